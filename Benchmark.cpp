@@ -0,0 +1,1542 @@
+/// Library
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Local
+#include "RectMorphology.h"
+#include "Shapedetector.h"
+
+// Options of the corpus suite
+static const std::string CORPUS_OPTION = "--corpus";
+static const std::string CORPUS_BATCH_OPTION = "--batch";
+static const std::string CORPUS_REPETITIONS_OPTION = "--repetitions";
+static const std::string CORPUS_WARM_UP_OPTION = "--warm-up";
+static const std::string CORPUS_JSON_OPTION = "--json";
+
+// The detection stages the corpus suite times, in the order recognize runs them
+static const Stage CORPUS_STAGES[] = {Stage::COLOR, Stage::NOISE, Stage::CONTOURS, Stage::CLASSIFY, Stage::DRAW};
+static const size_t CORPUS_STAGE_COUNT = sizeof(CORPUS_STAGES) / sizeof(CORPUS_STAGES[0]);
+
+// The allocations are counted while sCountAllocations is set, on every thread
+static std::atomic<bool> sCountAllocations(false);
+static std::atomic<uint64_t> sMatAllocations(0);
+static std::atomic<uint64_t> sNewCalls(0);
+
+void *operator new(size_t aSize)
+{
+    if (sCountAllocations)
+    {
+        sNewCalls++;
+    }
+    void *result = malloc((aSize > 0) ? aSize : 1);
+    if (result == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void operator delete(void *aPointer) noexcept
+{
+    free(aPointer);
+}
+
+void operator delete(void *aPointer, size_t) noexcept
+{
+    free(aPointer);
+}
+
+/**
+ * @brief Counts the Mat buffers that are allocated, the standard allocator does the work
+ */
+class CountingMatAllocator : public MatAllocator
+{
+public:
+    UMatData *allocate(int aDims, const int *aSizes, int aType, void *aData, size_t *aStep, int aFlags,
+                       UMatUsageFlags aUsageFlags) const override
+    {
+        if (sCountAllocations && aData == NULL)
+        {
+            sMatAllocations++;
+        }
+        return Mat::getStdAllocator()->allocate(aDims, aSizes, aType, aData, aStep, aFlags, aUsageFlags);
+    }
+
+    bool allocate(UMatData *aData, int aAccessFlags, UMatUsageFlags aUsageFlags) const override
+    {
+        return Mat::getStdAllocator()->allocate(aData, aAccessFlags, aUsageFlags);
+    }
+
+    void deallocate(UMatData *aData) const override
+    {
+        Mat::getStdAllocator()->deallocate(aData);
+    }
+};
+
+/**
+ * @brief Time a function, after one warm-up run
+ *
+ * @param aName The name to print
+ * @param aRepetitions The number of timed runs
+ * @param aFunction The function to time
+ * @return double The mean time per run in milliseconds
+ */
+static double timeFunction(const std::string &aName, int aRepetitions, const std::function<void()> &aFunction)
+{
+    aFunction(); // warm-up
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for (int i = 0; i < aRepetitions; i++)
+    {
+        aFunction();
+    }
+    std::chrono::duration<double, std::milli> totalTime = std::chrono::steady_clock::now() - startTime;
+
+    double meanTime = totalTime.count() / aRepetitions;
+    std::cout << "\t" << std::left << std::setw(36) << aName << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << meanTime << " ms" << std::endl;
+    return meanTime;
+}
+
+/**
+ * @brief Compare the fused color kernel with inRange per color
+ *
+ * @return bool true when the masks of every path are identical to inRange, also for ranges that wrap around and for
+ * packed masks at an offset in larger masks
+ */
+static bool benchmarkColorKernel(const Mat &aImage, int aRepetitions)
+{
+    Shapedetector shapeDetector;
+
+    // The limits of every color, one range each as the detector uses them
+    std::vector<Scalar> lowerLimits;
+    std::vector<Scalar> upperLimits;
+    std::vector<std::vector<ColorRange>> ranges;
+    for (size_t i = 0; i < COLORSTRINGS.size() - 1; i++)
+    {
+        Scalar lower;
+        Scalar upper;
+        shapeDetector.loadColorValues(COLORS(i), lower, upper);
+        lowerLimits.push_back(lower);
+        upperLimits.push_back(upper);
+        ranges.push_back(std::vector<ColorRange>(1, ScalarsToColorRange(lower, upper)));
+    }
+
+    std::cout << "Color masks for " << ranges.size() << " colors, " << aImage.cols << "x" << aImage.rows << std::endl;
+
+    // The conversion the color stage no longer does, its output was never used
+    Mat hsvImage;
+    timeFunction("removed cvtColor to HSV", aRepetitions, [&]() { cvtColor(aImage, hsvImage, CV_BGR2HSV); });
+
+    std::vector<Mat> referenceMasks(ranges.size());
+    double referenceTime = timeFunction("inRange per color", aRepetitions, [&]() {
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            inRange(aImage, lowerLimits.at(i), upperLimits.at(i), referenceMasks.at(i));
+        }
+    });
+
+    bool result = true;
+    const KernelPath paths[] = {KernelPath::SCALAR, KernelPath::SSSE3, KernelPath::AVX2};
+    for (KernelPath path : paths)
+    {
+        std::vector<Mat> fusedMasks;
+        double fusedTime = timeFunction("fused " + KernelPathToString(path), aRepetitions, [&]() {
+            fusedInRange(aImage, ranges, fusedMasks, path);
+        });
+
+        // The fused masks must be identical to the reference masks
+        int differentPixels = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            Mat difference;
+            absdiff(fusedMasks.at(i), referenceMasks.at(i), difference);
+            differentPixels += countNonZero(difference);
+        }
+        std::cout << "\t\tspeedup " << std::setprecision(2) << (referenceTime / fusedTime) << "x, "
+                  << differentPixels << " different pixels" << std::endl;
+        result = result && (differentPixels == 0);
+    }
+
+    // Ranges whose lower limit is above the upper limit select both ends of the channel, inRange needs two calls for that
+    const Scalar wrapLowers[] = {Scalar(200, 0, 0), Scalar(0, 230, 40), Scalar(250, 0, 180)};
+    const Scalar wrapUppers[] = {Scalar(40, 255, 120), Scalar(255, 60, 255), Scalar(5, 255, 90)};
+    std::vector<std::vector<ColorRange>> wrapRanges;
+    std::vector<Mat> wrapReferenceMasks;
+    for (size_t i = 0; i < sizeof(wrapLowers) / sizeof(wrapLowers[0]); i++)
+    {
+        wrapRanges.push_back(std::vector<ColorRange>(1, ScalarsToColorRange(wrapLowers[i], wrapUppers[i])));
+
+        // Split every wrapping channel into its two ends, a pixel matches when any combination of the ends holds it
+        std::vector<std::pair<Scalar, Scalar>> parts(1, std::make_pair(wrapLowers[i], wrapUppers[i]));
+        for (int c = 0; c < 3; c++)
+        {
+            if (wrapLowers[i][c] <= wrapUppers[i][c])
+            {
+                continue;
+            }
+            std::vector<std::pair<Scalar, Scalar>> splitParts;
+            for (std::pair<Scalar, Scalar> part : parts)
+            {
+                std::pair<Scalar, Scalar> upperEnd = part;
+                upperEnd.second[c] = 255;
+                std::pair<Scalar, Scalar> lowerEnd = part;
+                lowerEnd.first[c] = 0;
+                splitParts.push_back(upperEnd);
+                splitParts.push_back(lowerEnd);
+            }
+            parts.swap(splitParts);
+        }
+
+        Mat referenceMask = Mat::zeros(aImage.size(), CV_8U);
+        Mat partMask;
+        for (const std::pair<Scalar, Scalar> &part : parts)
+        {
+            inRange(aImage, part.first, part.second, partMask);
+            bitwise_or(referenceMask, partMask, referenceMask);
+        }
+        wrapReferenceMasks.push_back(referenceMask);
+    }
+
+    for (KernelPath path : paths)
+    {
+        std::vector<Mat> fusedMasks;
+        fusedInRange(aImage, wrapRanges, fusedMasks, path);
+
+        int differentPixels = 0;
+        for (size_t i = 0; i < wrapRanges.size(); i++)
+        {
+            Mat difference;
+            absdiff(fusedMasks.at(i), wrapReferenceMasks.at(i), difference);
+            differentPixels += countNonZero(difference);
+        }
+        std::cout << "\tfused " << KernelPathToString(path) << " with wrapping ranges: " << differentPixels << " different pixels"
+                  << std::endl;
+        result = result && (differentPixels == 0);
+    }
+
+    // The packed masks hold the same pixels in an eighth of the memory
+    std::vector<BitMask> packedMasks(ranges.size());
+    for (BitMask &packedMask : packedMasks)
+    {
+        packedMask.create(aImage.rows, aImage.cols);
+    }
+    double packedTime = timeFunction("fused packed " + KernelPathToString(bestKernelPath()), aRepetitions, [&]() {
+        fusedInRange(aImage, ranges, packedMasks);
+    });
+
+    int differentPixels = 0;
+    Mat unpacked;
+    Mat difference;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        packedMasks.at(i).toMat(unpacked);
+        absdiff(unpacked, referenceMasks.at(i), difference);
+        differentPixels += countNonZero(difference);
+    }
+    const size_t packedBytes = ranges.size() * (size_t)aImage.rows * packedMasks.front().wordsPerRow() * sizeof(uint64_t);
+    std::cout << "\t\tspeedup " << std::setprecision(2) << (referenceTime / packedTime) << "x, " << differentPixels
+              << " different pixels, " << packedBytes / 1024 << " KB of masks instead of " << ranges.size() * aImage.total() / 1024
+              << " KB" << std::endl;
+    result = result && (differentPixels == 0);
+
+    // A region of a larger image lands at its offset, which is not on a word boundary, and leaves the rest of the masks alone
+    const Rect region(Point(37, 5), aImage.size());
+    for (BitMask &packedMask : packedMasks)
+    {
+        packedMask.create(aImage.rows + 11, aImage.cols + 101);
+        packedMask.clear();
+    }
+    fusedInRange(aImage, ranges, packedMasks, region.tl());
+
+    int offsetDifferentPixels = 0;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        packedMasks.at(i).toMat(unpacked);
+        absdiff(unpacked(region), referenceMasks.at(i), difference);
+        offsetDifferentPixels += countNonZero(difference);
+        offsetDifferentPixels += countNonZero(unpacked) - countNonZero(unpacked(region));
+    }
+    std::cout << "\tfused packed at offset (" << region.x << ", " << region.y << "): " << offsetDifferentPixels
+              << " different pixels" << std::endl;
+    result = result && (offsetDifferentPixels == 0);
+    return result;
+}
+
+/**
+ * @brief Compare color lookup tables of several sizes with the fused kernel
+ */
+static void benchmarkColorLut(const Mat &aImage, int aRepetitions)
+{
+    Shapedetector shapeDetector;
+
+    std::vector<std::vector<ColorRange>> ranges;
+    std::vector<size_t> colors;
+    for (size_t i = 0; i < COLORSTRINGS.size() - 1; i++)
+    {
+        Scalar lower;
+        Scalar upper;
+        shapeDetector.loadColorValues(COLORS(i), lower, upper);
+        ranges.push_back(std::vector<ColorRange>(1, ScalarsToColorRange(lower, upper)));
+        colors.push_back(i);
+    }
+
+    std::cout << "Color lookup tables for " << ranges.size() << " colors, " << aImage.cols << "x" << aImage.rows << std::endl;
+
+    std::vector<Mat> referenceMasks;
+    double referenceTime = timeFunction("fused " + KernelPathToString(bestKernelPath()), aRepetitions, [&]() {
+        fusedInRange(aImage, ranges, referenceMasks);
+    });
+
+    const int bitsPerChannel[] = {4, 5, 6, 7, 8};
+    for (int bits : bitsPerChannel)
+    {
+        ColorLut colorLut;
+        std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+        colorLut.build(ranges, bits);
+        std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+
+        const int cells = 1 << bits;
+        std::vector<Mat> lutMasks;
+        double lutTime = timeFunction("lut " + std::to_string(cells) + "^3 (" + std::to_string(colorLut.tableBytes() / 1024) + " KB)",
+                                      aRepetitions, [&]() {
+                                          colorLut.apply(aImage, colors, lutMasks);
+                                      });
+
+        // Only the 8 bit table is exact, the others quantize the color limits
+        int differentPixels = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            Mat difference;
+            absdiff(lutMasks.at(i), referenceMasks.at(i), difference);
+            differentPixels += countNonZero(difference);
+        }
+        std::cout << "\t\tspeedup " << std::setprecision(2) << (referenceTime / lutTime) << "x, "
+                  << differentPixels << " different pixels, build " << std::setprecision(1) << buildTime.count() << " ms" << std::endl;
+    }
+}
+
+/**
+ * @brief Compare the opening of morphologyEx with the constant-time rectangular opening and the packed opening, for kernel sizes 1 to 50
+ *
+ * @return bool true when the openings, also of a region of the packed mask, are identical to morphologyEx for every kernel size
+ */
+static bool benchmarkMorphology(int aRepetitions)
+{
+    // A color mask: shapes on a grid with salt noise around them
+    Mat mask = Mat::zeros(1080, 1920, CV_8U);
+    for (int y = 30; y < mask.rows - 60; y += 90)
+    {
+        for (int x = 30; x < mask.cols - 60; x += 90)
+        {
+            rectangle(mask, Rect(x, y, 60, 45), Scalar(255), FILLED);
+        }
+    }
+    RNG rng(1);
+    for (int i = 0; i < 50000; i++)
+    {
+        mask.at<uchar>(rng.uniform(0, mask.rows), rng.uniform(0, mask.cols)) = 255;
+    }
+
+    const int kernelSizes[] = {1, 2, 3, 5, 7, 9, 15, 21, 31, 41, 50};
+    const int repetitions = std::max(1, aRepetitions / 10);
+    Mat openedCv;
+    Mat openedRect;
+    Mat difference;
+    RectMorphology morphology;
+    BitMask packedMask;
+    packedMask.fromMat(mask);
+    BitMask packedOpened;
+    Mat unpacked;
+    bool result = true;
+
+    std::cout << "Noise filter opening, 1920x1080 mask" << std::endl;
+    for (int kernelSize : kernelSizes)
+    {
+        // The structuring element is made once, as the frame context caches it
+        const Mat kernel = getStructuringElement(MORPH_RECT, Size(kernelSize, kernelSize));
+        double cvTime = timeFunction("morphologyEx " + std::to_string(kernelSize) + "x" + std::to_string(kernelSize), repetitions,
+                                     [&]() { morphologyEx(mask, openedCv, MORPH_OPEN, kernel); });
+        double rectTime = timeFunction("van Herk " + std::to_string(kernelSize) + "x" + std::to_string(kernelSize), repetitions,
+                                       [&]() { morphology.open(mask, openedRect, Size(kernelSize, kernelSize)); });
+
+        absdiff(openedCv, openedRect, difference);
+        const int rectDifferentPixels = countNonZero(difference);
+        std::cout << "\t\tspeedup " << std::setprecision(2) << (cvTime / rectTime) << "x, " << rectDifferentPixels
+                  << " different pixels" << std::endl;
+        result = result && (rectDifferentPixels == 0);
+
+        // The copy keeps the source, it reuses the storage of the previous repetition
+        double packedTime = timeFunction("packed " + std::to_string(kernelSize) + "x" + std::to_string(kernelSize), repetitions, [&]() {
+            packedOpened = packedMask;
+            packedOpened.open(Size(kernelSize, kernelSize));
+        });
+
+        packedOpened.toMat(unpacked);
+        absdiff(openedCv, unpacked, difference);
+        const int packedDifferentPixels = countNonZero(difference);
+        std::cout << "\t\tspeedup " << std::setprecision(2) << (cvTime / packedTime) << "x, " << packedDifferentPixels
+                  << " different pixels" << std::endl;
+        result = result && (packedDifferentPixels == 0);
+
+        // A region that does not start on a word boundary, opened on its own as the shape stage does and pasted back
+        const Rect region(45, 23, 301, 203);
+        BitMask packedRegion;
+        packedMask.copyRegion(region, packedRegion);
+        packedRegion.open(Size(kernelSize, kernelSize));
+        packedOpened = packedMask;
+        packedOpened.pasteRegion(packedRegion, region.tl());
+
+        // The clone has no parent, so morphologyEx does not look outside the region
+        Mat expected = mask.clone();
+        morphologyEx(mask(region).clone(), openedCv, MORPH_OPEN, kernel);
+        openedCv.copyTo(expected(region));
+        packedOpened.toMat(unpacked);
+        absdiff(expected, unpacked, difference);
+        const int regionDifferentPixels = countNonZero(difference);
+        if (regionDifferentPixels != 0)
+        {
+            std::cout << "\t\tregion opening: " << regionDifferentPixels << " different pixels" << std::endl;
+        }
+        result = result && (regionDifferentPixels == 0);
+    }
+
+    // The blobs of the noisy mask, labeled from the runs of the packed mask
+    BlobLabeler labeler;
+    Mat labels;
+    Mat stats;
+    Mat centroids;
+    int componentCount = 0;
+    double cvTime = timeFunction("connectedComponentsWithStats", repetitions, [&]() {
+        componentCount = connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+    });
+    double packedTime = timeFunction("packed blob labeler", repetitions, [&]() { labeler.label(packedMask); });
+    std::cout << "\t\tspeedup " << std::setprecision(2) << (cvTime / packedTime) << "x, " << labeler.blobs().size() << " blobs, "
+              << componentCount - 1 << " components" << std::endl;
+    return result;
+}
+
+/**
+ * @brief Check the blob labeler against findContours, the contour path it replaced
+ *
+ * Both run on the same mask of shapes and salt noise. Every contour of an
+ * allowed area must have a blob with the same bounding box and a traced
+ * contour with the same points, area and center.
+ *
+ * @return bool true when both paths found the same shapes
+ */
+static bool checkBlobLabeler(int aRepetitions)
+{
+    Mat mask = Mat::zeros(1080, 1920, CV_8U);
+    for (int y = 40; y < mask.rows - 40; y += 80)
+    {
+        for (int x = 40; x < mask.cols - 40; x += 80)
+        {
+            const int shape = (x / 80 + y / 80) % 4;
+            if (shape == 0)
+            {
+                rectangle(mask, Rect(x - 22, y - 16, 44, 32), Scalar(255), FILLED);
+            }
+            else if (shape == 1)
+            {
+                std::vector<Point> triangle = {Point(x, y - 22), Point(x - 24, y + 20), Point(x + 24, y + 20)};
+                fillConvexPoly(mask, triangle, Scalar(255));
+            }
+            else if (shape == 2)
+            {
+                circle(mask, Point(x, y), 22, Scalar(255), FILLED);
+            }
+            else
+            {
+                // Two shapes that touch at a corner are one 8-connected blob
+                rectangle(mask, Rect(x - 30, y - 30, 30, 30), Scalar(255), FILLED);
+                rectangle(mask, Rect(x, y, 25, 25), Scalar(255), FILLED);
+            }
+        }
+    }
+    RNG rng(2);
+    for (int i = 0; i < 20000; i++)
+    {
+        mask.at<uchar>(rng.uniform(0, mask.rows), rng.uniform(0, mask.cols)) = 255;
+    }
+    const double minArea = 300;
+    const double maxArea = 2800;
+    const int repetitions = std::max(1, aRepetitions / 10);
+
+    std::cout << "Blob labeler against findContours, 1920x1080 mask" << std::endl;
+
+    // The former path: findContours on a copy of the mask, measured with moments and boundingRect
+    Mat contourMask;
+    std::vector<std::vector<Point>> contours;
+    timeFunction("findContours", repetitions, [&]() {
+        mask.copyTo(contourMask);
+        findContours(contourMask, contours, CV_RETR_EXTERNAL, CHAIN_APPROX_NONE);
+    });
+
+    BlobLabeler labeler;
+    BitMask packedMask;
+    packedMask.fromMat(mask);
+    std::vector<Point> points;
+    std::vector<size_t> contourStarts;
+    timeFunction("blob labeler + trace", repetitions, [&]() {
+        labeler.label(packedMask);
+        points.clear();
+        contourStarts.clear();
+        for (size_t i = 0; i < labeler.blobs().size(); i++)
+        {
+            contourStarts.push_back(points.size());
+            labeler.traceContour(i, points);
+        }
+        contourStarts.push_back(points.size());
+    });
+
+    // The allowed contours of both paths, by bounding box
+    std::map<std::pair<int, int>, const std::vector<Point> *> referenceShapes;
+    for (const std::vector<Point> &contour : contours)
+    {
+        const double area = contourArea(contour);
+        if (area > minArea && area < maxArea)
+        {
+            const Rect box = boundingRect(contour);
+            referenceShapes[std::make_pair(box.y, box.x)] = &contour;
+        }
+    }
+
+    size_t labeledCount = 0;
+    size_t differentCount = 0;
+    for (size_t i = 0; i < labeler.blobs().size(); i++)
+    {
+        const std::vector<Point> traced(points.begin() + (long)contourStarts.at(i), points.begin() + (long)contourStarts.at(i + 1));
+        const double area = traced.empty() ? 0.0 : contourArea(traced);
+        if ((area > minArea && area < maxArea) == false)
+        {
+            continue;
+        }
+        labeledCount++;
+
+        const Rect &box = labeler.blobs().at(i).boundingBox;
+        std::map<std::pair<int, int>, const std::vector<Point> *>::const_iterator reference =
+            referenceShapes.find(std::make_pair(box.y, box.x));
+        if (reference == referenceShapes.end())
+        {
+            differentCount++;
+            continue;
+        }
+        const std::vector<Point> &contour = *reference->second;
+        const Moments referenceMoments = moments(contour);
+        const Moments tracedMoments = moments(traced);
+        const bool same = boundingRect(contour) == box && contour == traced && referenceMoments.m00 == tracedMoments.m00 &&
+                          referenceMoments.m10 == tracedMoments.m10 && referenceMoments.m01 == tracedMoments.m01;
+        differentCount += same ? 0 : 1;
+    }
+    differentCount += (referenceShapes.size() > labeledCount) ? referenceShapes.size() - labeledCount : 0;
+
+    std::cout << "\t\t" << referenceShapes.size() << " / " << labeledCount << " shapes of an allowed area, " << differentCount
+              << " different" << std::endl;
+    return differentCount == 0;
+}
+
+/**
+ * @brief Compare measuring every contour per query with computing its features once
+ */
+static void benchmarkContourFeatures(int aRepetitions)
+{
+    // A frame with hundreds of contours: rectangles, triangles and circles on a grid
+    Mat mask = Mat::zeros(1080, 1920, CV_8U);
+    for (int y = 30; y < mask.rows - 30; y += 60)
+    {
+        for (int x = 30; x < mask.cols - 30; x += 60)
+        {
+            const int shape = (x / 60 + y / 60) % 3;
+            if (shape == 0)
+            {
+                rectangle(mask, Rect(x - 22, y - 16, 44, 32), Scalar(255), FILLED);
+            }
+            else if (shape == 1)
+            {
+                std::vector<Point> triangle = {Point(x, y - 22), Point(x - 24, y + 20), Point(x + 24, y + 20)};
+                fillConvexPoly(mask, triangle, Scalar(255));
+            }
+            else
+            {
+                circle(mask, Point(x, y), 22, Scalar(255), FILLED);
+            }
+        }
+    }
+    std::vector<Mat> contours;
+    Mat contourMask = mask.clone();
+    findContours(contourMask, contours, CV_RETR_EXTERNAL, CHAIN_APPROX_NONE);
+
+    const double epsilonMultiply = 0.03;
+    const double minArea = 300;
+    const double maxArea = 2800;
+    const int margin = 30;
+    const int queryCount = 4; // queries for the same color, as in example_batch.txt
+    const int repetitions = std::max(1, aRepetitions / 10);
+
+    std::cout << "Contour features for " << contours.size() << " contours, " << queryCount << " queries" << std::endl;
+
+    // Every query measures every contour again, the center is recomputed for every pair
+    int perQueryMatches = 0;
+    double perQueryTime = timeFunction("measure per query", repetitions, [&]() {
+        perQueryMatches = 0;
+        for (size_t i = 0; i < contours.size(); i++)
+        {
+            Moments current = moments(contours.at(i));
+            for (size_t j = 0; j < contours.size(); j++)
+            {
+                Moments compare = moments(contours.at(j));
+                if (j != i && std::abs((int)(current.m10 / current.m00) - (int)(compare.m10 / compare.m00)) <= margin &&
+                    std::abs((int)(current.m01 / current.m00) - (int)(compare.m01 / compare.m00)) <= margin)
+                {
+                    perQueryMatches--;
+                }
+            }
+        }
+        Mat approx;
+        for (int query = 0; query < queryCount; query++)
+        {
+            for (const Mat &contour : contours)
+            {
+                if (contourArea(contour) > minArea && contourArea(contour) < maxArea)
+                {
+                    approxPolyDP(contour, approx, epsilonMultiply * arcLength(contour, true), true);
+                    Rect boundedRect = boundingRect(contour);
+                    if (approx.rows == 4 + query % 2 && contourArea(contour) < boundedRect.area())
+                    {
+                        Moments contourMoments = moments(contour);
+                        perQueryMatches += (contourMoments.m00 > 0) ? 1 : 0;
+                    }
+                }
+            }
+        }
+    });
+
+    // The features are computed once, the queries and the center check read the arrays
+    ContourFeatures features;
+    std::vector<Point> approxPoints;
+    int featureMatches = 0;
+    double featureTime = timeFunction("features once", repetitions, [&]() {
+        featureMatches = 0;
+        computeContourFeatures(contours, epsilonMultiply, minArea, maxArea, features, approxPoints);
+        for (size_t i = 0; i < features.size(); i++)
+        {
+            for (size_t j = 0; j < features.size(); j++)
+            {
+                if (j != i && std::abs(features.centers.at(i).x - features.centers.at(j).x) <= margin &&
+                    std::abs(features.centers.at(i).y - features.centers.at(j).y) <= margin)
+                {
+                    featureMatches--;
+                }
+            }
+        }
+        for (int query = 0; query < queryCount; query++)
+        {
+            for (size_t i = 0; i < features.size(); i++)
+            {
+                if (features.areas.at(i) > minArea && features.areas.at(i) < maxArea &&
+                    features.vertexCounts.at(i) == 4 + query % 2 && features.fillRatios.at(i) < 1.0)
+                {
+                    featureMatches++;
+                }
+            }
+        }
+    });
+
+    std::cout << "\t\tspeedup " << std::setprecision(2) << (perQueryTime / featureTime) << "x, "
+              << perQueryMatches << " / " << featureMatches << " matches" << std::endl;
+}
+
+/**
+ * @brief Compare the pairwise removal of close shapes with the spatial grid
+ */
+static void benchmarkCloseShapes(int aRepetitions)
+{
+    const int margin = 30;
+    const size_t blobCounts[] = {10, 100, 1000, 10000};
+
+    std::cout << "Close shape removal, margin " << margin << std::endl;
+    for (size_t blobCount : blobCounts)
+    {
+        // Random centers in a 1080p frame, as from noise blobs
+        RNG rng(blobCount);
+        std::vector<Point> centers(blobCount);
+        for (Point &center : centers)
+        {
+            center = Point(rng.uniform(0, 1920), rng.uniform(0, 1080));
+        }
+        const int repetitions = std::max(1, (blobCount >= 1000) ? aRepetitions / 20 : aRepetitions);
+
+        // The former removal: every pair, erasing in the middle of the loop
+        size_t pairwiseKept = 0;
+        double pairwiseTime = timeFunction("pairwise " + std::to_string(blobCount) + " blobs", repetitions, [&]() {
+            std::vector<Point> remaining = centers;
+            for (size_t i = 0; i < remaining.size(); i++)
+            {
+                for (size_t j = 0; j < remaining.size(); j++)
+                {
+                    if (j != i && abs(remaining.at(i).x - remaining.at(j).x) <= margin &&
+                        abs(remaining.at(i).y - remaining.at(j).y) <= margin)
+                    {
+                        remaining.erase(remaining.begin() + (long)j);
+                    }
+                }
+            }
+            pairwiseKept = remaining.size();
+        });
+
+        SpatialGrid grid;
+        size_t gridKept = 0;
+        double gridTime = timeFunction("grid " + std::to_string(blobCount) + " blobs", repetitions, [&]() {
+            const std::vector<uchar> &keep = grid.suppressNearDuplicates(centers, margin);
+            gridKept = (size_t)std::count(keep.begin(), keep.end(), 1);
+        });
+
+        std::cout << "\t\tspeedup " << std::setprecision(2) << (pairwiseTime / gridTime) << "x, kept "
+                  << pairwiseKept << " / " << gridKept << std::endl;
+    }
+}
+
+/**
+ * @brief Make a grey frame with shapes in the middle of their color ranges, as on a table seen from above
+ *
+ * @param aFrameSize The size of the frame
+ * @param aShapeCount The number of shapes drawn
+ * @return Mat The frame
+ */
+static Mat makeTableFrame(Size aFrameSize, int &aShapeCount)
+{
+    Mat frame(aFrameSize, CV_8UC3, Scalar(200, 200, 200));
+    const Scalar colors[] = {Scalar(25, 42, 162), Scalar(100, 127, 25), Scalar(82, 40, 22)};
+    aShapeCount = 0;
+    for (int y = 60; y < aFrameSize.height - 60; y += 240)
+    {
+        for (int x = 60; x < aFrameSize.width - 60; x += 320)
+        {
+            const Scalar &color = colors[aShapeCount % 3];
+            if (aShapeCount % 2 == 0)
+            {
+                rectangle(frame, Rect(x, y, 40, 40), color, FILLED);
+            }
+            else
+            {
+                rectangle(frame, Rect(x, y, 60, 30), color, FILLED);
+            }
+            aShapeCount++;
+        }
+    }
+    return frame;
+}
+
+/**
+ * @brief Add the queries that find every shape of makeTableFrame once, a square is a rectangle too
+ */
+static void addTableQueries(Shapedetector &aShapeDetector)
+{
+    aShapeDetector.addSpec("rechthoek rood");
+    aShapeDetector.addSpec("rechthoek groen");
+    aShapeDetector.addSpec("rechthoek blauw");
+}
+
+/**
+ * @brief Compare detecting the full frame with detecting the candidates of a pyramid level
+ *
+ * @return bool true when every level found every shape of the frame
+ */
+static bool benchmarkPyramid(int aRepetitions)
+{
+    const Size frameSizes[] = {Size(1280, 720), Size(1920, 1080), Size(3840, 2160)};
+    const int levels[] = {0, 1, 2};
+
+    bool result = true;
+    std::cout << "Coarse-to-fine detection, shapes of a fixed size" << std::endl;
+    for (const Size &frameSize : frameSizes)
+    {
+        int shapeCount = 0;
+        const Mat frame = makeTableFrame(frameSize, shapeCount);
+        const int repetitions = std::max(1, aRepetitions / ((frameSize.width > 1920) ? 20 : 5));
+
+        double fullTime = 0.0;
+        for (int level : levels)
+        {
+            Shapedetector shapeDetector;
+            addTableQueries(shapeDetector);
+            shapeDetector.setPyramidLevels(level);
+
+            FrameContext context;
+            context.originalImage = frame;
+            int found = 0;
+            const double time = timeFunction(std::to_string(frameSize.width) + "x" + std::to_string(frameSize.height) +
+                                                 " level " + std::to_string(level),
+                                             repetitions, [&]() {
+                                                 shapeDetector.reset(context);
+                                                 shapeDetector.recognize(context);
+                                                 found = 0;
+                                                 for (int count : context.result.shapeCounts)
+                                                 {
+                                                     found += count;
+                                                 }
+                                             });
+            fullTime = (level == 0) ? time : fullTime;
+            std::cout << "\t\tspeedup " << std::setprecision(2) << (fullTime / time) << "x, " << shapeCount
+                      << " shapes, found " << found << ", processed " << std::setprecision(1)
+                      << (context.result.processedFraction * 100.0) << "%" << std::endl;
+            if (found != shapeCount)
+            {
+                std::cout << "\t\tError: found " << found << " of " << shapeCount << " shapes" << std::endl;
+                result = false;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Count the allocations of detecting the same frame over and over, after warm-up
+ *
+ * Every buffer of a frame lives in its context, so once the context has seen
+ * a frame of that size neither a Mat buffer nor anything through operator
+ * new may be allocated anymore, and every query still finds its shapes.
+ *
+ * @return bool true when the steady state allocated nothing and found every shape
+ */
+static bool benchmarkSteadyState(int aRepetitions)
+{
+    struct Configuration
+    {
+        std::string name;
+        int colorLutBits;
+        int pyramidLevels;
+    };
+    const Configuration configurations[] = {{"fused kernel", 0, 0}, {"lookup table", 5, 0}, {"pyramid level 1", 0, 1}};
+    const int warmUpFrames = 3;
+
+    int shapeCount = 0;
+    const Mat frame = makeTableFrame(Size(1920, 1080), shapeCount);
+    CountingMatAllocator matAllocator;
+    MatAllocator *defaultAllocator = Mat::getDefaultAllocator();
+    Mat::setDefaultAllocator(&matAllocator);
+
+    bool result = true;
+    std::cout << "Steady-state allocations per frame, 1920x1080, " << shapeCount << " shapes" << std::endl;
+    for (const Configuration &configuration : configurations)
+    {
+        Shapedetector shapeDetector;
+        addTableQueries(shapeDetector);
+        shapeDetector.setHeadless(true);
+        shapeDetector.setColorLut(configuration.colorLutBits);
+        shapeDetector.setPyramidLevels(configuration.pyramidLevels);
+
+        FrameContext context;
+        context.originalImage = frame;
+        for (int i = 0; i < warmUpFrames; i++)
+        {
+            shapeDetector.reset(context);
+            shapeDetector.recognize(context);
+        }
+
+        sMatAllocations = 0;
+        sNewCalls = 0;
+        sCountAllocations = true;
+        for (int i = 0; i < aRepetitions; i++)
+        {
+            shapeDetector.reset(context);
+            shapeDetector.recognize(context);
+        }
+        sCountAllocations = false;
+
+        int found = 0;
+        for (int count : context.result.shapeCounts)
+        {
+            found += count;
+        }
+        const uint64_t matAllocations = sMatAllocations;
+        const uint64_t newCalls = sNewCalls;
+        std::cout << "\t" << std::left << std::setw(36) << configuration.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(8) << ((double)matAllocations / aRepetitions) << " Mat buffers, " << std::setw(8)
+                  << ((double)newCalls / aRepetitions) << " operator new, found " << found << std::endl;
+        result = result && (matAllocations == 0) && (newCalls == 0) && (found == shapeCount);
+    }
+
+    Mat::setDefaultAllocator(defaultAllocator);
+    return result;
+}
+
+/**
+ * @brief Detect the frames a producer thread publishes into a shared memory ring, as a capture process would
+ *
+ * The detector reads every frame through FrameGrabber::openShared as a header
+ * on its slot, so no frame may be copied before detection. A frame the
+ * producer overwrote during detection is counted as torn and not checked.
+ *
+ * @return bool true when no frame was copied and every intact frame showed every shape
+ */
+static bool benchmarkSharedRing(int aRepetitions)
+{
+    int shapeCount = 0;
+    const Mat frame = makeTableFrame(Size(1920, 1080), shapeCount);
+    const std::string ringName = "/shapedetector_bench_" + std::to_string(getpid());
+    const std::chrono::milliseconds frameInterval(10);
+    const size_t slotCount = 8; // a frame stays in the ring for 80 ms, longer than a detection
+
+    SharedFrameRing producer;
+    FrameGrabber grabber;
+    if (producer.create(ringName, frame.cols, frame.rows, frame.type(), slotCount) == false || grabber.openShared(ringName) == false)
+    {
+        std::cout << "Error: could not create the shared frame ring (" << ringName << ")" << std::endl;
+        return false;
+    }
+
+    Shapedetector shapeDetector;
+    addTableQueries(shapeDetector);
+    shapeDetector.setHeadless(true);
+    FrameContext context;
+
+    // The frame after the stop flag wakes the detector when it waits for the next one
+    std::atomic<bool> producerDone(false);
+    std::thread producerThread([&]() {
+        for (int i = 0; i < aRepetitions; i++)
+        {
+            producer.publish(frame, std::chrono::steady_clock::now());
+            std::this_thread::sleep_for(frameInterval);
+        }
+        producerDone = true;
+        producer.publish(frame, std::chrono::steady_clock::now());
+    });
+
+    uint64_t frameCopies = 0;
+    uint64_t checkedFrames = 0;
+    uint64_t incompleteFrames = 0;
+    while (producerDone == false)
+    {
+        Mat sharedFrame;
+        std::chrono::steady_clock::time_point captureTime;
+        if (grabber.acquire(sharedFrame, captureTime) == false)
+        {
+            break;
+        }
+
+        // A header on the slot owns no buffer, a copy of the frame would
+        frameCopies += (sharedFrame.u != NULL) ? 1 : 0;
+        context.originalImage = sharedFrame;
+        shapeDetector.reset(context);
+        shapeDetector.recognize(context);
+        if (grabber.frameIntact())
+        {
+            int found = 0;
+            for (int count : context.result.shapeCounts)
+            {
+                found += count;
+            }
+            checkedFrames++;
+            incompleteFrames += (found == shapeCount) ? 0 : 1;
+        }
+    }
+    grabber.release();
+    producerThread.join();
+
+    std::cout << "Shared frame ring, 1920x1080, " << slotCount << " slots, a frame every " << frameInterval.count() << " ms" << std::endl;
+    std::cout << "\t" << grabber.capturedCount() << " frames detected, " << grabber.droppedCount() << " skipped, "
+              << grabber.tornCount() << " overwritten during detection" << std::endl;
+    std::cout << "\t\t" << frameCopies << " frame copies, " << incompleteFrames << " of " << checkedFrames
+              << " intact frames missed shapes" << std::endl;
+    grabber.close();
+    producer.close();
+    return frameCopies == 0 && checkedFrames > 0 && incompleteFrames == 0;
+}
+
+/**
+ * @brief Run two webcam commands on a shared memory source with a result server client connected through both
+ *
+ * The client adds a query during the first command. The server must keep
+ * serving it during the second command, with that query still active next
+ * to the typed one.
+ *
+ * @return bool true when the second command served records that hold the query of the client
+ */
+static bool checkResultServer()
+{
+    int shapeCount = 0;
+    const Mat frame = makeTableFrame(Size(640, 480), shapeCount);
+    const std::string suffix = std::to_string(getpid());
+    const std::string ringName = "/shapedetector_serve_" + suffix;
+    const std::string socketPath = "/tmp/shapedetector_serve_" + suffix + ".sock";
+    const std::string profilePath = "/tmp/shapedetector_serve_" + suffix + ".profile";
+    const int framesPerCommand = 50;
+    const std::chrono::milliseconds frameInterval(10);
+    const std::chrono::seconds commandPause(3); // longer than the shared frame timeout, which ends a command
+
+    // A profile instead of the calibration windows
+    Shapedetector shapeDetector;
+    CalibrationProfile profile;
+    shapeDetector.exportProfile(profile);
+    SharedFrameRing producer;
+    if (profile.save(profilePath) == false || producer.create(ringName, frame.cols, frame.rows, frame.type(), PUBLISH_SLOT_COUNT) == false ||
+        shapeDetector.setResultServer("unix:" + socketPath) == false)
+    {
+        std::cout << "Error: could not prepare the result server check" << std::endl;
+        return false;
+    }
+    shapeDetector.setHeadless(true);
+    shapeDetector.setProfile(profilePath);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+    const int clientSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    const std::string clientQuery = "rechthoek blauw\n";
+    if (clientSocket < 0 || connect(clientSocket, (const sockaddr *)&address, sizeof(address)) != 0 ||
+        send(clientSocket, clientQuery.data(), clientQuery.size(), MSG_NOSIGNAL) != (ssize_t)clientQuery.size())
+    {
+        std::cout << "Error: could not connect to the result server (" << socketPath << ")" << std::endl;
+        return false;
+    }
+
+    // The client reads until the server closes the connection at the end of the mode
+    std::string received;
+    std::thread clientThread([&]() {
+        char buffer[4096];
+        ssize_t readSize = 0;
+        while ((readSize = recv(clientSocket, buffer, sizeof(buffer), 0)) > 0)
+        {
+            received.append(buffer, (size_t)readSize);
+        }
+    });
+    std::thread producerThread([&]() {
+        for (int command = 0; command < 2; command++)
+        {
+            for (int i = 0; i < framesPerCommand; i++)
+            {
+                producer.publish(frame, std::chrono::steady_clock::now());
+                std::this_thread::sleep_for(frameInterval);
+            }
+            std::this_thread::sleep_for(commandPause);
+        }
+    });
+
+    // The commands are typed on the standard input
+    std::istringstream commands("rechthoek rood\nrechthoek groen\n" + EXIT_COMMAND + "\n");
+    std::streambuf *standardInput = std::cin.rdbuf(commands.rdbuf());
+    shapeDetector.webcamMode("shm:" + ringName);
+    std::cin.rdbuf(standardInput);
+    producerThread.join();
+    clientThread.join();
+    close(clientSocket);
+    unlink(profilePath.c_str());
+
+    // Only the second command has the green query, every one of its records must have the query of the client
+    size_t firstRecords = 0;
+    size_t secondRecords = 0;
+    size_t withoutClientQuery = 0;
+    std::istringstream records(received);
+    std::string record;
+    while (getline(records, record))
+    {
+        if (record.find("\"rechthoek rood\"") != std::string::npos)
+        {
+            firstRecords++;
+        }
+        else if (record.find("\"rechthoek groen\"") != std::string::npos)
+        {
+            secondRecords++;
+            withoutClientQuery += (record.find("\"rechthoek blauw\"") == std::string::npos) ? 1 : 0;
+        }
+    }
+
+    std::cout << "Result server over two webcam commands" << std::endl;
+    std::cout << "\t\t" << firstRecords << " records of the first command, " << secondRecords << " of the second, "
+              << withoutClientQuery << " without the query of the client" << std::endl;
+    return secondRecords > 0 && withoutClientQuery == 0;
+}
+
+/**
+ * @brief The mean of repeated measurements and the 95% confidence interval of that mean
+ */
+struct Measurement
+{
+    double mean;
+    double standardDeviation;
+    double confidence95; // half the width of the interval
+    double minimum;
+    double maximum;
+};
+
+/**
+ * @brief The results of replaying the corpus with one set of queries
+ */
+struct CorpusResult
+{
+    std::string name;
+    std::vector<std::string> queries;
+    int shapesFound; // over every image of one pass, equal in every pass
+    Measurement framesPerSecond;
+    Measurement frameTime;               // milliseconds per frame
+    std::vector<Measurement> stageTimes; // milliseconds per frame, one per corpus stage
+};
+
+/**
+ * @brief Get the two-sided 95% quantile of Student's t distribution
+ */
+static double studentT95(size_t aDegreesOfFreedom)
+{
+    static const double quantiles[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                       2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                       2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (aDegreesOfFreedom == 0)
+    {
+        return 0.0; // a single sample has no interval
+    }
+    return (aDegreesOfFreedom <= 30) ? quantiles[aDegreesOfFreedom - 1] : 1.960;
+}
+
+/**
+ * @brief Summarize the samples of repeated measurements
+ */
+static Measurement summarize(const std::vector<double> &aSamples)
+{
+    Measurement result = {0.0, 0.0, 0.0, 0.0, 0.0};
+    if (aSamples.empty())
+    {
+        return result;
+    }
+
+    const double count = (double)aSamples.size();
+    for (double sample : aSamples)
+    {
+        result.mean += sample / count;
+    }
+    double squaredDeviations = 0.0;
+    for (double sample : aSamples)
+    {
+        squaredDeviations += (sample - result.mean) * (sample - result.mean);
+    }
+    result.standardDeviation = (aSamples.size() > 1) ? std::sqrt(squaredDeviations / (count - 1.0)) : 0.0;
+    result.confidence95 = studentT95(aSamples.size() - 1) * result.standardDeviation / std::sqrt(count);
+    result.minimum = *std::min_element(aSamples.begin(), aSamples.end());
+    result.maximum = *std::max_element(aSamples.begin(), aSamples.end());
+    return result;
+}
+
+/**
+ * @brief Run one detection stage on a frame
+ */
+static void runDetectionStage(const Shapedetector &aShapeDetector, Stage aStage, FrameContext &aContext)
+{
+    switch (aStage)
+    {
+        case Stage::COLOR:
+            aShapeDetector.filterColors(aContext);
+            break;
+        case Stage::NOISE:
+            aShapeDetector.filterNoise(aContext);
+            break;
+        case Stage::CONTOURS:
+            aShapeDetector.findShapeContours(aContext);
+            break;
+        case Stage::CLASSIFY:
+            aShapeDetector.classifyShapes(aContext);
+            break;
+        case Stage::DRAW:
+            aShapeDetector.drawShapes(aContext);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Detect every image of the corpus, stage by stage, for warm-up and then timed passes
+ *
+ * A pass detects every image once. Every timed pass gives one sample of the
+ * frame rate and of the mean time per frame of every stage, the confidence
+ * intervals are over those samples.
+ *
+ * @param aShapeDetector The detector with the queries of this configuration
+ * @param aImages The decoded images of the corpus
+ * @param aWarmUp The number of passes that are not timed
+ * @param aRepetitions The number of timed passes
+ * @param aResult The result to fill, its name and queries are kept
+ */
+static void replayCorpus(const Shapedetector &aShapeDetector, const std::vector<Mat> &aImages, int aWarmUp, int aRepetitions,
+                         CorpusResult &aResult)
+{
+    FrameContext context; // reused by every frame, as in the live modes
+    std::vector<double> frameRates;
+    std::vector<double> frameTimes;
+    std::vector<std::vector<double>> stageTimes(CORPUS_STAGE_COUNT);
+    const double frameCount = (double)aImages.size();
+
+    for (int pass = -aWarmUp; pass < aRepetitions; pass++)
+    {
+        std::vector<double> stageTotals(CORPUS_STAGE_COUNT, 0.0);
+        int shapesFound = 0;
+        const std::chrono::steady_clock::time_point passStart = std::chrono::steady_clock::now();
+        for (const Mat &image : aImages)
+        {
+            context.originalImage = image;
+            aShapeDetector.reset(context);
+            for (size_t stage = 0; stage < CORPUS_STAGE_COUNT; stage++)
+            {
+                const std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+                runDetectionStage(aShapeDetector, CORPUS_STAGES[stage], context);
+                const std::chrono::duration<double, std::milli> stageTime = std::chrono::steady_clock::now() - stageStart;
+                stageTotals.at(stage) += stageTime.count();
+            }
+            for (int count : context.result.shapeCounts)
+            {
+                shapesFound += count;
+            }
+        }
+        const std::chrono::duration<double, std::milli> passTime = std::chrono::steady_clock::now() - passStart;
+
+        aResult.shapesFound = shapesFound;
+        if (pass < 0)
+        {
+            continue; // warm-up
+        }
+        frameRates.push_back(frameCount * 1000.0 / passTime.count());
+        frameTimes.push_back(passTime.count() / frameCount);
+        for (size_t stage = 0; stage < CORPUS_STAGE_COUNT; stage++)
+        {
+            stageTimes.at(stage).push_back(stageTotals.at(stage) / frameCount);
+        }
+    }
+
+    aResult.framesPerSecond = summarize(frameRates);
+    aResult.frameTime = summarize(frameTimes);
+    aResult.stageTimes.clear();
+    for (const std::vector<double> &samples : stageTimes)
+    {
+        aResult.stageTimes.push_back(summarize(samples));
+    }
+}
+
+/**
+ * @brief Quote a string for JSON
+ */
+static std::string jsonString(const std::string &aText)
+{
+    std::ostringstream result;
+    result << '"';
+    for (char character : aText)
+    {
+        if (character == '"' || character == '\\')
+        {
+            result << '\\' << character;
+        }
+        else if ((unsigned char)character < 0x20)
+        {
+            result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)(unsigned char)character << std::dec;
+        }
+        else
+        {
+            result << character;
+        }
+    }
+    result << '"';
+    return result.str();
+}
+
+/**
+ * @brief Write a measurement as a JSON object
+ */
+static void writeJsonMeasurement(std::ostream &aStream, const Measurement &aMeasurement)
+{
+    aStream << "{\"mean\": " << aMeasurement.mean << ", \"ci95\": " << aMeasurement.confidence95 << ", \"stddev\": "
+            << aMeasurement.standardDeviation << ", \"min\": " << aMeasurement.minimum << ", \"max\": " << aMeasurement.maximum << "}";
+}
+
+/**
+ * @brief Write the corpus results as JSON, with everything needed to compare two builds
+ *
+ * @return bool false when the file could not be written
+ */
+static bool writeCorpusJson(const std::string &aPath, const std::vector<std::string> &aImagePaths, const std::string &aBatchPath,
+                            int aWarmUp, int aRepetitions, const std::vector<CorpusResult> &aResults)
+{
+    std::ofstream file(aPath);
+    if (file.is_open() == false)
+    {
+        return false;
+    }
+
+    file << std::fixed << std::setprecision(4);
+    file << "{" << std::endl;
+    file << "  \"suite\": \"corpus\"," << std::endl;
+    file << "  \"opencv\": " << jsonString(CV_VERSION) << "," << std::endl;
+#if defined(__VERSION__)
+    file << "  \"compiler\": " << jsonString(__VERSION__) << "," << std::endl;
+#endif
+    file << "  \"kernel\": " << jsonString(KernelPathToString(bestKernelPath())) << "," << std::endl;
+    file << "  \"opencv_threads\": " << getNumThreads() << "," << std::endl;
+    file << "  \"batch\": " << jsonString(aBatchPath) << "," << std::endl;
+    file << "  \"warm_up\": " << aWarmUp << "," << std::endl;
+    file << "  \"repetitions\": " << aRepetitions << "," << std::endl;
+    file << "  \"images\": [";
+    for (size_t i = 0; i < aImagePaths.size(); i++)
+    {
+        file << ((i == 0) ? "" : ", ") << jsonString(aImagePaths.at(i));
+    }
+    file << "]," << std::endl;
+
+    file << "  \"configurations\": [" << std::endl;
+    for (size_t i = 0; i < aResults.size(); i++)
+    {
+        const CorpusResult &result = aResults.at(i);
+        file << "    {" << std::endl;
+        file << "      \"name\": " << jsonString(result.name) << "," << std::endl;
+        file << "      \"queries\": [";
+        for (size_t j = 0; j < result.queries.size(); j++)
+        {
+            file << ((j == 0) ? "" : ", ") << jsonString(result.queries.at(j));
+        }
+        file << "]," << std::endl;
+        file << "      \"shapes_found\": " << result.shapesFound << "," << std::endl;
+        file << "      \"frames_per_second\": ";
+        writeJsonMeasurement(file, result.framesPerSecond);
+        file << "," << std::endl;
+        file << "      \"frame_ms\": ";
+        writeJsonMeasurement(file, result.frameTime);
+        file << "," << std::endl;
+        file << "      \"stage_ms\": {" << std::endl;
+        for (size_t stage = 0; stage < CORPUS_STAGE_COUNT; stage++)
+        {
+            file << "        " << jsonString(StageToString(CORPUS_STAGES[stage])) << ": ";
+            writeJsonMeasurement(file, result.stageTimes.at(stage));
+            file << ((stage + 1 < CORPUS_STAGE_COUNT) ? "," : "") << std::endl;
+        }
+        file << "      }" << std::endl;
+        file << "    }" << ((i + 1 < aResults.size()) ? "," : "") << std::endl;
+    }
+    file << "  ]" << std::endl;
+    file << "}" << std::endl;
+    return file.good();
+}
+
+/**
+ * @brief Print a measurement as its mean and confidence interval
+ */
+static void printMeasurement(const std::string &aName, const Measurement &aMeasurement, const std::string &aUnit)
+{
+    std::cout << "\t" << std::left << std::setw(36) << aName << std::right << std::fixed << std::setprecision(3) << std::setw(10)
+              << aMeasurement.mean << " +- " << std::setw(7) << aMeasurement.confidence95 << " " << aUnit << std::endl;
+}
+
+/**
+ * @brief Replay the image corpus with all queries of a batch file together and with every query alone
+ *
+ * Usage: shapedetector_bench --corpus [data directory] [--batch file] [--repetitions n] [--warm-up n] [--json file]
+ *
+ * @return int The exit status
+ */
+static int benchmarkCorpus(int argc, char **argv)
+{
+    std::string dataPath = "data";
+    std::string batchPath;
+    std::string jsonPath;
+    int repetitions = 10;
+    int warmUp = 2;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        if (argument == CORPUS_OPTION && hasValue)
+        {
+            dataPath = argv[++i];
+        }
+        else if (argument == CORPUS_BATCH_OPTION && hasValue)
+        {
+            batchPath = argv[++i];
+        }
+        else if (argument == CORPUS_REPETITIONS_OPTION && hasValue)
+        {
+            repetitions = std::max(1, atoi(argv[++i]));
+        }
+        else if (argument == CORPUS_WARM_UP_OPTION && hasValue)
+        {
+            warmUp = std::max(0, atoi(argv[++i]));
+        }
+        else if (argument == CORPUS_JSON_OPTION && hasValue)
+        {
+            jsonPath = argv[++i];
+        }
+        else
+        {
+            std::cout << "Error: invalid argument (" << argument << "), usage:" << std::endl;
+            std::cout << "\tshapedetector_bench --corpus [data directory] [--batch file] [--repetitions n] [--warm-up n] [--json file]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (batchPath.empty())
+    {
+        batchPath = dataPath + "/../example_batch.txt";
+    }
+
+    // The corpus is decoded once, in a fixed order
+    const std::string patterns[] = {"/camera/*.jpg", "/webcam/*", "/blocks.png"};
+    std::vector<std::string> imagePaths;
+    std::vector<Mat> images;
+    for (const std::string &pattern : patterns)
+    {
+        std::vector<std::string> paths;
+        glob(dataPath + pattern, paths, false);
+        std::sort(paths.begin(), paths.end());
+        for (const std::string &path : paths)
+        {
+            Mat image = imread(path, IMREAD_COLOR);
+            if (image.empty())
+            {
+                std::cout << "Warning: skipping unreadable image (" << path << ")" << std::endl;
+                continue;
+            }
+            imagePaths.push_back(path);
+            images.push_back(image);
+        }
+    }
+
+    // All queries of the batch file together, as batch mode runs them, then every query alone
+    std::vector<std::string> commands;
+    std::ifstream batchFile(batchPath);
+    std::string line;
+    while (std::getline(batchFile, line))
+    {
+        ShapeQuery query;
+        if (line.empty() == false && line.at(0) != COMMENT_CHARACTER && Shapedetector::parseQuery(line, query))
+        {
+            commands.push_back(line);
+        }
+    }
+    if (images.empty() || commands.empty())
+    {
+        std::cout << "Error: no images in " << dataPath << " or no queries in " << batchPath << std::endl;
+        return 1;
+    }
+
+    std::vector<CorpusResult> results(commands.size() + 1);
+    results.front().name = "all queries";
+    results.front().queries = commands;
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        results.at(i + 1).name = commands.at(i);
+        results.at(i + 1).queries.push_back(commands.at(i));
+    }
+
+    std::cout << "### Corpus benchmark (" << images.size() << " images, " << warmUp << " warm-up and " << repetitions
+              << " timed passes, mean +- 95% confidence, best kernel " << KernelPathToString(bestKernelPath()) << ") ###" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        CorpusResult &result = results.at(i);
+        Shapedetector shapeDetector;
+        if (i == 0)
+        {
+            shapeDetector.loadBatch(batchPath);
+        }
+        else
+        {
+            shapeDetector.parseSpec(result.queries.front());
+        }
+        replayCorpus(shapeDetector, images, warmUp, repetitions, result);
+
+        std::cout << result.name << " (" << result.shapesFound << " shapes per pass)" << std::endl;
+        printMeasurement("frames per second", result.framesPerSecond, "fps");
+        printMeasurement("frame", result.frameTime, "ms");
+        for (size_t stage = 0; stage < CORPUS_STAGE_COUNT; stage++)
+        {
+            printMeasurement(StageToString(CORPUS_STAGES[stage]), result.stageTimes.at(stage), "ms");
+        }
+    }
+
+    if (jsonPath.empty() == false)
+    {
+        if (writeCorpusJson(jsonPath, imagePaths, batchPath, warmUp, repetitions, results) == false)
+        {
+            std::cout << "Error: could not write " << jsonPath << std::endl;
+            return 1;
+        }
+        std::cout << "Results written to " << jsonPath << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && argv[1] == CORPUS_OPTION)
+    {
+        return benchmarkCorpus(argc, argv);
+    }
+
+    const std::string imagePath = (argc > 1) ? argv[1] : "data/blocks.png";
+    const int repetitions = (argc > 2) ? std::max(1, atoi(argv[2])) : 100;
+
+    Mat image = imread(imagePath, IMREAD_COLOR);
+    if (image.empty())
+    {
+        std::cout << "Error: could not read image (" << imagePath << "), usage:" << std::endl;
+        std::cout << "\tshapedetector_bench [image] [repetitions]" << std::endl;
+        std::cout << "\tshapedetector_bench --corpus [data directory] [--batch file] [--repetitions n] [--warm-up n] [--json file]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "### Benchmark (" << repetitions << " repetitions, best kernel " << KernelPathToString(bestKernelPath()) << ") ###" << std::endl;
+    const bool colorMasksMatch = benchmarkColorKernel(image, repetitions);
+    benchmarkColorLut(image, repetitions);
+    const bool morphologyMatches = benchmarkMorphology(repetitions);
+    const bool labelerMatches = checkBlobLabeler(repetitions);
+    benchmarkContourFeatures(repetitions);
+    benchmarkCloseShapes(repetitions);
+    const bool pyramidComplete = benchmarkPyramid(repetitions);
+    const bool steadyStateFree = benchmarkSteadyState(repetitions);
+    const bool sharedZeroCopy = benchmarkSharedRing(repetitions);
+    const bool serverKept = checkResultServer();
+
+    if (colorMasksMatch == false)
+    {
+        std::cout << "Error: a color mask differs from inRange" << std::endl;
+    }
+    if (morphologyMatches == false)
+    {
+        std::cout << "Error: an opening differs from morphologyEx" << std::endl;
+    }
+    if (labelerMatches == false)
+    {
+        std::cout << "Error: the blob labeler and findContours found different shapes" << std::endl;
+    }
+    if (pyramidComplete == false)
+    {
+        std::cout << "Error: the coarse-to-fine detection missed or added shapes" << std::endl;
+    }
+    if (steadyStateFree == false)
+    {
+        std::cout << "Error: the steady state allocated or missed shapes" << std::endl;
+    }
+    if (sharedZeroCopy == false)
+    {
+        std::cout << "Error: the shared frames were copied or missed shapes" << std::endl;
+    }
+    if (serverKept == false)
+    {
+        std::cout << "Error: the result server did not keep serving the queries of its client" << std::endl;
+    }
+    return (colorMasksMatch && morphologyMatches && labelerMatches && pyramidComplete && steadyStateFree && sharedZeroCopy && serverKept) ? 0 : 1;
+}
@@ -0,0 +1,497 @@
+// Library
+#include <algorithm>
+#include <cstring>
+
+// Local
+#include "BitMask.h"
+#include "ColorKernel.h"
+
+// The packing of 8-bit pixels has vector paths, selected at runtime with the processor check of the color kernel
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BIT_MASK_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define BIT_MASK_X86_DISPATCH 0
+#endif
+
+namespace
+{
+const int WORD_BITS = 64;
+const uint64_t ALL_BITS = ~(uint64_t)0;
+
+/**
+ * @brief Get the lowest aCount bits of a word, aCount up to 64
+ */
+uint64_t lowBits(int aCount)
+{
+    return (aCount >= WORD_BITS) ? ALL_BITS : (((uint64_t)1 << aCount) - 1);
+}
+
+/**
+ * @brief Get the index of the lowest set bit of a word that is not 0
+ */
+int countTrailingZeros(uint64_t aWord)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(aWord);
+#else
+    int result = 0;
+    for (; (aWord & 1) == 0; aWord >>= 1)
+    {
+        result++;
+    }
+    return result;
+#endif
+}
+
+/**
+ * @brief Read up to 64 bits of a row from any column, the row must hold them
+ */
+uint64_t readBits(const uint64_t *aRow, int aX, int aCount)
+{
+    const size_t word = (size_t)(aX / WORD_BITS);
+    const int bit = aX % WORD_BITS;
+    uint64_t result = aRow[word] >> bit;
+    if (bit > 0 && bit + aCount > WORD_BITS)
+    {
+        result |= aRow[word + 1] << (WORD_BITS - bit);
+    }
+    return result & lowBits(aCount);
+}
+
+/**
+ * @brief Replace up to 64 bits of a row from any column, the row must hold them
+ */
+void writeBits(uint64_t *aRow, int aX, uint64_t aBits, int aCount)
+{
+    const size_t word = (size_t)(aX / WORD_BITS);
+    const int bit = aX % WORD_BITS;
+    const uint64_t valid = lowBits(aCount);
+    aBits &= valid;
+    aRow[word] = (aRow[word] & ~(valid << bit)) | (aBits << bit);
+    if (bit > 0 && bit + aCount > WORD_BITS)
+    {
+        aRow[word + 1] = (aRow[word + 1] & ~(valid >> (WORD_BITS - bit))) | (aBits >> (WORD_BITS - bit));
+    }
+}
+
+/**
+ * @brief Pack 8 pixels into 8 bits, the first pixel in the lowest bit
+ */
+uint64_t packBytes(const uchar *aPixels)
+{
+    uint64_t bytes;
+    memcpy(&bytes, aPixels, sizeof(bytes));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bytes = __builtin_bswap64(bytes); // the first pixel in the lowest byte
+#endif
+    // The high bit of every byte, bit 8i+7, moves to bit 56+i, the partial products never overlap
+    return ((bytes & 0x8080808080808080ULL) * 0x0002040810204081ULL) >> 56;
+}
+
+#if BIT_MASK_X86_DISPATCH
+__attribute__((target("sse2"))) uint64_t sse2Pack64(const uchar *aPixels)
+{
+    uint64_t result = 0;
+    for (int i = 0; i < WORD_BITS; i += 16)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(aPixels + i));
+        result |= (uint64_t)(uint32_t)_mm_movemask_epi8(pixels) << i;
+    }
+    return result;
+}
+
+__attribute__((target("avx2"))) uint64_t avx2Pack64(const uchar *aPixels)
+{
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(aPixels));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(aPixels + 32));
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(low) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(high) << 32);
+}
+#endif
+
+/**
+ * @brief Pack up to 64 pixels into a word, by the high bit of every pixel
+ */
+uint64_t packPixels(const uchar *aPixels, int aCount, KernelPath aPath)
+{
+#if BIT_MASK_X86_DISPATCH
+    if (aCount == WORD_BITS && aPath == KernelPath::AVX2)
+    {
+        return avx2Pack64(aPixels);
+    }
+    if (aCount == WORD_BITS && aPath == KernelPath::SSSE3)
+    {
+        return sse2Pack64(aPixels);
+    }
+#else
+    (void)aPath;
+#endif
+
+    uint64_t result = 0;
+    int i = 0;
+    for (; i + 8 <= aCount; i += 8)
+    {
+        result |= packBytes(aPixels + i) << i;
+    }
+    for (; i < aCount; i++)
+    {
+        result |= (uint64_t)(aPixels[i] >> 7) << i;
+    }
+    return result;
+}
+
+/**
+ * @brief Shift the bits of a row to higher columns into a longer row, bit x of the source becomes bit x + aShift
+ * @param aFill The word that comes in below the first column and past the end of the source
+ */
+void shiftUp(const uint64_t *aSource, size_t aSourceWords, uint64_t *aDestination, size_t aWords, int aShift, uint64_t aFill)
+{
+    // The whole words first, then the bits, from the top so every word is read before it is written
+    const size_t words = (size_t)(aShift / WORD_BITS);
+    const int bits = aShift % WORD_BITS;
+    std::fill(aDestination, aDestination + words, aFill);
+    std::copy(aSource, aSource + aSourceWords, aDestination + words);
+    std::fill(aDestination + words + aSourceWords, aDestination + aWords, aFill);
+    if (bits > 0)
+    {
+        for (size_t i = aWords - 1; i > 0; i--)
+        {
+            aDestination[i] = (aDestination[i] << bits) | (aDestination[i - 1] >> (WORD_BITS - bits));
+        }
+        aDestination[0] = (aDestination[0] << bits) | (aFill >> (WORD_BITS - bits));
+    }
+}
+
+/**
+ * @brief Combine every bit of a row with the bit aShift columns further, in place
+ * @param aFill The word past the end of the row
+ * @param aErode true to AND the bits, false to OR them
+ */
+template <bool Erode>
+void combineShifted(uint64_t *aRow, size_t aWords, int aShift, uint64_t aFill)
+{
+    // In ascending order the words further on are still unchanged when they are read
+    const size_t words = (size_t)(aShift / WORD_BITS);
+    const int bits = aShift % WORD_BITS;
+    auto combine = [](uint64_t aFirst, uint64_t aSecond) { return Erode ? (aFirst & aSecond) : (aFirst | aSecond); };
+    size_t i = 0;
+    if (bits == 0)
+    {
+        for (; i + words < aWords; i++)
+        {
+            aRow[i] = combine(aRow[i], aRow[i + words]);
+        }
+    }
+    else
+    {
+        for (; i + words + 1 < aWords; i++)
+        {
+            aRow[i] = combine(aRow[i], (aRow[i + words] >> bits) | (aRow[i + words + 1] << (WORD_BITS - bits)));
+        }
+        for (; i + words < aWords; i++)
+        {
+            aRow[i] = combine(aRow[i], (aRow[i + words] >> bits) | (aFill << (WORD_BITS - bits)));
+        }
+    }
+    for (; i < aWords; i++)
+    {
+        aRow[i] = combine(aRow[i], aFill);
+    }
+}
+
+/**
+ * @brief Combine two rows of words, AND for an erosion and OR for a dilation
+ */
+void combineWords(uint64_t *aResult, const uint64_t *aOther, size_t aWords, bool aErode)
+{
+    if (aErode)
+    {
+        for (size_t i = 0; i < aWords; i++)
+        {
+            aResult[i] &= aOther[i];
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < aWords; i++)
+        {
+            aResult[i] |= aOther[i];
+        }
+    }
+}
+} // namespace
+
+BitMask::BitMask()
+    : mRows(0),
+      mCols(0),
+      mWordsPerRow(0)
+{
+}
+
+void BitMask::create(int aRows, int aCols)
+{
+    CV_Assert(aRows >= 0 && aCols >= 0);
+    mRows = aRows;
+    mCols = aCols;
+    mWordsPerRow = (size_t)(aCols + WORD_BITS - 1) / WORD_BITS;
+    const size_t size = (size_t)aRows * mWordsPerRow;
+    if (mWords.size() < size)
+    {
+        mWords.resize(size);
+    }
+
+    // The reused storage can hold bits of a wider mask past the last column
+    for (int y = 0; y < aRows && mWordsPerRow > 0; y++)
+    {
+        row(y)[mWordsPerRow - 1] = 0;
+    }
+}
+
+void BitMask::clear()
+{
+    std::fill(mWords.begin(), mWords.begin() + (long)((size_t)mRows * mWordsPerRow), 0);
+}
+
+int BitMask::rows() const
+{
+    return mRows;
+}
+
+int BitMask::cols() const
+{
+    return mCols;
+}
+
+size_t BitMask::wordsPerRow() const
+{
+    return mWordsPerRow;
+}
+
+uint64_t *BitMask::row(int aY)
+{
+    return mWords.data() + (size_t)aY * mWordsPerRow;
+}
+
+const uint64_t *BitMask::row(int aY) const
+{
+    return mWords.data() + (size_t)aY * mWordsPerRow;
+}
+
+uint64_t BitMask::bits(int aY, int aX, int aCount) const
+{
+    return readBits(row(aY), aX, aCount);
+}
+
+void BitMask::setBits(int aY, int aX, uint64_t aBits, int aCount)
+{
+    writeBits(row(aY), aX, aBits, aCount);
+}
+
+int BitMask::findPixel(int aY, int aX, bool aSet) const
+{
+    if (aX >= mCols)
+    {
+        return mCols;
+    }
+
+    // A clear pixel is a set bit of the inverted word, the bits before aX are masked off
+    const uint64_t *words = row(aY);
+    const uint64_t invert = aSet ? 0 : ALL_BITS;
+    size_t i = (size_t)(aX / WORD_BITS);
+    uint64_t word = (words[i] ^ invert) & (ALL_BITS << (aX % WORD_BITS));
+    while (word == 0)
+    {
+        if (++i >= mWordsPerRow)
+        {
+            return mCols;
+        }
+        word = words[i] ^ invert;
+    }
+    return std::min(mCols, (int)i * WORD_BITS + countTrailingZeros(word));
+}
+
+void BitMask::setRow(int aY, int aX, const uchar *aPixels, int aCount)
+{
+    CV_Assert(aY >= 0 && aY < mRows && aX >= 0 && aCount >= 0 && aX + aCount <= mCols);
+    const KernelPath path = bestKernelPath();
+    uint64_t *words = row(aY);
+    for (int x = 0; x < aCount; x += WORD_BITS)
+    {
+        const int count = std::min(WORD_BITS, aCount - x);
+        writeBits(words, aX + x, packPixels(aPixels + x, count, path), count);
+    }
+}
+
+void BitMask::copyRegion(const Rect &aRegion, BitMask &aDestination) const
+{
+    CV_Assert(aRegion.x >= 0 && aRegion.y >= 0 && aRegion.x + aRegion.width <= mCols && aRegion.y + aRegion.height <= mRows);
+    aDestination.create(aRegion.height, aRegion.width);
+    for (int y = 0; y < aRegion.height; y++)
+    {
+        const uint64_t *source = row(aRegion.y + y);
+        uint64_t *destination = aDestination.row(y);
+        for (size_t i = 0; i < aDestination.mWordsPerRow; i++)
+        {
+            const int x = (int)i * WORD_BITS;
+            destination[i] = readBits(source, aRegion.x + x, std::min(WORD_BITS, aRegion.width - x));
+        }
+    }
+}
+
+void BitMask::pasteRegion(const BitMask &aSource, Point aTopLeft)
+{
+    CV_Assert(aTopLeft.x >= 0 && aTopLeft.y >= 0 && aTopLeft.x + aSource.mCols <= mCols && aTopLeft.y + aSource.mRows <= mRows);
+    for (int y = 0; y < aSource.mRows; y++)
+    {
+        const uint64_t *source = aSource.row(y);
+        uint64_t *destination = row(aTopLeft.y + y);
+        for (size_t i = 0; i < aSource.mWordsPerRow; i++)
+        {
+            const int x = (int)i * WORD_BITS;
+            writeBits(destination, aTopLeft.x + x, source[i], std::min(WORD_BITS, aSource.mCols - x));
+        }
+    }
+}
+
+void BitMask::bitwiseOr(const BitMask &aOther)
+{
+    CV_Assert(aOther.mRows == mRows && aOther.mCols == mCols);
+    combineWords(mWords.data(), aOther.mWords.data(), (size_t)mRows * mWordsPerRow, false);
+}
+
+void BitMask::bitwiseAnd(const BitMask &aOther)
+{
+    CV_Assert(aOther.mRows == mRows && aOther.mCols == mCols);
+    combineWords(mWords.data(), aOther.mWords.data(), (size_t)mRows * mWordsPerRow, true);
+}
+
+void BitMask::erode(Size aKernelSize)
+{
+    CV_Assert(aKernelSize.width > 0 && aKernelSize.height > 0);
+    filterRows(aKernelSize.width, true);
+    filterColumns(aKernelSize.height, true);
+}
+
+void BitMask::dilate(Size aKernelSize)
+{
+    CV_Assert(aKernelSize.width > 0 && aKernelSize.height > 0);
+    filterRows(aKernelSize.width, false);
+    filterColumns(aKernelSize.height, false);
+}
+
+void BitMask::open(Size aKernelSize)
+{
+    erode(aKernelSize);
+    dilate(aKernelSize);
+}
+
+void BitMask::toMat(Mat &aImage) const
+{
+    aImage.create(mRows, mCols, CV_8U);
+    for (int y = 0; y < mRows; y++)
+    {
+        const uint64_t *words = row(y);
+        uchar *pixels = aImage.ptr<uchar>(y);
+        for (int x = 0; x < mCols; x++)
+        {
+            pixels[x] = ((words[x / WORD_BITS] >> (x % WORD_BITS)) & 1) ? 255 : 0;
+        }
+    }
+}
+
+void BitMask::fromMat(const Mat &aImage)
+{
+    CV_Assert(aImage.type() == CV_8U);
+    create(aImage.rows, aImage.cols);
+    for (int y = 0; y < mRows; y++)
+    {
+        setRow(y, 0, aImage.ptr<uchar>(y), mCols);
+    }
+}
+
+void BitMask::filterRows(int aWindow, bool aErode)
+{
+    if (aWindow == 1 || mRows == 0)
+    {
+        return;
+    }
+
+    // The row is moved up by the anchor into a buffer that also holds the window past its end,
+    // so output pixel x is the extreme of padded bits x to x + aWindow - 1. Every doubling step
+    // widens the windows of the buffer, a last step with an overlap completes them
+    const uint64_t fill = aErode ? ALL_BITS : 0;
+    const int anchor = aWindow / 2;
+    const size_t words = (size_t)(mCols + aWindow - 1 + WORD_BITS - 1) / WORD_BITS;
+    mPadded.resize(words);
+    const uint64_t lastMask = lastWordMask();
+
+    for (int y = 0; y < mRows; y++)
+    {
+        uint64_t *source = row(y);
+        source[mWordsPerRow - 1] |= fill & ~lastMask;
+        shiftUp(source, mWordsPerRow, mPadded.data(), words, anchor, fill);
+
+        int width = 1;
+        while (2 * width <= aWindow)
+        {
+            aErode ? combineShifted<true>(mPadded.data(), words, width, fill) : combineShifted<false>(mPadded.data(), words, width, fill);
+            width *= 2;
+        }
+        if (width < aWindow)
+        {
+            aErode ? combineShifted<true>(mPadded.data(), words, aWindow - width, fill) : combineShifted<false>(mPadded.data(), words, aWindow - width, fill);
+        }
+
+        std::copy(mPadded.begin(), mPadded.begin() + (long)mWordsPerRow, source);
+        source[mWordsPerRow - 1] &= lastMask;
+    }
+}
+
+void BitMask::filterColumns(int aWindow, bool aErode)
+{
+    if (aWindow == 1 || mCols == 0)
+    {
+        return;
+    }
+
+    // The same doubling as the rows, on whole rows of words: padded row j holds row j - anchor
+    const uint64_t fill = aErode ? ALL_BITS : 0;
+    const int anchor = aWindow / 2;
+    const size_t length = (size_t)(mRows + aWindow - 1);
+    mPadded.resize(length * mWordsPerRow);
+    std::fill(mPadded.begin(), mPadded.begin() + (long)(length * mWordsPerRow), fill);
+    std::copy(mWords.begin(), mWords.begin() + (long)((size_t)mRows * mWordsPerRow), mPadded.begin() + (long)((size_t)anchor * mWordsPerRow));
+    auto paddedRow = [&](size_t aRow) { return mPadded.data() + aRow * mWordsPerRow; };
+
+    // In ascending order the row further down is still unchanged when it is combined
+    size_t width = 1;
+    while (2 * width <= (size_t)aWindow)
+    {
+        for (size_t j = 0; j + width < length; j++)
+        {
+            combineWords(paddedRow(j), paddedRow(j + width), mWordsPerRow, aErode);
+        }
+        width *= 2;
+    }
+    const size_t rest = (size_t)aWindow - width;
+    if (rest > 0)
+    {
+        for (size_t j = 0; j + rest < length; j++)
+        {
+            combineWords(paddedRow(j), paddedRow(j + rest), mWordsPerRow, aErode);
+        }
+    }
+
+    // The padding bits were neutral and stayed, they are cleared again
+    std::copy(mPadded.begin(), mPadded.begin() + (long)((size_t)mRows * mWordsPerRow), mWords.begin());
+    const uint64_t lastMask = lastWordMask();
+    for (int y = 0; y < mRows; y++)
+    {
+        row(y)[mWordsPerRow - 1] &= lastMask;
+    }
+}
+
+uint64_t BitMask::lastWordMask() const
+{
+    return lowBits(mCols - (int)(mWordsPerRow - 1) * WORD_BITS);
+}
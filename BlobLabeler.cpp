@@ -0,0 +1,265 @@
+// Library
+#include <algorithm>
+#include <cstring>
+
+// Local
+#include "BlobLabeler.h"
+
+namespace
+{
+// The steps to the 8 neighbours in the order findContours searches them: east, then counterclockwise
+const Point NEIGHBOUR_STEPS[8] = {Point(1, 0), Point(1, -1), Point(0, -1), Point(-1, -1), Point(-1, 0), Point(-1, 1), Point(0, 1), Point(1, 1)};
+const int WEST = 4;
+
+/**
+ * @brief Count the set bits of a word
+ */
+int popCount(uint64_t aWord)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(aWord);
+#else
+    int result = 0;
+    for (; aWord != 0; aWord &= aWord - 1)
+    {
+        result++;
+    }
+    return result;
+#endif
+}
+} // namespace
+
+BlobLabeler::BlobLabeler()
+{
+}
+
+void BlobLabeler::label(const BitMask &aMask, Point aOffset)
+{
+    mOffset = aOffset;
+
+    mRuns.clear();
+    mParents.clear();
+    mBlobs.clear();
+    mFirstRuns.clear();
+    mLastRuns.clear();
+    mSumX.clear();
+    mSumY.clear();
+
+    // Find the runs row by row, joining them with the runs of the row above
+    size_t previousRowStart = 0;
+    size_t previousRowEnd = 0;
+    for (int y = 0; y < aMask.rows(); y++)
+    {
+        const size_t rowStart = mRuns.size();
+        addRowRuns(aMask, y, previousRowStart, previousRowEnd);
+        previousRowStart = rowStart;
+        previousRowEnd = mRuns.size();
+    }
+
+    // Give every root label a blob, in raster order, and gather the statistics of its runs
+    mBlobIndices.assign(mParents.size(), -1);
+    for (size_t i = 0; i < mRuns.size(); i++)
+    {
+        Run &run = mRuns.at(i);
+        const int root = findRoot(run.label);
+        const int length = run.xEnd - run.xStart + 1;
+
+        if (mBlobIndices.at((size_t)root) < 0)
+        {
+            mBlobIndices.at((size_t)root) = (int)mBlobs.size();
+
+            Blob blob;
+            blob.area = 0;
+            blob.perimeter = 0;
+            // The width and height hold the maximum x and y until all runs are added
+            blob.boundingBox = Rect(run.xStart, run.y, run.xEnd, run.y);
+            mBlobs.push_back(blob);
+            mFirstRuns.push_back((int)i);
+            mLastRuns.push_back((int)i);
+            mSumX.push_back(0);
+            mSumY.push_back(0);
+        }
+        else
+        {
+            // Chain the run behind the last run of its blob
+            const size_t blobIndex = (size_t)mBlobIndices.at((size_t)root);
+            mRuns.at((size_t)mLastRuns.at(blobIndex)).nextRun = (int)i;
+            mLastRuns.at(blobIndex) = (int)i;
+        }
+
+        const size_t blobIndex = (size_t)mBlobIndices.at((size_t)root);
+        run.label = (int)blobIndex;
+
+        Blob &blob = mBlobs.at(blobIndex);
+        blob.area += length;
+        blob.perimeter += countBorderPixels(aMask, run);
+        blob.boundingBox.x = std::min(blob.boundingBox.x, run.xStart);
+        blob.boundingBox.width = std::max(blob.boundingBox.width, run.xEnd);
+        blob.boundingBox.height = run.y;
+        mSumX.at(blobIndex) += (int64_t)(run.xStart + run.xEnd) * length / 2;
+        mSumY.at(blobIndex) += (int64_t)run.y * length;
+    }
+
+    for (size_t i = 0; i < mBlobs.size(); i++)
+    {
+        Blob &blob = mBlobs.at(i);
+        blob.boundingBox.width = blob.boundingBox.width - blob.boundingBox.x + 1;
+        blob.boundingBox.height = blob.boundingBox.height - blob.boundingBox.y + 1;
+        blob.boundingBox.x += mOffset.x;
+        blob.boundingBox.y += mOffset.y;
+        blob.center = Point((int)(mSumX.at(i) / blob.area) + mOffset.x, (int)(mSumY.at(i) / blob.area) + mOffset.y);
+    }
+}
+
+const std::vector<Blob> &BlobLabeler::blobs() const
+{
+    return mBlobs;
+}
+
+size_t BlobLabeler::traceContour(size_t aBlobIndex, std::vector<Point> &aPoints)
+{
+    const Rect &boundingBox = mBlobs.at(aBlobIndex).boundingBox;
+    const Point patchOrigin(boundingBox.x - mOffset.x - 1, boundingBox.y - mOffset.y - 1); // in run coordinates
+
+    // The patch is a header on the front of a buffer that only grows, no patch size allocates twice
+    const int patchRows = boundingBox.height + 2;
+    const int patchCols = boundingBox.width + 2;
+    const size_t patchSize = (size_t)patchRows * (size_t)patchCols;
+    if (mPatchBuffer.total() < patchSize)
+    {
+        mPatchBuffer.create(1, (int)patchSize, CV_8U);
+    }
+    Mat patch(patchRows, patchCols, CV_8U, mPatchBuffer.data);
+
+    // Draw only this blob, other blobs inside its bounding box must not join the contour
+    patch.setTo(Scalar(0));
+    for (int i = mFirstRuns.at(aBlobIndex); i >= 0; i = mRuns.at((size_t)i).nextRun)
+    {
+        const Run &run = mRuns.at((size_t)i);
+        uchar *patchRow = patch.ptr<uchar>(run.y - patchOrigin.y);
+        memset(patchRow + (run.xStart - patchOrigin.x), 255, (size_t)(run.xEnd - run.xStart + 1));
+    }
+
+    // Follow the outer border as findContours does (Suzuki and Abe), from the first pixel of the blob,
+    // which has an empty west neighbour. The border of the patch keeps every neighbour inside it.
+    int offsets[8];
+    for (int s = 0; s < 8; s++)
+    {
+        offsets[s] = NEIGHBOUR_STEPS[s].y * patchCols + NEIGHBOUR_STEPS[s].x;
+    }
+    const Run &firstRun = mRuns.at((size_t)mFirstRuns.at(aBlobIndex));
+    Point position(firstRun.xStart - patchOrigin.x, firstRun.y - patchOrigin.y);
+    const uchar *start = patch.ptr<uchar>(position.y) + position.x;
+    const Point imageOffset(boundingBox.x - 1, boundingBox.y - 1); // the patch position, as findContours was given it
+    const size_t firstPoint = aPoints.size();
+
+    // The first neighbour clockwise from the west, a blob of one pixel has none
+    int s = WEST;
+    do
+    {
+        s = (s - 1) & 7;
+    } while (start[offsets[s]] == 0 && s != WEST);
+    if (start[offsets[s]] == 0)
+    {
+        aPoints.push_back(position + imageOffset);
+        return 1;
+    }
+
+    const uchar *second = start + offsets[s];
+    const uchar *current = start;
+    while (true)
+    {
+        // The next neighbour counterclockwise from the one the border came from, at worst that one again
+        const int searchEnd = s + 8;
+        const uchar *next = current;
+        do
+        {
+            s++;
+            next = current + offsets[s & 7];
+        } while (*next == 0 && s < searchEnd);
+        s &= 7;
+
+        aPoints.push_back(position + imageOffset);
+        position += NEIGHBOUR_STEPS[s];
+        if (next == start && current == second)
+        {
+            break;
+        }
+        current = next;
+        s = (s + 4) & 7;
+    }
+    return aPoints.size() - firstPoint;
+}
+
+void BlobLabeler::addRowRuns(const BitMask &aMask, int aY, size_t aPreviousRowStart, size_t aPreviousRowEnd)
+{
+    size_t previous = aPreviousRowStart;
+
+    // Masks are mostly empty, the background is skipped a word at a time
+    for (int x = aMask.findPixel(aY, 0, true); x < aMask.cols(); x = aMask.findPixel(aY, x, true))
+    {
+        Run run;
+        run.y = aY;
+        run.xStart = x;
+        x = aMask.findPixel(aY, x, false);
+        run.xEnd = x - 1;
+        run.label = -1;
+        run.nextRun = -1;
+
+        // 8-connectivity: a run above touches when it overlaps one pixel further on both sides
+        while (previous < aPreviousRowEnd && mRuns.at(previous).xEnd < run.xStart - 1)
+        {
+            previous++;
+        }
+        for (size_t i = previous; i < aPreviousRowEnd && mRuns.at(i).xStart <= run.xEnd + 1; i++)
+        {
+            const int root = findRoot(mRuns.at(i).label);
+            if (run.label < 0)
+            {
+                run.label = root;
+            }
+            else if (root != run.label)
+            {
+                // Join the trees under the lowest label
+                const int lowest = std::min(root, run.label);
+                mParents.at((size_t)std::max(root, run.label)) = lowest;
+                run.label = lowest;
+            }
+        }
+
+        if (run.label < 0)
+        {
+            run.label = (int)mParents.size();
+            mParents.push_back(run.label);
+        }
+        mRuns.push_back(run);
+    }
+}
+
+int BlobLabeler::countBorderPixels(const BitMask &aMask, const Run &aRun)
+{
+    if (aRun.y == 0 || aRun.y + 1 >= aMask.rows())
+    {
+        return aRun.xEnd - aRun.xStart + 1;
+    }
+
+    // Both ends always border the background, an inner pixel when the pixel above or below is clear
+    int result = (aRun.xEnd > aRun.xStart) ? 2 : 1;
+    for (int x = aRun.xStart + 1; x < aRun.xEnd; x += 64)
+    {
+        const int count = std::min(64, aRun.xEnd - x);
+        result += count - popCount(aMask.bits(aRun.y - 1, x, count) & aMask.bits(aRun.y + 1, x, count));
+    }
+    return result;
+}
+
+int BlobLabeler::findRoot(int aLabel)
+{
+    // Path halving keeps the trees flat
+    while (mParents.at((size_t)aLabel) != aLabel)
+    {
+        mParents.at((size_t)aLabel) = mParents.at((size_t)mParents.at((size_t)aLabel));
+        aLabel = mParents.at((size_t)aLabel);
+    }
+    return aLabel;
+}
@@ -0,0 +1,97 @@
+#ifndef BLOB_LABELER_H_
+#define BLOB_LABELER_H_
+
+// Library
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Local
+#include "BitMask.h"
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief The statistics of one 8-connected blob of a mask
+ */
+struct Blob
+{
+  int area;         // number of pixels
+  Point center;     // centroid of the pixels
+  Rect boundingBox; // in image coordinates
+  int perimeter;    // number of pixels with a 4-neighbour outside the blob
+};
+
+/**
+ * @brief Labels the 8-connected blobs of a binary mask in one run-length pass
+ *
+ * Every row is split into runs of set pixels, found a word of the packed
+ * mask at a time, runs that touch a run of the row above are joined with
+ * union-find. The statistics of every blob come from its runs, the contour
+ * is only traced on request, on a patch holding just that blob, by the
+ * border following of findContours without its allocations. The storage
+ * is kept between frames, once it has grown to the largest mask no call
+ * allocates.
+ */
+class BlobLabeler
+{
+public:
+  BlobLabeler();
+
+  /**
+   * @brief Label the blobs of a mask
+   * @param aMask The mask
+   * @param aOffset Added to the blob coordinates, the position of aMask when it is a region of an image
+   */
+  void label(const BitMask &aMask, Point aOffset = Point());
+
+  /**
+   * @brief Get the blobs of the last labeled mask, in the order of their first pixel
+   */
+  const std::vector<Blob> &blobs() const;
+
+  /**
+   * @brief Trace the outer contour of a blob, as findContours with CHAIN_APPROX_NONE would
+   * @param aBlobIndex The index in blobs()
+   * @param aPoints The contour points in image coordinates are appended to these
+   * @return size_t The number of appended points
+   */
+  size_t traceContour(size_t aBlobIndex, std::vector<Point> &aPoints);
+
+private:
+  struct Run
+  {
+    int y;
+    int xStart; // inclusive
+    int xEnd;   // inclusive
+    int label;  // provisional label, the blob index once labeling is done
+    int nextRun; // the next run of the same blob, -1 for the last one
+  };
+
+  /**
+   * @brief Add the runs of one row, joined with the touching runs of the row above
+   */
+  void addRowRuns(const BitMask &aMask, int aY, size_t aPreviousRowStart, size_t aPreviousRowEnd);
+
+  /**
+   * @brief Count the pixels of a run that have a 4-neighbour outside the mask
+   */
+  static int countBorderPixels(const BitMask &aMask, const Run &aRun);
+
+  int findRoot(int aLabel);
+
+  std::vector<Run> mRuns;
+  std::vector<int> mParents; // union-find forest over the provisional labels
+  std::vector<int> mBlobIndices; // provisional root label to blob index
+  std::vector<int> mFirstRuns;  // first run per blob
+  std::vector<int> mLastRuns;   // last run per blob
+  std::vector<int64_t> mSumX;
+  std::vector<int64_t> mSumY;
+  std::vector<Blob> mBlobs;
+  Point mOffset;
+
+  Mat mPatchBuffer; // holds the blob being traced, with a border of one pixel
+};
+
+#endif
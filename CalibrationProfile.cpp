@@ -0,0 +1,301 @@
+// Library
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local
+#include "CalibrationProfile.h"
+
+namespace
+{
+const char PROFILE_HEADER[] = "shapedetector-profile";
+const int PROFILE_VERSION = 1;
+const size_t MAX_NUMBER_LENGTH = 31;
+
+/**
+ * @brief Visit every field of a profile with its key, the one list for loading and saving
+ */
+template <typename Profile, typename Visitor>
+void visitFields(Profile &aProfile, Visitor &aVisitor)
+{
+    aVisitor("rood.min", aProfile.redLimits[0]);
+    aVisitor("rood.max", aProfile.redLimits[1]);
+    aVisitor("rood.min2", aProfile.redLimits[2]);
+    aVisitor("rood.max2", aProfile.redLimits[3]);
+    aVisitor("groen.min", aProfile.greenLimits[0]);
+    aVisitor("groen.max", aProfile.greenLimits[1]);
+    aVisitor("blauw.min", aProfile.blueLimits[0]);
+    aVisitor("blauw.max", aProfile.blueLimits[1]);
+    aVisitor("zwart.min", aProfile.blackLimits[0]);
+    aVisitor("zwart.max", aProfile.blackLimits[1]);
+    aVisitor("geel.min", aProfile.yellowLimits[0]);
+    aVisitor("geel.max", aProfile.yellowLimits[1]);
+    aVisitor("wit.min", aProfile.whiteLimits[0]);
+    aVisitor("wit.max", aProfile.whiteLimits[1]);
+    aVisitor("noise.kernel-size", aProfile.noiseKernelSize);
+    aVisitor("square.min-ratio", aProfile.minSquareRatio);
+    aVisitor("square.max-ratio", aProfile.maxSquareRatio);
+    aVisitor("contour.center-margin", aProfile.contourCenterMargin);
+    aVisitor("contour.track-padding", aProfile.trackPadding);
+    aVisitor("contour.epsilon", aProfile.epsilonMultiply);
+    aVisitor("contour.min-size", aProfile.minContourSize);
+    aVisitor("contour.max-size", aProfile.maxContourSize);
+    aVisitor("halfcircle.min-percentage", aProfile.minHalfCirclePercentage);
+    aVisitor("halfcircle.max-percentage", aProfile.maxHalfCirclePercentage);
+}
+
+/**
+ * @brief A range of the profile text
+ */
+struct TextRange
+{
+    const char *begin;
+    const char *end;
+
+    bool equals(const char *aText) const
+    {
+        const size_t length = strlen(aText);
+        return (size_t)(end - begin) == length && memcmp(begin, aText, length) == 0;
+    }
+};
+
+bool isSpace(char aCharacter)
+{
+    return aCharacter == ' ' || aCharacter == '\t' || aCharacter == '\r';
+}
+
+TextRange trim(TextRange aRange)
+{
+    while (aRange.begin < aRange.end && isSpace(*aRange.begin))
+    {
+        aRange.begin++;
+    }
+    while (aRange.end > aRange.begin && isSpace(*(aRange.end - 1)))
+    {
+        aRange.end--;
+    }
+    return aRange;
+}
+
+/**
+ * @brief Parse the next number of a range, the range starts after it on success
+ *
+ * The number is copied to a terminated buffer on the stack, strtod must not
+ * read past the end of the mapped file.
+ */
+bool parseNumber(TextRange &aRange, double &aNumber)
+{
+    aRange = trim(aRange);
+    const char *numberEnd = aRange.begin;
+    while (numberEnd < aRange.end && isSpace(*numberEnd) == false)
+    {
+        numberEnd++;
+    }
+    const size_t length = (size_t)(numberEnd - aRange.begin);
+    if (length == 0 || length > MAX_NUMBER_LENGTH)
+    {
+        return false;
+    }
+
+    char buffer[MAX_NUMBER_LENGTH + 1];
+    memcpy(buffer, aRange.begin, length);
+    buffer[length] = '\0';
+    char *parsedEnd = nullptr;
+    aNumber = strtod(buffer, &parsedEnd);
+    aRange.begin = numberEnd;
+    return parsedEnd == buffer + length;
+}
+
+/**
+ * @brief Sets the field whose key matches, for every type of field
+ */
+class FieldParser
+{
+public:
+    FieldParser(TextRange aKey, TextRange aValue) : mKey(aKey), mValue(aValue), mFound(false), mValid(false)
+    {
+    }
+
+    void operator()(const char *aKey, Scalar &aField)
+    {
+        if (mFound == false && mKey.equals(aKey))
+        {
+            mFound = true;
+            Scalar parsed;
+            TextRange value = mValue;
+            mValid = parseNumber(value, parsed[0]) && parseNumber(value, parsed[1]) && parseNumber(value, parsed[2]) &&
+                     trim(value).begin == value.end;
+            aField = mValid ? parsed : aField;
+        }
+    }
+
+    void operator()(const char *aKey, double &aField)
+    {
+        if (mFound == false && mKey.equals(aKey))
+        {
+            mFound = true;
+            double parsed = 0.0;
+            TextRange value = mValue;
+            mValid = parseNumber(value, parsed) && trim(value).begin == value.end;
+            aField = mValid ? parsed : aField;
+        }
+    }
+
+    void operator()(const char *aKey, int &aField)
+    {
+        const bool foundBefore = mFound;
+        double parsed = (double)aField;
+        (*this)(aKey, parsed);
+        if (foundBefore == false && mFound && mValid)
+        {
+            aField = (int)parsed;
+        }
+    }
+
+    bool found() const
+    {
+        return mFound;
+    }
+
+    bool valid() const
+    {
+        return mValid;
+    }
+
+private:
+    TextRange mKey;
+    TextRange mValue;
+    bool mFound;
+    bool mValid;
+};
+
+/**
+ * @brief Writes every field as a line of the profile
+ */
+class FieldWriter
+{
+public:
+    explicit FieldWriter(std::ostream &aStream) : mStream(aStream)
+    {
+    }
+
+    void operator()(const char *aKey, const Scalar &aField)
+    {
+        mStream << aKey << " = " << aField[0] << " " << aField[1] << " " << aField[2] << "\n";
+    }
+
+    template <typename T>
+    void operator()(const char *aKey, const T &aField)
+    {
+        mStream << aKey << " = " << aField << "\n";
+    }
+
+private:
+    std::ostream &mStream;
+};
+} // namespace
+
+bool CalibrationProfile::load(const std::string &aPath)
+{
+    const int fileDescriptor = open(aPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0)
+    {
+        std::cout << "Error: could not open profile (" << aPath << ")" << std::endl;
+        return false;
+    }
+
+    struct stat fileStatus;
+    bool result = false;
+    if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0)
+    {
+        const size_t size = (size_t)fileStatus.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping != MAP_FAILED)
+        {
+            result = parse((const char *)mapping, size, aPath);
+            munmap(mapping, size);
+        }
+    }
+    else
+    {
+        std::cout << "Error: empty profile (" << aPath << ")" << std::endl;
+    }
+    close(fileDescriptor);
+    return result;
+}
+
+bool CalibrationProfile::save(const std::string &aPath) const
+{
+    std::ofstream file(aPath);
+    if (file.is_open() == false)
+    {
+        return false;
+    }
+
+    file << PROFILE_HEADER << " " << PROFILE_VERSION << "\n";
+    file << "# Color limits are B G R, rood.min2 and rood.max2 are the second red range\n";
+    FieldWriter writer(file);
+    visitFields(*this, writer);
+    return file.good();
+}
+
+bool CalibrationProfile::parse(const char *aText, size_t aSize, const std::string &aPath)
+{
+    bool headerRead = false;
+    bool result = true;
+    int lineNumber = 0;
+    const char *textEnd = aText + aSize;
+    for (const char *lineBegin = aText; lineBegin < textEnd;)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(lineBegin, '\n', (size_t)(textEnd - lineBegin)));
+        lineEnd = (lineEnd == nullptr) ? textEnd : lineEnd;
+        const TextRange line = trim(TextRange{lineBegin, lineEnd});
+        lineBegin = lineEnd + 1;
+        lineNumber++;
+
+        if (line.begin == line.end || *line.begin == '#')
+        {
+            continue;
+        }
+
+        if (headerRead == false)
+        {
+            // The version decides which keys can appear, newer profiles are refused
+            const size_t headerLength = sizeof(PROFILE_HEADER) - 1;
+            TextRange version{line.begin + headerLength, line.end};
+            double versionNumber = 0.0;
+            if ((size_t)(line.end - line.begin) <= headerLength || memcmp(line.begin, PROFILE_HEADER, headerLength) != 0 ||
+                parseNumber(version, versionNumber) == false || versionNumber < 1.0 || versionNumber > PROFILE_VERSION)
+            {
+                std::cout << "Error: " << aPath << " is not a profile of version 1 to " << PROFILE_VERSION << std::endl;
+                return false;
+            }
+            headerRead = true;
+            continue;
+        }
+
+        const char *separator = static_cast<const char *>(memchr(line.begin, '=', (size_t)(line.end - line.begin)));
+        FieldParser parser(trim(TextRange{line.begin, (separator == nullptr) ? line.end : separator}),
+                           TextRange{(separator == nullptr) ? line.end : separator + 1, line.end});
+        if (separator != nullptr)
+        {
+            visitFields(*this, parser);
+        }
+        if (parser.found() == false || parser.valid() == false)
+        {
+            std::cout << "Error: invalid line " << lineNumber << " in profile (" << aPath << ")" << std::endl;
+            result = false;
+        }
+    }
+
+    if (headerRead == false)
+    {
+        std::cout << "Error: no profile header in " << aPath << std::endl;
+    }
+    return result && headerRead;
+}
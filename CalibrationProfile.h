@@ -0,0 +1,67 @@
+#ifndef CALIBRATION_PROFILE_H_
+#define CALIBRATION_PROFILE_H_
+
+// Library
+#include <string>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief The calibrated color limits and detection settings, stored in a versioned profile file
+ *
+ * The file is text, one "key = value" per line after the header line
+ * "shapedetector-profile <version>". A color limit is three numbers in the
+ * channel order of the frame (B G R). Keys that are missing keep the value
+ * the profile had before loading, so older profiles stay valid.
+ */
+struct CalibrationProfile
+{
+  // Color limits, [0] = min, [1] = max
+  Scalar redLimits[4]; // [2] and [3] are the second red range
+  Scalar greenLimits[2];
+  Scalar blueLimits[2];
+  Scalar blackLimits[2];
+  Scalar yellowLimits[2];
+  Scalar whiteLimits[2];
+
+  // Noise and ratio settings
+  int noiseKernelSize;
+  double minSquareRatio;
+  double maxSquareRatio;
+
+  // Contour settings
+  int contourCenterMargin;
+  int trackPadding;
+  double epsilonMultiply;
+  double minContourSize;
+  double maxContourSize;
+  double minHalfCirclePercentage;
+  double maxHalfCirclePercentage;
+
+  /**
+   * @brief Load a profile file, the file is mapped and parsed in place without allocating per field
+   * @param aPath The path of the profile
+   * @return whether the file was read and every line is valid, the errors are printed
+   */
+  bool load(const std::string &aPath);
+
+  /**
+   * @brief Save the profile in the current version
+   * @param aPath The path of the profile
+   * @return whether the file was written
+   */
+  bool save(const std::string &aPath) const;
+
+  /**
+   * @brief Parse the text of a profile
+   * @param aText The text, not terminated
+   * @param aSize The length of the text
+   * @param aPath The path to print in errors
+   * @return whether the header and every line are valid
+   */
+  bool parse(const char *aText, size_t aSize, const std::string &aPath);
+};
+
+#endif
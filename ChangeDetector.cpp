@@ -0,0 +1,75 @@
+// Local
+#include "ChangeDetector.h"
+
+namespace
+{
+const double FRAME_SCALE = 1.0 / 8.0; // the frame is compared at 1/8th of its size
+const double BLOCK_SCALE = 1.0 / 4.0; // a block is 4x4 pixels of the small frame
+} // namespace
+
+ChangeDetector::ChangeDetector()
+    : mThreshold(0.0),
+      mFrameCount(0),
+      mUnchangedCount(0)
+{
+}
+
+void ChangeDetector::configure(double aThreshold)
+{
+    mThreshold = aThreshold;
+    mReferenceImage.release();
+}
+
+bool ChangeDetector::enabled() const
+{
+    return mThreshold > 0.0;
+}
+
+bool ChangeDetector::changed(const Mat &aFrame)
+{
+    mFrameCount++;
+    if (enabled() == false)
+    {
+        return true;
+    }
+
+    // Area interpolation averages every 8x8 pixels, which also removes most sensor noise
+    resize(aFrame, mSmallImage, Size(), FRAME_SCALE, FRAME_SCALE, INTER_AREA);
+    cvtColor(mSmallImage, mGreyImage, CV_BGR2GRAY);
+
+    bool result = true;
+    if (mReferenceImage.empty() == false && mReferenceImage.size() == mGreyImage.size())
+    {
+        absdiff(mGreyImage, mReferenceImage, mDifferenceImage);
+        resize(mDifferenceImage, mBlockImage, Size(), BLOCK_SCALE, BLOCK_SCALE, INTER_AREA);
+
+        double maxBlockDifference = 0.0;
+        minMaxLoc(mBlockImage, NULL, &maxBlockDifference);
+        result = (maxBlockDifference > mThreshold);
+    }
+
+    if (result)
+    {
+        std::swap(mReferenceImage, mGreyImage);
+    }
+    else
+    {
+        mUnchangedCount++;
+    }
+    return result;
+}
+
+void ChangeDetector::invalidate()
+{
+    mReferenceImage.release();
+}
+
+uint64_t ChangeDetector::frameCount() const
+{
+    return mFrameCount;
+}
+
+uint64_t ChangeDetector::unchangedCount() const
+{
+    return mUnchangedCount;
+}
@@ -0,0 +1,69 @@
+#ifndef CHANGE_DETECTOR_H_
+#define CHANGE_DETECTOR_H_
+
+// Library
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief Decides whether a live frame differs enough from the last processed one to detect again
+ *
+ * The frame is reduced to a grey image of 1/8th of its size and compared
+ * with the reference in blocks of 32x32 original pixels. The frame has
+ * changed when the mean absolute difference of any block is above the
+ * threshold. Only a changed frame becomes the new reference, so a slow
+ * drift is still seen once it adds up.
+ */
+class ChangeDetector
+{
+public:
+  ChangeDetector();
+
+  /**
+   * @brief Set the threshold
+   * @param aThreshold The mean absolute grey difference of a block, 0 detects on every frame
+   */
+  void configure(double aThreshold);
+
+  /**
+   * @brief Get whether unchanged frames are skipped
+   */
+  bool enabled() const;
+
+  /**
+   * @brief Compare a frame with the reference frame
+   * @param aFrame The BGR frame
+   * @return true when the frame changed, it is then the new reference
+   */
+  bool changed(const Mat &aFrame);
+
+  /**
+   * @brief Forget the reference frame, the next frame counts as changed
+   */
+  void invalidate();
+
+  /**
+   * @brief Get the number of compared frames
+   */
+  uint64_t frameCount() const;
+
+  /**
+   * @brief Get the number of unchanged frames, served from the previous result
+   */
+  uint64_t unchangedCount() const;
+
+private:
+  double mThreshold;
+  Mat mSmallImage;     // the frame at 1/8th of its size
+  Mat mGreyImage;      // the grey small frame
+  Mat mReferenceImage; // the grey small frame of the last changed frame
+  Mat mDifferenceImage;
+  Mat mBlockImage;     // the mean difference per block
+  uint64_t mFrameCount;
+  uint64_t mUnchangedCount;
+};
+
+#endif
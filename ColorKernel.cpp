@@ -0,0 +1,407 @@
+// Library
+#include <algorithm>
+
+// Local
+#include "ColorKernel.h"
+
+// The vector paths are compiled with per-function target attributes and
+// selected at runtime, so the binary still runs on any x86 processor
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define COLOR_KERNEL_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define COLOR_KERNEL_X86_DISPATCH 0
+#endif
+
+namespace
+{
+const size_t MAX_VECTOR_RANGES = 16;
+const size_t MAX_VECTOR_COLORS = 16;
+const int PACK_CHUNK = 256; // the pixels of a row thresholded at once before they are packed, a multiple of 64
+const int CHANNEL_COUNT = 3;
+
+/**
+ * @brief The ranges of all colors as flat arrays, prepared once per image
+ */
+struct FlatRanges
+{
+  size_t rangeCount;
+  size_t colorCount;
+  uchar lower[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  uchar upper[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  uchar wraps[MAX_VECTOR_RANGES][CHANNEL_COUNT]; // 0xFF when lower > upper
+  size_t color[MAX_VECTOR_RANGES];
+};
+
+/**
+ * @brief Flatten the ranges, fails when there are too many for the vector paths
+ */
+bool flattenRanges(const std::vector<std::vector<ColorRange>> &aColorRanges, FlatRanges &aFlatRanges)
+{
+  aFlatRanges.rangeCount = 0;
+  aFlatRanges.colorCount = aColorRanges.size();
+  if (aFlatRanges.colorCount > MAX_VECTOR_COLORS)
+  {
+    return false;
+  }
+
+  for (size_t color = 0; color < aColorRanges.size(); color++)
+  {
+    for (const ColorRange &range : aColorRanges.at(color))
+    {
+      if (aFlatRanges.rangeCount == MAX_VECTOR_RANGES)
+      {
+        return false;
+      }
+      size_t index = aFlatRanges.rangeCount++;
+      for (int c = 0; c < CHANNEL_COUNT; c++)
+      {
+        aFlatRanges.lower[index][c] = range.lower[c];
+        aFlatRanges.upper[index][c] = range.upper[c];
+        aFlatRanges.wraps[index][c] = (range.lower[c] > range.upper[c]) ? 0xFF : 0x00;
+      }
+      aFlatRanges.color[index] = color;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Check whether a pixel lies inside a range
+ */
+inline bool pixelInside(const uchar *aPixel, const ColorRange &aRange)
+{
+  for (int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    const uchar value = aPixel[c];
+    const uchar lower = aRange.lower[c];
+    const uchar upper = aRange.upper[c];
+    const bool inside = (lower <= upper) ? (value >= lower && value <= upper) : (value >= lower || value <= upper);
+    if (inside == false)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Threshold the pixels [aBegin, aEnd) of a row one pixel at a time
+ */
+void scalarRow(const uchar *aPixels, int aBegin, int aEnd, const std::vector<std::vector<ColorRange>> &aColorRanges,
+               uchar *const *aMaskRows)
+{
+  for (int x = aBegin; x < aEnd; x++)
+  {
+    const uchar *pixel = aPixels + CHANNEL_COUNT * x;
+    for (size_t color = 0; color < aColorRanges.size(); color++)
+    {
+      uchar value = 0;
+      for (const ColorRange &range : aColorRanges.at(color))
+      {
+        if (pixelInside(pixel, range))
+        {
+          value = 255;
+          break;
+        }
+      }
+      aMaskRows[color][x] = value;
+    }
+  }
+}
+
+#if COLOR_KERNEL_X86_DISPATCH
+
+/**
+ * @brief Split 16 interleaved BGR pixels into one vector per channel
+ */
+__attribute__((target("ssse3"))) inline void deinterleave16(const uchar *aPixels, __m128i *aChannels)
+{
+  const __m128i block0 = _mm_loadu_si128((const __m128i *)aPixels);
+  const __m128i block1 = _mm_loadu_si128((const __m128i *)(aPixels + 16));
+  const __m128i block2 = _mm_loadu_si128((const __m128i *)(aPixels + 32));
+
+  // Channel c of pixel i sits at byte 3 * i + c, spread over the three blocks
+  aChannels[0] = _mm_or_si128(_mm_or_si128(
+                     _mm_shuffle_epi8(block0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(block1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+                     _mm_shuffle_epi8(block2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+  aChannels[1] = _mm_or_si128(_mm_or_si128(
+                     _mm_shuffle_epi8(block0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(block1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+                     _mm_shuffle_epi8(block2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+  aChannels[2] = _mm_or_si128(_mm_or_si128(
+                     _mm_shuffle_epi8(block0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(block1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+                     _mm_shuffle_epi8(block2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/**
+ * @brief Threshold 16 pixels per step, returns the first pixel that was not handled
+ */
+__attribute__((target("ssse3"))) int ssse3Row(const uchar *aPixels, int aWidth, const FlatRanges &aRanges, uchar *const *aMaskRows)
+{
+  __m128i lower[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  __m128i upper[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  __m128i wraps[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  for (size_t r = 0; r < aRanges.rangeCount; r++)
+  {
+    for (int c = 0; c < CHANNEL_COUNT; c++)
+    {
+      lower[r][c] = _mm_set1_epi8((char)aRanges.lower[r][c]);
+      upper[r][c] = _mm_set1_epi8((char)aRanges.upper[r][c]);
+      wraps[r][c] = _mm_set1_epi8((char)aRanges.wraps[r][c]);
+    }
+  }
+
+  int x = 0;
+  for (; x + 16 <= aWidth; x += 16)
+  {
+    __m128i channels[CHANNEL_COUNT];
+    deinterleave16(aPixels + CHANNEL_COUNT * x, channels);
+
+    __m128i colorMasks[MAX_VECTOR_COLORS];
+    for (size_t color = 0; color < aRanges.colorCount; color++)
+    {
+      colorMasks[color] = _mm_setzero_si128();
+    }
+
+    for (size_t r = 0; r < aRanges.rangeCount; r++)
+    {
+      __m128i inside = _mm_set1_epi8(-1);
+      for (int c = 0; c < CHANNEL_COUNT; c++)
+      {
+        // Unsigned compares: v >= lower <=> max(v, lower) == v
+        const __m128i aboveLower = _mm_cmpeq_epi8(_mm_max_epu8(channels[c], lower[r][c]), channels[c]);
+        const __m128i belowUpper = _mm_cmpeq_epi8(_mm_min_epu8(channels[c], upper[r][c]), channels[c]);
+        const __m128i channelInside = _mm_or_si128(_mm_and_si128(aboveLower, belowUpper),
+                                                   _mm_and_si128(wraps[r][c], _mm_or_si128(aboveLower, belowUpper)));
+        inside = _mm_and_si128(inside, channelInside);
+      }
+      colorMasks[aRanges.color[r]] = _mm_or_si128(colorMasks[aRanges.color[r]], inside);
+    }
+
+    for (size_t color = 0; color < aRanges.colorCount; color++)
+    {
+      _mm_storeu_si128((__m128i *)(aMaskRows[color] + x), colorMasks[color]);
+    }
+  }
+  return x;
+}
+
+/**
+ * @brief Threshold 32 pixels per step, returns the first pixel that was not handled
+ */
+__attribute__((target("avx2"))) int avx2Row(const uchar *aPixels, int aWidth, const FlatRanges &aRanges, uchar *const *aMaskRows)
+{
+  __m256i lower[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  __m256i upper[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  __m256i wraps[MAX_VECTOR_RANGES][CHANNEL_COUNT];
+  for (size_t r = 0; r < aRanges.rangeCount; r++)
+  {
+    for (int c = 0; c < CHANNEL_COUNT; c++)
+    {
+      lower[r][c] = _mm256_set1_epi8((char)aRanges.lower[r][c]);
+      upper[r][c] = _mm256_set1_epi8((char)aRanges.upper[r][c]);
+      wraps[r][c] = _mm256_set1_epi8((char)aRanges.wraps[r][c]);
+    }
+  }
+
+  int x = 0;
+  for (; x + 32 <= aWidth; x += 32)
+  {
+    // Deinterleave both halves with 128-bit shuffles, they do not cross lanes
+    __m128i firstHalf[CHANNEL_COUNT];
+    __m128i secondHalf[CHANNEL_COUNT];
+    deinterleave16(aPixels + CHANNEL_COUNT * x, firstHalf);
+    deinterleave16(aPixels + CHANNEL_COUNT * (x + 16), secondHalf);
+
+    __m256i channels[CHANNEL_COUNT];
+    for (int c = 0; c < CHANNEL_COUNT; c++)
+    {
+      channels[c] = _mm256_inserti128_si256(_mm256_castsi128_si256(firstHalf[c]), secondHalf[c], 1);
+    }
+
+    __m256i colorMasks[MAX_VECTOR_COLORS];
+    for (size_t color = 0; color < aRanges.colorCount; color++)
+    {
+      colorMasks[color] = _mm256_setzero_si256();
+    }
+
+    for (size_t r = 0; r < aRanges.rangeCount; r++)
+    {
+      __m256i inside = _mm256_set1_epi8(-1);
+      for (int c = 0; c < CHANNEL_COUNT; c++)
+      {
+        const __m256i aboveLower = _mm256_cmpeq_epi8(_mm256_max_epu8(channels[c], lower[r][c]), channels[c]);
+        const __m256i belowUpper = _mm256_cmpeq_epi8(_mm256_min_epu8(channels[c], upper[r][c]), channels[c]);
+        const __m256i channelInside = _mm256_or_si256(_mm256_and_si256(aboveLower, belowUpper),
+                                                      _mm256_and_si256(wraps[r][c], _mm256_or_si256(aboveLower, belowUpper)));
+        inside = _mm256_and_si256(inside, channelInside);
+      }
+      colorMasks[aRanges.color[r]] = _mm256_or_si256(colorMasks[aRanges.color[r]], inside);
+    }
+
+    for (size_t color = 0; color < aRanges.colorCount; color++)
+    {
+      _mm256_storeu_si256((__m256i *)(aMaskRows[color] + x), colorMasks[color]);
+    }
+  }
+  return x;
+}
+
+#endif
+
+/**
+ * @brief Use the best supported path when the requested one is not available
+ */
+KernelPath resolvePath(KernelPath aPath)
+{
+  const KernelPath best = bestKernelPath();
+  if (aPath == KernelPath::AUTO || (aPath == KernelPath::AVX2 && best != KernelPath::AVX2) ||
+      (aPath == KernelPath::SSSE3 && best == KernelPath::SCALAR))
+  {
+    return best;
+  }
+  return aPath;
+}
+
+/**
+ * @brief Threshold a row with prepared ranges
+ */
+void thresholdRow(const uchar *aPixels, int aWidth, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                  const FlatRanges &aFlatRanges, bool aFlattened, uchar *const *aMaskRows, KernelPath aPath)
+{
+  int x = 0;
+#if COLOR_KERNEL_X86_DISPATCH
+  if (aFlattened && aPath == KernelPath::AVX2)
+  {
+    x = avx2Row(aPixels, aWidth, aFlatRanges, aMaskRows);
+  }
+  else if (aFlattened && aPath == KernelPath::SSSE3)
+  {
+    x = ssse3Row(aPixels, aWidth, aFlatRanges, aMaskRows);
+  }
+#else
+  (void)aFlatRanges;
+  (void)aFlattened;
+  (void)aPath;
+#endif
+  scalarRow(aPixels, x, aWidth, aColorRanges, aMaskRows);
+}
+} // namespace
+
+ColorRange ScalarsToColorRange(const Scalar &aLower, const Scalar &aUpper)
+{
+  ColorRange result;
+  for (int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    result.lower[c] = saturate_cast<uchar>(aLower[c]);
+    result.upper[c] = saturate_cast<uchar>(aUpper[c]);
+  }
+  return result;
+}
+
+KernelPath bestKernelPath()
+{
+#if COLOR_KERNEL_X86_DISPATCH
+  static const KernelPath best = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return KernelPath::AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+      return KernelPath::SSSE3;
+    }
+    return KernelPath::SCALAR;
+  }();
+  return best;
+#else
+  return KernelPath::SCALAR;
+#endif
+}
+
+std::string KernelPathToString(KernelPath aPath)
+{
+  switch (aPath)
+  {
+    case KernelPath::AUTO:
+      return "auto (" + KernelPathToString(bestKernelPath()) + ")";
+    case KernelPath::SCALAR:
+      return "scalar";
+    case KernelPath::SSSE3:
+      return "ssse3";
+    case KernelPath::AVX2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+void fusedInRangeRow(const uchar *aPixels, int aWidth, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                     uchar *const *aMaskRows, KernelPath aPath)
+{
+  FlatRanges flatRanges;
+  bool flattened = flattenRanges(aColorRanges, flatRanges);
+  thresholdRow(aPixels, aWidth, aColorRanges, flatRanges, flattened, aMaskRows, resolvePath(aPath));
+}
+
+void fusedInRange(const Mat &aImage, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                  std::vector<Mat> &aMasks, KernelPath aPath)
+{
+  CV_Assert(aImage.type() == CV_8UC3);
+
+  aMasks.resize(aColorRanges.size());
+  for (Mat &mask : aMasks)
+  {
+    mask.create(aImage.rows, aImage.cols, CV_8U);
+  }
+
+  FlatRanges flatRanges;
+  const bool flattened = flattenRanges(aColorRanges, flatRanges);
+  const KernelPath path = resolvePath(aPath);
+
+  // On the stack for every color count the vector paths handle, the kernel runs for every frame
+  AutoBuffer<uchar *, MAX_VECTOR_COLORS> maskRows(aMasks.size());
+  for (int y = 0; y < aImage.rows; y++)
+  {
+    for (size_t color = 0; color < aMasks.size(); color++)
+    {
+      maskRows[color] = aMasks.at(color).ptr<uchar>(y);
+    }
+    thresholdRow(aImage.ptr<uchar>(y), aImage.cols, aColorRanges, flatRanges, flattened, maskRows, path);
+  }
+}
+
+void fusedInRange(const Mat &aImage, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                  std::vector<BitMask> &aMasks, Point aOffset, KernelPath aPath)
+{
+  CV_Assert(aImage.type() == CV_8UC3 && aMasks.size() == aColorRanges.size());
+
+  FlatRanges flatRanges;
+  const bool flattened = flattenRanges(aColorRanges, flatRanges);
+  const KernelPath path = resolvePath(aPath);
+
+  // The 8-bit rows of one chunk per color stay in L1 until they are packed
+  AutoBuffer<uchar, MAX_VECTOR_COLORS * PACK_CHUNK> chunk(aMasks.size() * PACK_CHUNK);
+  AutoBuffer<uchar *, MAX_VECTOR_COLORS> chunkRows(aMasks.size());
+  for (size_t color = 0; color < aMasks.size(); color++)
+  {
+    chunkRows[color] = chunk + color * PACK_CHUNK;
+  }
+
+  for (int y = 0; y < aImage.rows; y++)
+  {
+    const uchar *pixels = aImage.ptr<uchar>(y);
+    for (int x = 0; x < aImage.cols; x += PACK_CHUNK)
+    {
+      const int width = std::min(PACK_CHUNK, aImage.cols - x);
+      thresholdRow(pixels + x * CHANNEL_COUNT, width, aColorRanges, flatRanges, flattened, chunkRows, path);
+      for (size_t color = 0; color < aMasks.size(); color++)
+      {
+        aMasks[color].setRow(aOffset.y + y, aOffset.x + x, chunkRows[color], width);
+      }
+    }
+  }
+}
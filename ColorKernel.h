@@ -0,0 +1,98 @@
+#ifndef COLOR_KERNEL_H_
+#define COLOR_KERNEL_H_
+
+// Library
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Local
+#include "BitMask.h"
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief An inclusive range per channel, in the channel order of the image
+ *
+ * A channel whose lower limit is above its upper limit wraps around, so a
+ * hue range of 170..10 selects 170..255 and 0..10.
+ */
+struct ColorRange
+{
+  uchar lower[3];
+  uchar upper[3];
+};
+
+/**
+ * @brief The implementation used by the fused color kernel
+ */
+enum class KernelPath
+{
+  AUTO, // the fastest path the processor supports
+  SCALAR,
+  SSSE3,
+  AVX2
+};
+
+/**
+ * @brief Convert two scalars to a color range
+ *
+ * @param aLower The lower limits
+ * @param aUpper The upper limits
+ * @return ColorRange the range
+ */
+ColorRange ScalarsToColorRange(const Scalar &aLower, const Scalar &aUpper);
+
+/**
+ * @brief Get the fastest kernel path the processor supports
+ */
+KernelPath bestKernelPath();
+
+/**
+ * @brief Convert a kernel path to its name
+ */
+std::string KernelPathToString(KernelPath aPath);
+
+/**
+ * @brief Threshold one row of 3-channel pixels against every color at once
+ *
+ * @param aPixels The interleaved 3-channel pixels
+ * @param aWidth The number of pixels
+ * @param aColorRanges The ranges per color, a pixel matches a color when it is inside any of its ranges
+ * @param aMaskRows One output row per color, set to 255 for a match and 0 otherwise
+ * @param aPath The implementation to use
+ */
+void fusedInRangeRow(const uchar *aPixels, int aWidth, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                     uchar *const *aMaskRows, KernelPath aPath = KernelPath::AUTO);
+
+/**
+ * @brief Threshold a BGR image against every color in a single pass
+ *
+ * Reads every pixel once and writes one mask per color, the same masks an
+ * inRange per range and a bitwise_or per extra range would give.
+ *
+ * @param aImage The 8-bit 3-channel image
+ * @param aColorRanges The ranges per color
+ * @param aMasks The masks, one per color, reallocated only when the size changes
+ * @param aPath The implementation to use
+ */
+void fusedInRange(const Mat &aImage, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                  std::vector<Mat> &aMasks, KernelPath aPath = KernelPath::AUTO);
+
+/**
+ * @brief Threshold a BGR image against every color in a single pass, into packed masks
+ *
+ * A short part of every row is thresholded on the stack and packed, so no
+ * 8-bit mask is ever written out.
+ *
+ * @param aImage The 8-bit 3-channel image
+ * @param aColorRanges The ranges per color
+ * @param aMasks The masks, one per color, already created and large enough to hold the image at aOffset
+ * @param aOffset The position of the image in the masks, when it is a region of a larger image
+ * @param aPath The implementation to use
+ */
+void fusedInRange(const Mat &aImage, const std::vector<std::vector<ColorRange>> &aColorRanges,
+                  std::vector<BitMask> &aMasks, Point aOffset = Point(), KernelPath aPath = KernelPath::AUTO);
+
+#endif
@@ -0,0 +1,159 @@
+// Library
+#include <algorithm>
+
+// Local
+#include "ColorLut.h"
+
+namespace
+{
+const int CHANNEL_COUNT = 3;
+const int MAX_BITS_PER_CHANNEL = 8;
+const size_t MAX_STACK_ROW = 4096; // the widest row whose color bits stay on the stack
+} // namespace
+
+ColorLut::ColorLut()
+    : mBitsPerChannel(0)
+{
+}
+
+void ColorLut::build(const std::vector<std::vector<ColorRange>> &aColorRanges, int aBitsPerChannel)
+{
+    CV_Assert(aColorRanges.size() <= MAX_COLORS);
+
+    mBitsPerChannel = std::min(std::max(aBitsPerChannel, 1), MAX_BITS_PER_CHANNEL);
+    const size_t cellsPerChannel = (size_t)1 << mBitsPerChannel;
+    const int shift = MAX_BITS_PER_CHANNEL - mBitsPerChannel;
+    mTable.assign(cellsPerChannel * cellsPerChannel * cellsPerChannel, 0);
+
+    for (size_t color = 0; color < aColorRanges.size(); color++)
+    {
+        const uchar colorBit = (uchar)(1u << color);
+        for (const ColorRange &range : aColorRanges.at(color))
+        {
+            // A range is a box per channel, so the cells inside it are a box too
+            std::vector<uchar> inside[CHANNEL_COUNT];
+            for (int c = 0; c < CHANNEL_COUNT; c++)
+            {
+                inside[c].resize(cellsPerChannel);
+                for (size_t cell = 0; cell < cellsPerChannel; cell++)
+                {
+                    const int center = (int)(cell << shift) + ((1 << shift) >> 1);
+                    const int lower = range.lower[c];
+                    const int upper = range.upper[c];
+                    inside[c].at(cell) = (lower <= upper) ? (center >= lower && center <= upper) : (center >= lower || center <= upper);
+                }
+            }
+
+            for (size_t b = 0; b < cellsPerChannel; b++)
+            {
+                if (inside[0].at(b) == false)
+                {
+                    continue;
+                }
+                for (size_t g = 0; g < cellsPerChannel; g++)
+                {
+                    if (inside[1].at(g) == false)
+                    {
+                        continue;
+                    }
+                    uchar *row = &mTable.at((b * cellsPerChannel + g) * cellsPerChannel);
+                    for (size_t r = 0; r < cellsPerChannel; r++)
+                    {
+                        if (inside[2].at(r))
+                        {
+                            row[r] |= colorBit;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ColorLut::apply(const Mat &aImage, const std::vector<size_t> &aColors, std::vector<Mat> &aMasks) const
+{
+    CV_Assert(aImage.type() == CV_8UC3 && empty() == false);
+
+    aMasks.resize(aColors.size());
+    for (Mat &mask : aMasks)
+    {
+        mask.create(aImage.rows, aImage.cols, CV_8U);
+    }
+
+    const int shift = MAX_BITS_PER_CHANNEL - mBitsPerChannel;
+    const int bits = mBitsPerChannel;
+    const uchar *table = mTable.data();
+
+    // One gather per pixel into a row of color bits, then one vectorizable pass per mask
+    AutoBuffer<uchar, MAX_STACK_ROW> colorBits((size_t)aImage.cols);
+    for (int y = 0; y < aImage.rows; y++)
+    {
+        const uchar *pixel = aImage.ptr<uchar>(y);
+        for (int x = 0; x < aImage.cols; x++, pixel += CHANNEL_COUNT)
+        {
+            const size_t index = ((size_t)(pixel[0] >> shift) << (2 * bits)) | ((size_t)(pixel[1] >> shift) << bits) |
+                                 (size_t)(pixel[2] >> shift);
+            colorBits[(size_t)x] = table[index];
+        }
+
+        for (size_t i = 0; i < aColors.size(); i++)
+        {
+            const unsigned int colorShift = (unsigned int)aColors[i];
+            uchar *maskRow = aMasks[i].ptr<uchar>(y);
+            for (int x = 0; x < aImage.cols; x++)
+            {
+                // 0 - 1 gives 255 for a set bit
+                maskRow[x] = (uchar)(0u - ((colorBits[(size_t)x] >> colorShift) & 1u));
+            }
+        }
+    }
+}
+
+void ColorLut::apply(const Mat &aImage, const std::vector<size_t> &aColors, std::vector<BitMask> &aMasks, Point aOffset) const
+{
+    CV_Assert(aImage.type() == CV_8UC3 && empty() == false && aMasks.size() == aColors.size());
+
+    const int shift = MAX_BITS_PER_CHANNEL - mBitsPerChannel;
+    const int bits = mBitsPerChannel;
+    const uchar *table = mTable.data();
+
+    // The same gather, then the bits of every color are packed a row at a time
+    AutoBuffer<uchar, MAX_STACK_ROW> colorBits((size_t)aImage.cols);
+    AutoBuffer<uchar, MAX_STACK_ROW> highBits((size_t)aImage.cols);
+    for (int y = 0; y < aImage.rows; y++)
+    {
+        const uchar *pixel = aImage.ptr<uchar>(y);
+        for (int x = 0; x < aImage.cols; x++, pixel += CHANNEL_COUNT)
+        {
+            const size_t index = ((size_t)(pixel[0] >> shift) << (2 * bits)) | ((size_t)(pixel[1] >> shift) << bits) |
+                                 (size_t)(pixel[2] >> shift);
+            colorBits[(size_t)x] = table[index];
+        }
+
+        for (size_t i = 0; i < aColors.size(); i++)
+        {
+            // The bit of the color moves to the high bit of every byte, the bit the packing looks at
+            const unsigned int colorShift = 7u - (unsigned int)aColors[i];
+            for (int x = 0; x < aImage.cols; x++)
+            {
+                highBits[(size_t)x] = (uchar)(colorBits[(size_t)x] << colorShift);
+            }
+            aMasks[i].setRow(aOffset.y + y, aOffset.x, highBits, aImage.cols);
+        }
+    }
+}
+
+bool ColorLut::empty() const
+{
+    return mTable.empty();
+}
+
+int ColorLut::bitsPerChannel() const
+{
+    return mBitsPerChannel;
+}
+
+size_t ColorLut::tableBytes() const
+{
+    return mTable.size();
+}
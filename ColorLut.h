@@ -0,0 +1,76 @@
+#ifndef COLOR_LUT_H_
+#define COLOR_LUT_H_
+
+// Library
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Local
+#include "ColorKernel.h"
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief Quantized 3D lookup table from a pixel value to the colors it has
+ *
+ * Every entry holds one bit per color. The pixel channels are quantized to
+ * bitsPerChannel bits, the cell is classified by its center, so only the
+ * 8 bit table is exact. A 5 bit table (32 KB) fits in L1, a 6 bit table
+ * (256 KB) in L2.
+ */
+class ColorLut
+{
+public:
+  /**
+   * @brief The maximum number of colors, one bit per color in an entry
+   */
+  static const size_t MAX_COLORS = 8;
+
+  ColorLut();
+
+  /**
+   * @brief Classify every cell of the table
+   * @param aColorRanges The ranges per color, at most MAX_COLORS colors
+   * @param aBitsPerChannel The quantization, 1 up to 8 bits per channel
+   */
+  void build(const std::vector<std::vector<ColorRange>> &aColorRanges, int aBitsPerChannel);
+
+  /**
+   * @brief Make the masks of some colors with one table lookup per pixel
+   * @param aImage The 8-bit 3-channel image
+   * @param aColors The indices of the colors (as passed to build) to make masks for
+   * @param aMasks The masks, one per color, reallocated only when the size changes
+   */
+  void apply(const Mat &aImage, const std::vector<size_t> &aColors, std::vector<Mat> &aMasks) const;
+
+  /**
+   * @brief Make the packed masks of some colors with one table lookup per pixel
+   * @param aImage The 8-bit 3-channel image
+   * @param aColors The indices of the colors (as passed to build) to make masks for
+   * @param aMasks The masks, one per color, already created and large enough to hold the image at aOffset
+   * @param aOffset The position of the image in the masks, when it is a region of a larger image
+   */
+  void apply(const Mat &aImage, const std::vector<size_t> &aColors, std::vector<BitMask> &aMasks, Point aOffset = Point()) const;
+
+  /**
+   * @brief Get whether the table was built
+   */
+  bool empty() const;
+
+  /**
+   * @brief Get the quantization in bits per channel
+   */
+  int bitsPerChannel() const;
+
+  /**
+   * @brief Get the size of the table in bytes
+   */
+  size_t tableBytes() const;
+
+private:
+  std::vector<uchar> mTable;
+  int mBitsPerChannel;
+};
+
+#endif
@@ -0,0 +1,94 @@
+// Library
+#include <cmath>
+
+// Local
+#include "ContourFeatures.h"
+
+size_t ContourFeatures::size() const
+{
+    return centers.size();
+}
+
+void ContourFeatures::clear()
+{
+    centers.clear();
+    areas.clear();
+    arcLengths.clear();
+    vertexCounts.clear();
+    boundingBoxes.clear();
+    fillRatios.clear();
+}
+
+void ContourFeatures::compact(const std::vector<uchar> &aKeep)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < size(); i++)
+    {
+        if (aKeep.at(i) != 0)
+        {
+            centers.at(kept) = centers.at(i);
+            areas.at(kept) = areas.at(i);
+            arcLengths.at(kept) = arcLengths.at(i);
+            vertexCounts.at(kept) = vertexCounts.at(i);
+            boundingBoxes.at(kept) = boundingBoxes.at(i);
+            fillRatios.at(kept) = fillRatios.at(i);
+            kept++;
+        }
+    }
+
+    centers.resize(kept);
+    areas.resize(kept);
+    arcLengths.resize(kept);
+    vertexCounts.resize(kept);
+    boundingBoxes.resize(kept);
+    fillRatios.resize(kept);
+}
+
+void computeContourFeatures(const std::vector<Mat> &aContours, double aEpsilonMultiply, double aMinArea, double aMaxArea,
+                            ContourFeatures &aFeatures, std::vector<Point> &aApproxPoints)
+{
+    const size_t count = aContours.size();
+    aFeatures.centers.resize(count);
+    aFeatures.areas.resize(count);
+    aFeatures.arcLengths.resize(count);
+    aFeatures.vertexCounts.resize(count);
+    aFeatures.boundingBoxes.resize(count);
+    aFeatures.fillRatios.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Mat &contour = aContours.at(i);
+
+        // The area is the zeroth moment, no need for contourArea
+        Moments contourMoments = moments(contour);
+        const double area = std::abs(contourMoments.m00);
+        if (contourMoments.m00 != 0.0)
+        {
+            aFeatures.centers.at(i) = Point((int)(contourMoments.m10 / contourMoments.m00),
+                                            (int)(contourMoments.m01 / contourMoments.m00));
+        }
+        else
+        {
+            aFeatures.centers.at(i) = contour.at<Point>(0);
+        }
+        aFeatures.areas.at(i) = area;
+
+        const Rect boundingBox = boundingRect(contour);
+        aFeatures.boundingBoxes.at(i) = boundingBox;
+        aFeatures.fillRatios.at(i) = area / ((double)boundingBox.width * (double)boundingBox.height);
+
+        if (area > aMinArea && area < aMaxArea)
+        {
+            const double perimeter = arcLength(contour, true);
+            // A vector keeps its capacity, a Mat would be reallocated for every other corner count
+            approxPolyDP(contour, aApproxPoints, aEpsilonMultiply * perimeter, true);
+            aFeatures.arcLengths.at(i) = perimeter;
+            aFeatures.vertexCounts.at(i) = (int)aApproxPoints.size();
+        }
+        else
+        {
+            aFeatures.arcLengths.at(i) = 0.0;
+            aFeatures.vertexCounts.at(i) = 0;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CONTOUR_FEATURES_H_
+#define CONTOUR_FEATURES_H_
+
+// Library
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief The features of a list of contours, one entry per contour in every array
+ *
+ * Computed once per contour per frame, every classifier reads these arrays
+ * instead of measuring the contour again.
+ */
+struct ContourFeatures
+{
+  std::vector<Point> centers;       // center of mass of the contour
+  std::vector<double> areas;        // contourArea
+  std::vector<double> arcLengths;   // closed arcLength, 0 when outside the area range
+  std::vector<int> vertexCounts;    // corners of the approximated polygon, 0 when outside the area range
+  std::vector<Rect> boundingBoxes;  // boundingRect
+  std::vector<double> fillRatios;   // area / bounding box area
+
+  /**
+   * @brief Get the number of contours
+   */
+  size_t size() const;
+
+  /**
+   * @brief Remove every contour
+   */
+  void clear();
+
+  /**
+   * @brief Remove contours from every array, keeping the order of the others
+   * @param aKeep Non-zero for every contour to keep
+   */
+  void compact(const std::vector<uchar> &aKeep);
+};
+
+/**
+ * @brief Compute the features of every contour
+ *
+ * The polygon approximation is the expensive part, it is skipped for
+ * contours whose area is outside the range since they are never classified.
+ *
+ * @param aContours The contours
+ * @param aEpsilonMultiply The approximation accuracy as a fraction of the arc length
+ * @param aMinArea The exclusive lower limit of the area range
+ * @param aMaxArea The exclusive upper limit of the area range
+ * @param aFeatures The features, one entry per contour
+ * @param aApproxPoints Storage for the approximated polygon, reused between calls
+ */
+void computeContourFeatures(const std::vector<Mat> &aContours, double aEpsilonMultiply, double aMinArea, double aMaxArea,
+                            ContourFeatures &aFeatures, std::vector<Point> &aApproxPoints);
+
+#endif
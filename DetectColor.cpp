@@ -1,50 +1,182 @@
 #include "Shapedetector.h"
 
-Mat Shapedetector::detectColor(COLORS aColor, Mat aImage)
+void Shapedetector::filterColors(FrameContext &aContext) const
 {
-  Mat resultMask;
-  Mat tempMask;
-  Mat resultImage;
+  ScopedStageTimer timer(mStageProfile, Stage::COLOR);
+  aContext.detectionStart = std::chrono::steady_clock::now();
+
+  // The ranges and table bits are gathered once per frame from its snapshot, into the storage of the context
+  const DetectionParameters &parameters = *aContext.parameters;
+  requestedColors(*aContext.result.queries, aContext.colors);
+  aContext.colorRanges.resize(aContext.colors.size());
+  aContext.colorBits.resize(aContext.colors.size());
+  for (size_t i = 0; i < aContext.colors.size(); i++)
+  {
+    aContext.colorRanges.at(i) = parameters.colorRanges.at((size_t)aContext.colors.at(i));
+    // The table is built with every color at the bit of its COLORS value
+    aContext.colorBits.at(i) = (size_t)aContext.colors.at(i);
+  }
+
+  // A keyframe only searches the candidates of a smaller pyramid level at full resolution
+  double coarseFraction = 0.0;
+  if (aContext.fullFrame && mPyramidLevels > 0)
+  {
+    findCandidateRegions(aContext);
+    coarseFraction = 1.0 / (double)(1 << (2 * mPyramidLevels));
+  }
+
+  aContext.colorMasks.resize(aContext.colors.size());
+  for (BitMask &colorMask : aContext.colorMasks)
+  {
+    colorMask.create(aContext.originalImage.rows, aContext.originalImage.cols);
+  }
+
+  if (aContext.fullFrame)
+  {
+    // One pass over the image makes the masks of every requested color
+    thresholdColors(aContext, aContext.originalImage, Point(), aContext.colorMasks);
+    aContext.result.processedFraction = 1.0;
+  }
+  else
+  {
+    // Only the regions are thresholded, the rest of the masks stays empty
+    for (BitMask &colorMask : aContext.colorMasks)
+    {
+      colorMask.clear();
+    }
+    for (const Rect &region : aContext.regions)
+    {
+      thresholdColors(aContext, aContext.originalImage(region), region.tl(), aContext.colorMasks);
+    }
+    aContext.result.processedFraction = coarseFraction + (double)RegionTracker::regionPixels(aContext.regions) /
+                                                             (double)aContext.originalImage.total();
+  }
+
+  if (mHeadless == false)
+  {
+    // The masks are only unpacked to show them
+    aContext.scratchMask.create(aContext.originalImage.rows, aContext.originalImage.cols);
+    aContext.scratchMask.clear();
+    for (const BitMask &colorMask : aContext.colorMasks)
+    {
+      aContext.scratchMask.bitwiseOr(colorMask);
+    }
+    aContext.scratchMask.toMat(aContext.maskImage);
+  }
+}
+
+void Shapedetector::thresholdColors(const FrameContext &aContext, const Mat &aImage, Point aOffset, std::vector<BitMask> &aMasks) const
+{
+  const ColorLut &colorLut = aContext.parameters->colorLut;
+  if (colorLut.empty())
+  {
+    fusedInRange(aImage, aContext.colorRanges, aMasks, aOffset);
+  }
+  else
+  {
+    colorLut.apply(aImage, aContext.colorBits, aMasks, aOffset);
+  }
+}
+
+void Shapedetector::findCandidateRegions(FrameContext &aContext) const
+{
+  const int scale = 1 << mPyramidLevels;
+  const double areaScale = (double)scale * (double)scale;
+  const int padding = 2 * scale; // a shape edge can blur into the next coarse pixel on either side
+  const Rect frame(0, 0, aContext.originalImage.cols, aContext.originalImage.rows);
+  const CalibrationProfile &profile = aContext.parameters->profile;
+
+  // Area interpolation averages every scale x scale block, like every pyramid level would
+  resize(aContext.originalImage, aContext.coarseImage, Size(), 1.0 / scale, 1.0 / scale, INTER_AREA);
+  aContext.coarseMasks.resize(aContext.colors.size());
+  for (BitMask &coarseMask : aContext.coarseMasks)
+  {
+    coarseMask.create(aContext.coarseImage.rows, aContext.coarseImage.cols);
+  }
+  thresholdColors(aContext, aContext.coarseImage, Point(), aContext.coarseMasks);
+
+  aContext.regions.clear();
+  for (const BitMask &coarseMask : aContext.coarseMasks)
+  {
+    aContext.labeler.label(coarseMask);
+    for (const Blob &blob : aContext.labeler.blobs())
+    {
+      // The size limits scaled to the coarse level, with a coarse pixel of slack around the blob
+      const double maxArea = (double)(blob.boundingBox.width + 2) * (double)(blob.boundingBox.height + 2) * areaScale;
+      const double minArea = (double)(blob.area - blob.perimeter) * areaScale;
+      if (maxArea <= profile.minContourSize || minArea >= profile.maxContourSize)
+      {
+        continue;
+      }
+
+      const Rect region(blob.boundingBox.x * scale - padding, blob.boundingBox.y * scale - padding,
+                        blob.boundingBox.width * scale + 2 * padding, blob.boundingBox.height * scale + 2 * padding);
+      RegionTracker::mergeRegion(aContext.regions, region & frame);
+    }
+  }
+  aContext.fullFrame = false;
+}
+
+std::unique_ptr<DetectionParameters> Shapedetector::buildParameters(const CalibrationProfile &aProfile, int aColorLutBits)
+{
+  std::unique_ptr<DetectionParameters> parameters(new DetectionParameters());
+  parameters->profile = aProfile;
+  parameters->colorRanges.resize(COLORSTRINGS.size() - 1);
+  for (size_t i = 0; i < parameters->colorRanges.size(); i++)
+  {
+    colorRanges(aProfile, COLORS(i), parameters->colorRanges.at(i));
+  }
+
+  // The table is the slow part, it is built here and never while a frame uses it
+  if (aColorLutBits > 0)
+  {
+    parameters->colorLut.build(parameters->colorRanges, aColorLutBits);
+  }
+  return parameters;
+}
+
+void Shapedetector::colorRanges(const CalibrationProfile &aProfile, COLORS aColor, std::vector<ColorRange> &aRanges)
+{
+  aRanges.clear();
   switch (aColor)
   {
     case COLORS::BLUE:
     {
-      inRange(aImage, mBlueLimits[0], mBlueLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.blueLimits[0], aProfile.blueLimits[1]));
       break;
     }
     case COLORS::GREEN:
     {
-      inRange(aImage, mGreenLimits[0], mGreenLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.greenLimits[0], aProfile.greenLimits[1]));
       break;
     }
     case COLORS::RED:
     {
-      inRange(aImage, mRedLimits[0], mRedLimits[1], resultMask);
-      // inRange(aImage, mRedLimits[2], mRedLimits[3], tempMask);
-      // bitwise_or(resultMask, tempMask, resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.redLimits[0], aProfile.redLimits[1]));
+      // The masks are made from the BGR image, redLimits[2..3] is an HSV hue range
+      // aRanges.push_back(ScalarsToColorRange(aProfile.redLimits[2], aProfile.redLimits[3]));
       break;
     }
     case COLORS::BLACK:
     {
-      inRange(aImage, mBlackLimits[0], mBlackLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.blackLimits[0], aProfile.blackLimits[1]));
       break;
     }
     case COLORS::YELLOW:
     {
-      inRange(aImage, mYellowLimits[0], mYellowLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.yellowLimits[0], aProfile.yellowLimits[1]));
       break;
     }
     case COLORS::WHITE:
     {
-      inRange(aImage, mWhiteLimits[0], mWhiteLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.whiteLimits[0], aProfile.whiteLimits[1]));
       break;
     }
     case COLORS::UNKNOWNCOLOR:
     {
-      inRange(aImage, mBlackLimits[0], mBlackLimits[1], resultMask);
+      aRanges.push_back(ScalarsToColorRange(aProfile.blackLimits[0], aProfile.blackLimits[1]));
       std::cout << "Error: unknown color = " << aColor << std::endl;
       break;
     }
   }
-  return resultMask;
-}
\ No newline at end of file
+}
@@ -1,220 +1,271 @@
 #include "Shapedetector.h"
 
-void Shapedetector::detectSquares(std::vector<Mat> aContours)
+SHAPES Shapedetector::classifyShape(const ContourFeatures &aFeatures, size_t aIndex, const FrameContext &aContext) const
 {
-  for (size_t i = 0; i < aContours.size(); i++)
+  const FrameSettings &settings = aContext.settings;
+  const CalibrationProfile &profile = aContext.parameters->profile;
+  // The corner count decides the shape, the square and half circle also check their proportions
+  const int cornerCount = aFeatures.vertexCounts.at(aIndex);
+  SHAPES result = SHAPES::UNKNOWNSHAPE;
+  if (cornerCount == SQUARE_CORNERCOUNT)
+  {
+    //Check if it is a square
+    const Rect &boundedRect = aFeatures.boundingBoxes.at(aIndex);
+    float ratio = (float)boundedRect.width / (float)boundedRect.height;
+    result = (ratio > settings.minSquareRatio && ratio < settings.maxSquareRatio) ? SHAPES::SQUARE : SHAPES::RECTANGLE;
+  }
+  else if (cornerCount == TRIANGLE_CORNERCOUNT)
   {
-    double epsilon = mEpsilonMultiply * arcLength(mCurrentContours.at(i), true);
-    approxPolyDP(mCurrentContours.at(i), mApproxImage, epsilon, true);
-    if (mApproxImage.size().height == SQUARE_CORNERCOUNT)
+    result = SHAPES::TRIANGLE;
+  }
+  else if (cornerCount == 5)
+  {
+    //Check for half circle
+    double shapePercentage = 100.0 * aFeatures.fillRatios.at(aIndex);
+    if (shapePercentage > profile.minHalfCirclePercentage && shapePercentage < profile.maxHalfCirclePercentage)
     {
-      if (contourSizeAllowed(mCurrentContours.at(i)))
-      {
-        //Check if it is a square
-        Rect boundedRect = boundingRect(mCurrentContours.at(i));
-        float ratio = (float)boundedRect.width / (float)boundedRect.height;
-        if(ratio > mMinSquareRatio && ratio < mMaxSquareRatio)
-        {
-          mCurrentShapeCount++;
-          drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-          setShapeValues(mDisplayImage, mCurrentContours.at(i));
-        }
-      }
+      result = SHAPES::HALFCIRCLE;
     }
   }
+  else if (cornerCount > 5)
+  {
+    result = SHAPES::CIRCLE;
+  }
+  return result;
 }
 
-void Shapedetector::detectRectangles(std::vector<Mat> aContours)
+bool Shapedetector::queryMatches(SHAPES aQueryShape, SHAPES aLabel)
 {
-  for (size_t i = 0; i < aContours.size(); i++)
+  bool result = false;
+  switch (aQueryShape)
   {
-    double epsilon = mEpsilonMultiply * arcLength(mCurrentContours.at(i), true);
-    approxPolyDP(mCurrentContours.at(i), mApproxImage, epsilon, true);
-    if (mApproxImage.size().height == SQUARE_CORNERCOUNT)
+    case SHAPES::ALL_SHAPES:
     {
-      if (contourSizeAllowed(mCurrentContours.at(i)))
-      {
-        mCurrentShapeCount++;
-        drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-        setShapeValues(mDisplayImage, mCurrentContours.at(i));
-      }
+      result = true;
+      break;
+    }
+    case SHAPES::RECTANGLE:
+    {
+      // A square is a rectangle too
+      result = (aLabel == SHAPES::RECTANGLE || aLabel == SHAPES::SQUARE);
+      break;
+    }
+    case SHAPES::UNKNOWNSHAPE:
+    {
+      std::cout << "ERROR - Unknown shape" << std::endl;
+      break;
+    }
+    default:
+    {
+      result = (aLabel == aQueryShape);
+      break;
     }
   }
+  return result;
 }
 
-void Shapedetector::detectTriangles(std::vector<Mat> aContours)
+bool Shapedetector::contourSizeAllowed(const CalibrationProfile &aProfile, double aArea)
 {
-  for (size_t i = 0; i < aContours.size(); i++)
-  {
-    double epsilon = mEpsilonMultiply * arcLength(mCurrentContours.at(i), true);
-    approxPolyDP(mCurrentContours.at(i), mApproxImage, epsilon, true);
-    if (mApproxImage.size().height == TRIANGLE_CORNERCOUNT)
-    {
-      if (contourSizeAllowed(mCurrentContours.at(i)))
-      {
-        mCurrentShapeCount++;
-        drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-        setShapeValues(mDisplayImage, mCurrentContours.at(i));
-      }
-    }
-  }
+  return (aArea > aProfile.minContourSize && aArea < aProfile.maxContourSize);
 }
 
-void Shapedetector::detectCircles(std::vector<Mat> aContours)
+bool Shapedetector::blobSizePossible(const CalibrationProfile &aProfile, const Blob &aBlob)
 {
-  for (size_t i = 0; i < aContours.size(); i++)
+  // The contour runs through the centers of the outer pixels: it lies inside the bounding box
+  // of those centers and encloses at least every pixel that is not on the border
+  const double maxContourArea = (double)(aBlob.boundingBox.width - 1) * (double)(aBlob.boundingBox.height - 1);
+  const double minContourArea = (double)(aBlob.area - aBlob.perimeter);
+  return (maxContourArea > aProfile.minContourSize && minContourArea < aProfile.maxContourSize);
+}
+
+void Shapedetector::requestedColors(const std::vector<ShapeQuery> &aQueries, std::vector<COLORS> &aColors)
+{
+  aColors.clear();
+  for (const ShapeQuery &query : aQueries)
   {
-    double epsilon = mEpsilonMultiply * arcLength(mCurrentContours.at(i), true);
-    approxPolyDP(mCurrentContours.at(i), mApproxImage, epsilon, true);
-    if (mApproxImage.size().height > 5)
+    if (std::find(aColors.begin(), aColors.end(), query.color) == aColors.end())
     {
-      if (contourSizeAllowed(mCurrentContours.at(i)))
-      {
-        mCurrentShapeCount++;
-        drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-        setShapeValues(mDisplayImage, mCurrentContours.at(i));
-      }
+      aColors.push_back(query.color);
     }
   }
 }
 
-void Shapedetector::detectHalfCircles(std::vector<Mat> aContours)
+void Shapedetector::findShapeContours(FrameContext &aContext) const
 {
-  for (size_t i = 0; i < aContours.size(); i++)
+  ScopedStageTimer timer(mStageProfile, Stage::CONTOURS);
+  const CalibrationProfile &profile = aContext.parameters->profile;
+  aContext.contours.resize(aContext.colorMasks.size());
+  aContext.contourPoints.resize(aContext.colorMasks.size());
+  aContext.features.resize(aContext.colorMasks.size());
+  for (size_t i = 0; i < aContext.colorMasks.size(); i++)
   {
-    double epsilon = mEpsilonMultiply * arcLength(aContours.at(i), true);
-    approxPolyDP(aContours.at(i), mApproxImage, epsilon, true);
-    if (mApproxImage.size().height == 5)
+    std::vector<Point> &points = aContext.contourPoints.at(i);
+    points.clear();
+    aContext.contourSizes.clear();
+
+    // Label the blobs in one pass, only blobs that can have an allowed size are traced
+    const BitMask &colorMask = aContext.colorMasks.at(i);
+    const size_t regionCount = aContext.fullFrame ? 1 : aContext.regions.size();
+    for (size_t regionIndex = 0; regionIndex < regionCount; regionIndex++)
     {
-      if (contourSizeAllowed(aContours.at(i)))
+      if (aContext.fullFrame)
+      {
+        aContext.labeler.label(colorMask);
+      }
+      else
       {
-        //Check for half circle
-        Rect boundedRect = boundingRect(aContours.at(i));
-        double shapeArea = contourArea(aContours.at(i));
-        float squareArea = (float)boundedRect.width * (float)boundedRect.height;
-        double shapePercentage = (100.0f * ((float)shapeArea / (float)squareArea));
-        if(shapePercentage > mMinHalfCirclePercentage && shapePercentage < mMaxHalfCirclePercentage)
+        // A region is labeled on its own, as the noise filter saw it
+        const Rect &region = aContext.regions.at(regionIndex);
+        colorMask.copyRegion(region, aContext.scratchMask);
+        aContext.labeler.label(aContext.scratchMask, region.tl());
+      }
+      const std::vector<Blob> &blobs = aContext.labeler.blobs();
+      for (size_t blobIndex = 0; blobIndex < blobs.size(); blobIndex++)
+      {
+        if (blobSizePossible(profile, blobs.at(blobIndex)))
         {
-          mCurrentShapeCount++;
-          drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-          setShapeValues(mDisplayImage, mCurrentContours.at(i));
+          aContext.contourSizes.push_back(aContext.labeler.traceContour(blobIndex, points));
         }
       }
     }
+
+    // The points do not move anymore, every contour is a header on its part of them
+    std::vector<Mat> &contours = aContext.contours.at(i);
+    contours.clear();
+    size_t start = 0;
+    for (size_t contourSize : aContext.contourSizes)
+    {
+      if (contourSize > 0)
+      {
+        contours.push_back(Mat((int)contourSize, 1, CV_32SC2, &points.at(start)));
+      }
+      start += contourSize;
+    }
+
+    // Measure every contour once, everything after this reads the features
+    computeContourFeatures(contours, profile.epsilonMultiply, profile.minContourSize, profile.maxContourSize, aContext.features.at(i), aContext.approxPoints);
+    removeCloseShapes(contours, aContext.features.at(i), aContext.centerGrid, profile.contourCenterMargin);
   }
 }
 
-bool Shapedetector::contourSizeAllowed(Mat aContour) const
+void Shapedetector::classifyShapes(FrameContext &aContext) const
 {
-  return (contourArea(aContour) > mMinContourSize && contourArea(aContour) < mMaxContourSize);
-}
+  ScopedStageTimer timer(mStageProfile, Stage::CLASSIFY);
 
-std::vector<Mat> Shapedetector::detectShape(SHAPES aShape, Mat aShapeMask)
-{
-  findContours(aShapeMask, mCurrentContours, CV_RETR_EXTERNAL, CHAIN_APPROX_NONE);
-  removeCloseShapes(mCurrentContours);
-  switch (aShape)
+  // Label every contour once
+  for (size_t i = 0; i < aContext.colors.size(); i++)
   {
-    case SHAPES::ALL_SHAPES:
+    labelShapes(i, aContext.features.at(i), aContext);
+  }
+
+  // Every query filters the labeled shapes
+  const std::vector<ShapeQuery> &queries = *aContext.result.queries;
+  for (const LabeledShape &shape : aContext.result.shapes)
+  {
+    for (size_t queryIndex = 0; queryIndex < queries.size(); queryIndex++)
     {
-      for (size_t i = 0; i < mCurrentContours.size(); i++)
+      const ShapeQuery &query = queries.at(queryIndex);
+      if (query.color == shape.color && queryMatches(query.shape, shape.shape))
       {
-        double epsilon = mEpsilonMultiply * arcLength(mCurrentContours.at(i), true);
-        approxPolyDP(mCurrentContours.at(i), mApproxImage, epsilon, true);
-        if(contourSizeAllowed(mCurrentContours.at(i)))
-        {
-          mCurrentShapeCount++;
-          drawShapeContours(mDisplayImage, mCurrentContours.at(i));
-          setShapeValues(mDisplayImage, mCurrentContours.at(i));
-        }
+        aContext.result.shapeCounts.at(queryIndex)++;
+        setShapeValues(aContext, shape, queryIndex);
       }
-      break;
     }
-    case SHAPES::SQUARE:
-    {
-      detectSquares(mCurrentContours);
-      break;
-    }
-    case SHAPES::RECTANGLE:
-    {
-      detectRectangles(mCurrentContours);
-      break;
-    }
-    case SHAPES::TRIANGLE:
-    {
-      detectTriangles(mCurrentContours);
-      break;
-    }
-    case SHAPES::CIRCLE:
+  }
+
+  // Stop timer, in a pipeline this includes the waits between the stages
+  const std::chrono::duration<double, std::milli> detectionTime = std::chrono::steady_clock::now() - aContext.detectionStart;
+  aContext.result.detectionTime = detectionTime.count();
+}
+
+void Shapedetector::drawShapes(FrameContext &aContext) const
+{
+  if (mHeadless)
+  {
+    return;
+  }
+  ScopedStageTimer timer(mStageProfile, Stage::DRAW);
+
+  // A shape found by several queries is drawn once
+  for (const LabeledShape &shape : aContext.result.shapes)
+  {
+    bool found = false;
+    for (const ShapeQuery &query : *aContext.result.queries)
     {
-      detectCircles(mCurrentContours); 
-      break;
+      found = found || (query.color == shape.color && queryMatches(query.shape, shape.shape));
     }
-    case SHAPES::HALFCIRCLE:
+    if (found == false)
     {
-      detectHalfCircles(mCurrentContours);
-      break;
+      continue;
     }
-    case SHAPES::UNKNOWNSHAPE:
+
+    drawShapeContours(aContext.displayImage, aContext.contours.at(shape.colorIndex).at(shape.contourIndex));
+    const std::string xPosString = std::string("X: " + std::to_string(shape.center.x));
+    const std::string yPosString = std::string("Y: " + std::to_string(shape.center.y));
+    const std::string areaString = std::string("A: " + std::to_string(shape.area));
+    putText(aContext.displayImage, xPosString, Point(shape.center.x, shape.center.y), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
+    putText(aContext.displayImage, yPosString, Point(shape.center.x, shape.center.y + mTextOffset), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
+    putText(aContext.displayImage, areaString, Point(shape.center.x, shape.center.y + (mTextOffset * 2)), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
+  }
+
+  // Show recognition data in displayed image
+  setShapeCommand(aContext.displayImage, *aContext.result.queries);
+  setTimeValue(aContext.displayImage, aContext.result.detectionTime);
+  setShapeFound(aContext.displayImage, aContext.result);
+}
+
+void Shapedetector::labelShapes(size_t aColorIndex, const ContourFeatures &aFeatures, FrameContext &aContext) const
+{
+  for (size_t i = 0; i < aFeatures.size(); i++)
+  {
+    if (contourSizeAllowed(aContext.parameters->profile, aFeatures.areas.at(i)) == false)
     {
-      std::cout << "ERROR - Unknown shape" << std::endl;
-      break;
+      continue;
     }
+
+    LabeledShape shape;
+    shape.color = aContext.colors.at(aColorIndex);
+    shape.shape = classifyShape(aFeatures, i, aContext);
+    shape.colorIndex = aColorIndex;
+    shape.contourIndex = i;
+    shape.boundingBox = aFeatures.boundingBoxes.at(i);
+    shape.center = aFeatures.centers.at(i);
+    shape.area = (int)aFeatures.areas.at(i);
+    aContext.result.shapes.push_back(shape);
   }
-  return mCurrentContours;
 }
 
-void Shapedetector::removeCloseShapes(std::vector<Mat> &aContours) const
+void Shapedetector::removeCloseShapes(std::vector<Mat> &aContours, ContourFeatures &aFeatures, SpatialGrid &aGrid, int aMargin)
 {
-  Point currentCenter;
-  Point compareCenter;
+  // The first contour of every group of close centers is kept
+  const std::vector<uchar> &keep = aGrid.suppressNearDuplicates(aFeatures.centers, aMargin);
+
+  size_t kept = 0;
   for (size_t i = 0; i < aContours.size(); i++)
   {
-    currentCenter = getContourCenter(aContours.at(i));
-    //Remove duplicates
-    for (size_t j = 0; j < aContours.size(); j++)
+    if (keep.at(i) != 0)
     {
-      if (j != i) // Not the same shape
-      {
-        compareCenter = getContourCenter(aContours.at(j));
-        int Xdiff = abs(currentCenter.x - compareCenter.x);
-        int Ydiff = abs(currentCenter.y - compareCenter.y);
-        //Shape is too close
-        if (Xdiff <= mContourCenterMargin && Ydiff <= mContourCenterMargin)
-        {
-          aContours.erase(aContours.begin() + j);
-        }
-      }
+      std::swap(aContours.at(kept), aContours.at(i));
+      kept++;
     }
   }
+  aContours.resize(kept);
+  aFeatures.compact(keep);
 }
 
-void Shapedetector::setShapeValues(Mat aImage, Mat aContour)
+void Shapedetector::setShapeValues(FrameContext &aContext, const LabeledShape &aShape, size_t aQueryIndex) const
 {
-  Point currentCenter = getContourCenter(aContour);
-  const std::string xPosString = std::string("X: " + std::to_string(currentCenter.x));
-  const std::string yPosString = std::string("Y: " + std::to_string(currentCenter.y));
-  const std::string areaString = std::string("A: " + std::to_string((int)contourArea(aContour)));
-
-  // Place values in the image
-  putText(aImage, xPosString, Point(currentCenter.x, currentCenter.y), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
-  putText(aImage, yPosString, Point(currentCenter.x, currentCenter.y + mTextOffset), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
-  putText(aImage, areaString, Point(currentCenter.x, currentCenter.y + (mTextOffset * 2)), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(255, 255, 255), 1);
-
-  // Print to stdout
-  std::cout << "\tShape location:\t" << xPosString << "\t" << yPosString << "\t" << areaString << std::endl;
+  // Store the values, they are printed once the frame is done
+  ShapeDetection detection;
+  detection.queryIndex = aQueryIndex;
+  detection.shape = aShape.shape;
+  detection.color = aShape.color;
+  detection.center = aShape.center;
+  detection.area = aShape.area;
+  aContext.result.detections.push_back(detection);
 }
 
 void Shapedetector::drawShapeContours(Mat aImage, Mat aContour)
 {
   drawContours(aImage, aContour, -1, Scalar(0, 255, 0), 3);
 }
-
-Point Shapedetector::getContourCenter(Mat aContour)
-{
-  //Calculate center
-  Moments currentmoments = moments(aContour);
-  int centerX = (int)(currentmoments.m10 / currentmoments.m00);
-  int centerY = (int)(currentmoments.m01 / currentmoments.m00);
-  return Point(centerX, centerY);
-}
\ No newline at end of file
@@ -0,0 +1,379 @@
+// Local
+#include "FrameGrabber.h"
+
+namespace
+{
+const size_t MIN_RING_SIZE = 2;
+const size_t DEFAULT_RING_SIZE = 4;
+const std::chrono::seconds SHARED_FRAME_TIMEOUT(2); // a producer that publishes nothing for this long has stopped
+} // namespace
+
+FrameGrabber::FrameGrabber()
+    : mSlots(DEFAULT_RING_SIZE), mPolicy(CapturePolicy::LATEST_FRAME), mFile(false), mReadingSlot(DEFAULT_RING_SIZE),
+      mNextSequence(0), mDroppedCount(0), mStarvedCount(0), mStopping(true), mEndOfStream(false)
+{
+}
+
+FrameGrabber::~FrameGrabber()
+{
+    close();
+}
+
+void FrameGrabber::configure(size_t aRingSize, CapturePolicy aPolicy)
+{
+    if (mCaptureThread.joinable() == false)
+    {
+        mSlots.assign(std::max(aRingSize, MIN_RING_SIZE), Slot());
+        mReadingSlot = mSlots.size();
+        mPolicy = aPolicy;
+    }
+}
+
+bool FrameGrabber::open(int aDeviceId)
+{
+    close();
+    mFile = false;
+    mVidCap.open(aDeviceId);
+    return start();
+}
+
+bool FrameGrabber::open(const std::string &aSource)
+{
+    close();
+    mFile = true;
+    mFileSource = aSource;
+    if (mPolicy == CapturePolicy::LATEST_FRAME)
+    {
+        mPolicy = CapturePolicy::EVERY_FRAME;
+    }
+    mVidCap.open(aSource);
+    return start();
+}
+
+bool FrameGrabber::rewind()
+{
+    if (mFile == false)
+    {
+        return false;
+    }
+    const std::string source = mFileSource; // open assigns it again
+    return open(source);
+}
+
+bool FrameGrabber::openShared(const std::string &aName)
+{
+    close();
+    mFile = false;
+    mStopping = false;
+    return mSharedRing.open(aName);
+}
+
+bool FrameGrabber::start()
+{
+    if (mVidCap.isOpened() == false)
+    {
+        return false;
+    }
+
+    // Preallocate every buffer, retrieve() reuses a buffer of the right size
+    const int width = (int)mVidCap.get(CAP_PROP_FRAME_WIDTH);
+    const int height = (int)mVidCap.get(CAP_PROP_FRAME_HEIGHT);
+    for (Slot &slot : mSlots)
+    {
+        if (width > 0 && height > 0)
+        {
+            slot.frame.create(height, width, CV_8UC3);
+        }
+        slot.sequence = 0;
+        slot.state = SlotState::FREE;
+    }
+    mReadingSlot = mSlots.size();
+    mNextSequence = 0;
+    mDroppedCount = 0;
+    mStarvedCount = 0;
+    mDecodeHistogram.clear();
+    mEndOfStream = false;
+    mStopping = false;
+
+    if (mPolicy != CapturePolicy::INLINE)
+    {
+        mCaptureThread = std::thread(&FrameGrabber::captureLoop, this);
+    }
+    return true;
+}
+
+void FrameGrabber::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mSlotCondition.notify_all();
+    mFrameCondition.notify_all();
+
+    if (mCaptureThread.joinable())
+    {
+        mCaptureThread.join();
+    }
+    mVidCap.release();
+    mSharedRing.close();
+}
+
+bool FrameGrabber::acquire(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime)
+{
+    release(); // a frame that was not given back is released now
+
+    if (mSharedRing.isOpen())
+    {
+        return mStopping == false && mSharedRing.acquire(aFrame, aCaptureTime, SHARED_FRAME_TIMEOUT);
+    }
+
+    if (mPolicy == CapturePolicy::INLINE)
+    {
+        Slot &slot = mSlots.front();
+        const std::chrono::steady_clock::time_point decodeStart = std::chrono::steady_clock::now();
+        if (mStopping || mVidCap.grab() == false)
+        {
+            return false;
+        }
+        slot.captureTime = std::chrono::steady_clock::now();
+        mVidCap.retrieve(slot.frame);
+        slot.sequence = mNextSequence++;
+        if (mFile)
+        {
+            mDecodeHistogram.add(std::chrono::steady_clock::now() - decodeStart);
+        }
+
+        aFrame = slot.frame;
+        aCaptureTime = slot.captureTime;
+        return aFrame.empty() == false;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    size_t chosenSlot = mSlots.size();
+    bool waited = false;
+    while (chosenSlot == mSlots.size())
+    {
+        for (size_t i = 0; i < mSlots.size(); i++)
+        {
+            if (mSlots.at(i).state != SlotState::READY)
+            {
+                continue;
+            }
+
+            if (chosenSlot == mSlots.size())
+            {
+                chosenSlot = i;
+            }
+            else if ((mPolicy == CapturePolicy::LATEST_FRAME) == (mSlots.at(i).sequence > mSlots.at(chosenSlot).sequence))
+            {
+                chosenSlot = i; // newest for latest frame, oldest for every frame
+            }
+        }
+
+        if (chosenSlot == mSlots.size())
+        {
+            if (mStopping || mEndOfStream)
+            {
+                return false;
+            }
+            mFrameCondition.wait(lock);
+            waited = true;
+        }
+    }
+    mStarvedCount += waited ? 1 : 0;
+
+    // Latest frame wins, every older ready frame is dropped
+    if (mPolicy == CapturePolicy::LATEST_FRAME)
+    {
+        for (size_t i = 0; i < mSlots.size(); i++)
+        {
+            if (i != chosenSlot && mSlots.at(i).state == SlotState::READY)
+            {
+                mSlots.at(i).state = SlotState::FREE;
+                mDroppedCount++;
+            }
+        }
+    }
+
+    Slot &slot = mSlots.at(chosenSlot);
+    slot.state = SlotState::READING;
+    mReadingSlot = chosenSlot;
+    aFrame = slot.frame;
+    aCaptureTime = slot.captureTime;
+
+    lock.unlock();
+    mSlotCondition.notify_one();
+    return true;
+}
+
+void FrameGrabber::release()
+{
+    if (mSharedRing.isOpen())
+    {
+        mSharedRing.release();
+        return;
+    }
+    if (mPolicy == CapturePolicy::INLINE)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mReadingSlot == mSlots.size())
+        {
+            return;
+        }
+        mSlots.at(mReadingSlot).state = SlotState::FREE;
+        mReadingSlot = mSlots.size();
+    }
+    mSlotCondition.notify_one();
+}
+
+uint64_t FrameGrabber::capturedCount() const
+{
+    if (mSharedRing.isOpen())
+    {
+        return mSharedRing.takenCount();
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mNextSequence;
+}
+
+uint64_t FrameGrabber::droppedCount() const
+{
+    if (mSharedRing.isOpen())
+    {
+        return mSharedRing.skippedCount();
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDroppedCount;
+}
+
+bool FrameGrabber::frameIntact() const
+{
+    return mSharedRing.isOpen() == false || mSharedRing.intact();
+}
+
+bool FrameGrabber::isShared() const
+{
+    return mSharedRing.isOpen();
+}
+
+uint64_t FrameGrabber::tornCount() const
+{
+    return mSharedRing.tornCount();
+}
+
+bool FrameGrabber::isFile() const
+{
+    return mFile;
+}
+
+const LatencyHistogram &FrameGrabber::decodeHistogram() const
+{
+    return mDecodeHistogram;
+}
+
+uint64_t FrameGrabber::starvedCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStarvedCount;
+}
+
+bool FrameGrabber::StringToPolicy(const std::string &aPolicyString, CapturePolicy &aPolicy)
+{
+    bool result = true;
+    if (aPolicyString == "latest")
+    {
+        aPolicy = CapturePolicy::LATEST_FRAME;
+    }
+    else if (aPolicyString == "every")
+    {
+        aPolicy = CapturePolicy::EVERY_FRAME;
+    }
+    else if (aPolicyString == "inline")
+    {
+        aPolicy = CapturePolicy::INLINE;
+    }
+    else
+    {
+        result = false;
+    }
+    return result;
+}
+
+size_t FrameGrabber::claimWriteSlot(std::unique_lock<std::mutex> &aLock)
+{
+    while (mStopping == false)
+    {
+        size_t oldestReadySlot = mSlots.size();
+        for (size_t i = 0; i < mSlots.size(); i++)
+        {
+            if (mSlots.at(i).state == SlotState::FREE)
+            {
+                return i;
+            }
+            if (mSlots.at(i).state == SlotState::READY &&
+                (oldestReadySlot == mSlots.size() || mSlots.at(i).sequence < mSlots.at(oldestReadySlot).sequence))
+            {
+                oldestReadySlot = i;
+            }
+        }
+
+        // Latest frame wins: overwrite the oldest frame nobody has taken yet
+        if (mPolicy == CapturePolicy::LATEST_FRAME && oldestReadySlot != mSlots.size())
+        {
+            mDroppedCount++;
+            return oldestReadySlot;
+        }
+
+        mSlotCondition.wait(aLock);
+    }
+    return mSlots.size();
+}
+
+void FrameGrabber::captureLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        size_t slotIndex = claimWriteSlot(lock);
+        if (slotIndex == mSlots.size())
+        {
+            break;
+        }
+        Slot &slot = mSlots.at(slotIndex);
+        slot.state = SlotState::WRITING;
+
+        // Capture without holding the lock, the slot belongs to this thread now
+        lock.unlock();
+        const std::chrono::steady_clock::time_point decodeStart = std::chrono::steady_clock::now();
+        bool grabbed = mVidCap.grab();
+        std::chrono::steady_clock::time_point captureTime = std::chrono::steady_clock::now();
+        if (grabbed)
+        {
+            mVidCap.retrieve(slot.frame);
+        }
+        if (grabbed && mFile)
+        {
+            // A camera grab waits for the sensor, only a file grab is decode time
+            mDecodeHistogram.add(std::chrono::steady_clock::now() - decodeStart);
+        }
+        lock.lock();
+
+        if (grabbed == false || slot.frame.empty())
+        {
+            slot.state = SlotState::FREE;
+            mEndOfStream = true;
+            break;
+        }
+
+        slot.captureTime = captureTime;
+        slot.sequence = mNextSequence++;
+        slot.state = SlotState::READY;
+        mFrameCondition.notify_one();
+    }
+    mFrameCondition.notify_all();
+}
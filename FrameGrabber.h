@@ -0,0 +1,216 @@
+#ifndef FRAME_GRABBER_H_
+#define FRAME_GRABBER_H_
+
+// Library
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Local
+#include "LatencyHistogram.h"
+#include "SharedFrameRing.h"
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief How the capture thread hands frames to the detector
+ */
+enum class CapturePolicy
+{
+  LATEST_FRAME, // older unprocessed frames are dropped, lowest latency
+  EVERY_FRAME,  // the capture thread waits for a free buffer, no frame is dropped
+  INLINE        // no capture thread, the frame is captured on acquire
+};
+
+/**
+ * @brief Owns the video capture and fills a fixed ring of frame buffers from a capture thread
+ *
+ * The capture is a camera, a video file or a numbered image sequence. A
+ * file is decoded sequentially on the capture thread ahead of the
+ * detector, the ring is its read-ahead queue and no frame is dropped.
+ * A shared memory ring of an external capture process is read without a
+ * capture thread or a copy, the frames are headers on its slots.
+ */
+class FrameGrabber
+{
+public:
+  FrameGrabber();
+  ~FrameGrabber();
+
+  FrameGrabber(const FrameGrabber &) = delete;
+  FrameGrabber &operator=(const FrameGrabber &) = delete;
+
+  /**
+   * @brief Set the ring size and policy, only has effect before open
+   * @param aRingSize The number of frame buffers, at least 2
+   * @param aPolicy The capture policy
+   */
+  void configure(size_t aRingSize, CapturePolicy aPolicy);
+
+  /**
+   * @brief Open a camera and start capturing
+   * @param aDeviceId The id of the camera
+   * @return whether the camera was opened
+   */
+  bool open(int aDeviceId);
+
+  /**
+   * @brief Open a video file or image sequence and start decoding it ahead of the detector
+   *
+   * The latest frame policy becomes every frame: a file is not real time,
+   * every frame is detected and the decoder waits for a free buffer.
+   *
+   * @param aSource A video file, or an image sequence as a printf pattern (frames/%04d.png)
+   * @return whether the file was opened
+   */
+  bool open(const std::string &aSource);
+
+  /**
+   * @brief Open the video file or image sequence again, its next frame is the first one
+   * @return false when the capture is not a file or it could not be opened
+   */
+  bool rewind();
+
+  /**
+   * @brief Read the frames of an external capture process from a shared memory ring, see SharedFrameRing
+   * @param aName The name of the shared memory object, such as /shapedetector
+   * @return whether the ring was opened
+   */
+  bool openShared(const std::string &aName);
+
+  /**
+   * @brief Stop capturing and close the camera
+   */
+  void close();
+
+  /**
+   * @brief Take the next frame according to the policy, blocks until one is available
+   * @param aFrame Header of the frame buffer, valid until release
+   * @param aCaptureTime The time the frame was grabbed
+   * @return whether a frame was taken
+   */
+  bool acquire(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime);
+
+  /**
+   * @brief Give the acquired frame buffer back to the capture thread
+   */
+  void release();
+
+  /**
+   * @brief Get the number of captured frames
+   */
+  uint64_t capturedCount() const;
+
+  /**
+   * @brief Get the number of frames that were dropped before processing
+   */
+  uint64_t droppedCount() const;
+
+  /**
+   * @brief Get whether the acquired frame is still intact, a shared frame can be overwritten by a fast producer
+   */
+  bool frameIntact() const;
+
+  /**
+   * @brief Get whether the frames come from a shared memory ring
+   */
+  bool isShared() const;
+
+  /**
+   * @brief Get the number of shared frames that were overwritten while they were detected
+   */
+  uint64_t tornCount() const;
+
+  /**
+   * @brief Get whether the capture is a video file or image sequence
+   */
+  bool isFile() const;
+
+  /**
+   * @brief Get the time to decode every frame of a file, empty for a camera
+   */
+  const LatencyHistogram &decodeHistogram() const;
+
+  /**
+   * @brief Get the number of frames the detector had to wait for because the read-ahead queue was empty
+   */
+  uint64_t starvedCount() const;
+
+  /**
+   * @brief Parse a policy name (latest, every or inline)
+   * @param aPolicyString The name of the policy
+   * @param aPolicy The parsed policy
+   * @return whether the name is valid
+   */
+  static bool StringToPolicy(const std::string &aPolicyString, CapturePolicy &aPolicy);
+
+private:
+  /**
+   * @brief State of a frame buffer in the ring
+   */
+  enum class SlotState
+  {
+    FREE,
+    WRITING,
+    READY,
+    READING
+  };
+
+  /**
+   * @brief A preallocated frame buffer
+   */
+  struct Slot
+  {
+    Mat frame;
+    std::chrono::steady_clock::time_point captureTime;
+    uint64_t sequence;
+    SlotState state;
+  };
+
+  /**
+   * @brief Preallocate the ring and start the capture thread on the opened capture
+   * @return whether the capture is opened
+   */
+  bool start();
+
+  /**
+   * @brief The loop of the capture thread
+   */
+  void captureLoop();
+
+  /**
+   * @brief Find a slot for the capture thread, drops the oldest ready frame if needed
+   * @param aLock The held ring lock
+   * @return size_t The slot, or the ring size when stopping
+   */
+  size_t claimWriteSlot(std::unique_lock<std::mutex> &aLock);
+
+  VideoCapture mVidCap;
+  std::vector<Slot> mSlots;
+  CapturePolicy mPolicy;
+  bool mFile; // a video file or image sequence, not a camera
+  std::string mFileSource; // the path of that file, to rewind it
+  SharedFrameRing mSharedRing; // open when the frames come from another process
+  LatencyHistogram mDecodeHistogram;
+
+  std::thread mCaptureThread;
+  mutable std::mutex mMutex;
+  std::condition_variable mFrameCondition; // a frame became ready
+  std::condition_variable mSlotCondition;  // a slot became free
+
+  size_t mReadingSlot;
+  uint64_t mNextSequence;
+  uint64_t mDroppedCount;
+  uint64_t mStarvedCount;
+  bool mStopping;
+  bool mEndOfStream; // the capture returned no more frames
+};
+
+#endif
@@ -0,0 +1,139 @@
+// Library
+#include <chrono>
+
+// Local
+#include "FramePipeline.h"
+
+namespace
+{
+const size_t STAGE_COUNT = 4; // color, noise, contours, classify
+const unsigned int SPIN_COUNT = 64;
+const unsigned int YIELD_COUNT = 64;
+const std::chrono::microseconds IDLE_SLEEP(100);
+} // namespace
+
+FramePipeline::FramePipeline(const Shapedetector &aDetector, size_t aDepth)
+    : mDetector(aDetector), mStopping(false), mInFlightCount(0)
+{
+    const size_t depth = (aDepth > 0) ? aDepth : 1;
+
+    for (size_t i = 0; i < depth; i++)
+    {
+        mContexts.push_back(std::unique_ptr<FrameContext>(new FrameContext()));
+        mFreeContexts.push_back(mContexts.back().get());
+    }
+
+    // Every queue can hold all contexts, so a push never fails
+    for (size_t i = 0; i < STAGE_COUNT + 1; i++)
+    {
+        mQueues.push_back(std::unique_ptr<SpscQueue<FrameContext *>>(new SpscQueue<FrameContext *>(depth)));
+    }
+    for (size_t i = 0; i < STAGE_COUNT; i++)
+    {
+        mThreads.push_back(std::thread(&FramePipeline::stageLoop, this, i));
+    }
+}
+
+FramePipeline::~FramePipeline()
+{
+    mStopping = true;
+    for (std::thread &thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+FrameContext *FramePipeline::freeContext()
+{
+    FrameContext *result = nullptr;
+    if (mFreeContexts.empty() == false)
+    {
+        result = mFreeContexts.back();
+        mFreeContexts.pop_back();
+    }
+    return result;
+}
+
+void FramePipeline::push(FrameContext *aContext)
+{
+    mInFlightCount++;
+    mQueues.front()->push(aContext);
+}
+
+FrameContext *FramePipeline::waitFinished()
+{
+    FrameContext *result = nullptr;
+    if (mInFlightCount > 0 && waitPop(*mQueues.back(), result))
+    {
+        mInFlightCount--;
+    }
+    return result;
+}
+
+void FramePipeline::recycle(FrameContext *aContext)
+{
+    mFreeContexts.push_back(aContext);
+}
+
+size_t FramePipeline::inFlightCount() const
+{
+    return mInFlightCount;
+}
+
+void FramePipeline::stageLoop(size_t aStage)
+{
+    FrameContext *context = nullptr;
+    while (waitPop(*mQueues.at(aStage), context))
+    {
+        runStage(aStage, *context);
+        mQueues.at(aStage + 1)->push(context);
+    }
+}
+
+void FramePipeline::runStage(size_t aStage, FrameContext &aContext) const
+{
+    switch (aStage)
+    {
+        case 0:
+            mDetector.filterColors(aContext);
+            break;
+        case 1:
+            mDetector.filterNoise(aContext);
+            break;
+        case 2:
+            mDetector.findShapeContours(aContext);
+            break;
+        default:
+            mDetector.classifyShapes(aContext);
+            mDetector.drawShapes(aContext);
+            break;
+    }
+}
+
+bool FramePipeline::waitPop(SpscQueue<FrameContext *> &aQueue, FrameContext *&aContext) const
+{
+    unsigned int attempt = 0;
+    while (aQueue.pop(aContext) == false)
+    {
+        if (mStopping)
+        {
+            return false;
+        }
+
+        // Spin shortly for a low hand-over latency, then stop burning the core
+        if (attempt < SPIN_COUNT)
+        {
+            attempt++;
+        }
+        else if (attempt < SPIN_COUNT + YIELD_COUNT)
+        {
+            attempt++;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(IDLE_SLEEP);
+        }
+    }
+    return true;
+}
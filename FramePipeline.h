@@ -0,0 +1,93 @@
+#ifndef FRAME_PIPELINE_H_
+#define FRAME_PIPELINE_H_
+
+// Library
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Local
+#include "Shapedetector.h"
+#include "SpscQueue.h"
+
+/**
+ * @brief Runs the detection stages of consecutive frames on separate threads
+ *
+ * Stage threads are connected by lock-free single producer, single consumer
+ * queues, so color filtering of frame N+1 overlaps the classification of
+ * frame N. The throughput is bound by the slowest stage. The depth is the
+ * number of frame contexts in flight: a deeper pipeline keeps every stage busy
+ * but adds up to one frame of latency per extra context.
+ */
+class FramePipeline
+{
+public:
+  /**
+   * @brief Start the stage threads
+   * @param aDetector The detector whose stages are run, must outlive the pipeline
+   * @param aDepth The number of frame contexts, at least 1
+   */
+  FramePipeline(const Shapedetector &aDetector, size_t aDepth);
+  ~FramePipeline();
+
+  FramePipeline(const FramePipeline &) = delete;
+  FramePipeline &operator=(const FramePipeline &) = delete;
+
+  /**
+   * @brief Get a context that is not in flight, only called by the feeding thread
+   * @return FrameContext* The context, nullptr when every context is in flight
+   */
+  FrameContext *freeContext();
+
+  /**
+   * @brief Send a reset context into the first stage
+   * @param aContext A context from freeContext
+   */
+  void push(FrameContext *aContext);
+
+  /**
+   * @brief Wait for the oldest frame that went through every stage
+   * @return FrameContext* The finished context, nullptr when nothing is in flight
+   */
+  FrameContext *waitFinished();
+
+  /**
+   * @brief Give a context back so it can be fed again
+   * @param aContext A context from freeContext or waitFinished
+   */
+  void recycle(FrameContext *aContext);
+
+  /**
+   * @brief Get the number of contexts that are pushed but not finished yet
+   */
+  size_t inFlightCount() const;
+
+private:
+  /**
+   * @brief The loop of one stage thread
+   * @param aStage The index of the stage
+   */
+  void stageLoop(size_t aStage);
+
+  /**
+   * @brief Run one stage on a context
+   */
+  void runStage(size_t aStage, FrameContext &aContext) const;
+
+  /**
+   * @brief Take from a queue, backs off from spinning to sleeping while it is empty
+   * @return false when the pipeline is stopping
+   */
+  bool waitPop(SpscQueue<FrameContext *> &aQueue, FrameContext *&aContext) const;
+
+  const Shapedetector &mDetector;
+  std::vector<std::unique_ptr<FrameContext>> mContexts;
+  std::vector<FrameContext *> mFreeContexts; // only used by the feeding thread
+  std::vector<std::unique_ptr<SpscQueue<FrameContext *>>> mQueues; // in front of every stage, plus the output
+  std::vector<std::thread> mThreads;
+  std::atomic<bool> mStopping;
+  size_t mInFlightCount;
+};
+
+#endif
@@ -0,0 +1,159 @@
+// Library
+#include <algorithm>
+#include <iomanip>
+
+// Local
+#include "LatencyHistogram.h"
+
+namespace
+{
+const unsigned int SUB_BUCKET_BITS = 3; // 8 linear buckets per power of two
+const uint64_t SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+const size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+const size_t HISTOGRAM_BAR_WIDTH = 40;
+} // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : mBuckets(BUCKET_COUNT), mCount(0), mSum(0), mMax(0)
+{
+    clear();
+}
+
+void LatencyHistogram::add(std::chrono::steady_clock::duration aLatency)
+{
+    long long microseconds = std::chrono::duration_cast<std::chrono::microseconds>(aLatency).count();
+    addMicroseconds((uint64_t)std::max(0LL, microseconds));
+}
+
+void LatencyHistogram::addMicroseconds(uint64_t aMicroseconds)
+{
+    // The counters are independent, a relaxed order is enough
+    mBuckets.at(bucketIndex(aMicroseconds)).fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(aMicroseconds, std::memory_order_relaxed);
+    uint64_t previousMax = mMax.load(std::memory_order_relaxed);
+    while (aMicroseconds > previousMax && !mMax.compare_exchange_weak(previousMax, aMicroseconds, std::memory_order_relaxed))
+    {
+    }
+    mCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::clear()
+{
+    for (std::atomic<uint64_t> &bucket : mBuckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return mCount.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::percentile(double aFraction) const
+{
+    const uint64_t count = this->count();
+    if (count == 0)
+    {
+        return 0.0;
+    }
+
+    // Latencies added while counting only move the result up to the maximum
+    uint64_t rank = (uint64_t)(aFraction * (double)count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        seen += mBuckets.at(i).load(std::memory_order_relaxed);
+        if (seen > rank)
+        {
+            return (double)std::min(bucketUpperBound(i), mMax.load(std::memory_order_relaxed)) / 1000.0;
+        }
+    }
+    return max();
+}
+
+double LatencyHistogram::mean() const
+{
+    const uint64_t count = this->count();
+    return (count == 0) ? 0.0 : ((double)mSum.load(std::memory_order_relaxed) / (double)count) / 1000.0;
+}
+
+double LatencyHistogram::max() const
+{
+    return (double)mMax.load(std::memory_order_relaxed) / 1000.0;
+}
+
+void LatencyHistogram::printSummary(std::ostream &aStream, const std::string &aName) const
+{
+    aStream << std::fixed << std::setprecision(2);
+    aStream << aName << ": n = " << count() << "\tmean = " << mean() << " ms\tp50 = " << percentile(0.50)
+            << " ms\tp95 = " << percentile(0.95) << " ms\tp99 = " << percentile(0.99) << " ms\tmax = " << max() << " ms" << std::endl;
+}
+
+void LatencyHistogram::print(std::ostream &aStream, const std::string &aName) const
+{
+    printSummary(aStream, aName);
+    if (count() == 0)
+    {
+        return;
+    }
+
+    // Merge the buckets per power of two milliseconds
+    std::vector<uint64_t> rangeCounts;
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        uint64_t milliseconds = bucketUpperBound(i) / 1000;
+        size_t range = 0;
+        while (milliseconds > 0)
+        {
+            milliseconds >>= 1;
+            range++;
+        }
+        const uint64_t bucketCount = mBuckets.at(i).load(std::memory_order_relaxed);
+        if (bucketCount > 0)
+        {
+            rangeCounts.resize(std::max(rangeCounts.size(), range + 1), 0);
+            rangeCounts.at(range) += bucketCount;
+        }
+    }
+
+    uint64_t largestCount = *std::max_element(rangeCounts.begin(), rangeCounts.end());
+    for (size_t range = 0; range < rangeCounts.size(); range++)
+    {
+        uint64_t upperMilliseconds = (uint64_t)1 << range;
+        size_t barLength = (size_t)(rangeCounts.at(range) * HISTOGRAM_BAR_WIDTH / largestCount);
+        aStream << "\t< " << std::setw(6) << upperMilliseconds << " ms\t" << std::setw(8) << rangeCounts.at(range) << " "
+                << std::string(barLength, '#') << std::endl;
+    }
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t aMicroseconds)
+{
+    if (aMicroseconds < SUB_BUCKET_COUNT)
+    {
+        return (size_t)aMicroseconds;
+    }
+
+    unsigned int exponent = 0;
+    while ((aMicroseconds >> exponent) >= 2 * SUB_BUCKET_COUNT)
+    {
+        exponent++;
+    }
+    // aMicroseconds >> exponent lies in [SUB_BUCKET_COUNT, 2 * SUB_BUCKET_COUNT)
+    return (size_t)((exponent + 1) * SUB_BUCKET_COUNT + ((aMicroseconds >> exponent) - SUB_BUCKET_COUNT));
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t aBucket)
+{
+    if (aBucket < SUB_BUCKET_COUNT)
+    {
+        return (uint64_t)aBucket;
+    }
+
+    unsigned int exponent = (unsigned int)(aBucket / SUB_BUCKET_COUNT) - 1;
+    uint64_t subBucket = (uint64_t)(aBucket % SUB_BUCKET_COUNT) + SUB_BUCKET_COUNT;
+    return ((subBucket + 1) << exponent) - 1;
+}
@@ -0,0 +1,98 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+// Library
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Histogram of latencies with a bounded relative error
+ *
+ * Every power of two microseconds is split into a fixed number of linear
+ * sub-buckets, so percentiles are accurate to 1/8th of their value. Latencies
+ * are added without locks from any number of threads, a reader sees every
+ * latency that was added before it started.
+ */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  /**
+   * @brief Add a latency
+   * @param aLatency The latency to add
+   */
+  void add(std::chrono::steady_clock::duration aLatency);
+
+  /**
+   * @brief Add a latency in microseconds
+   * @param aMicroseconds The latency to add
+   */
+  void addMicroseconds(uint64_t aMicroseconds);
+
+  /**
+   * @brief Remove all latencies, not while latencies are added
+   */
+  void clear();
+
+  /**
+   * @brief Get the number of added latencies
+   */
+  uint64_t count() const;
+
+  /**
+   * @brief Get the latency below which a fraction of the latencies lie
+   * @param aFraction The fraction, 0.5 for the median
+   * @return double The latency in milliseconds
+   */
+  double percentile(double aFraction) const;
+
+  /**
+   * @brief Get the mean latency in milliseconds
+   */
+  double mean() const;
+
+  /**
+   * @brief Get the highest latency in milliseconds
+   */
+  double max() const;
+
+  /**
+   * @brief Print the count, mean, percentiles and maximum on one line
+   * @param aStream The stream to print to
+   * @param aName The name of the measured latency
+   */
+  void printSummary(std::ostream &aStream, const std::string &aName) const;
+
+  /**
+   * @brief Print the percentiles and a histogram per power of two milliseconds
+   * @param aStream The stream to print to
+   * @param aName The name of the measured latency
+   */
+  void print(std::ostream &aStream, const std::string &aName) const;
+
+private:
+  /**
+   * @brief Get the bucket of a latency
+   */
+  static size_t bucketIndex(uint64_t aMicroseconds);
+
+  /**
+   * @brief Get the highest latency that falls in a bucket
+   */
+  static uint64_t bucketUpperBound(size_t aBucket);
+
+  std::vector<std::atomic<uint64_t>> mBuckets;
+  std::atomic<uint64_t> mCount;
+  std::atomic<uint64_t> mSum; // microseconds
+  std::atomic<uint64_t> mMax; // microseconds
+};
+
+#endif
@@ -0,0 +1,119 @@
+// Library
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Local
+#include "ParameterWatcher.h"
+
+namespace
+{
+const size_t EVENT_BUFFER_SIZE = 4096;
+} // namespace
+
+ParameterWatcher::ParameterWatcher() : mInotifyDescriptor(-1), mStopDescriptor(-1)
+{
+}
+
+ParameterWatcher::~ParameterWatcher()
+{
+    stop();
+}
+
+bool ParameterWatcher::start(const std::string &aPath, std::function<void()> aOnChange)
+{
+    stop();
+
+    const size_t separator = aPath.find_last_of('/');
+    const std::string directory = (separator == std::string::npos) ? "." : aPath.substr(0, std::max<size_t>(separator, 1));
+    mFileName = (separator == std::string::npos) ? aPath : aPath.substr(separator + 1);
+    if (mFileName.empty())
+    {
+        return false;
+    }
+
+    mInotifyDescriptor = inotify_init1(IN_CLOEXEC);
+    mStopDescriptor = eventfd(0, EFD_CLOEXEC);
+    if (mInotifyDescriptor < 0 || mStopDescriptor < 0 ||
+        inotify_add_watch(mInotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        stop();
+        return false;
+    }
+
+    mOnChange = aOnChange;
+    mWatcherThread = std::thread(&ParameterWatcher::watchLoop, this);
+    return true;
+}
+
+void ParameterWatcher::stop()
+{
+    if (mWatcherThread.joinable())
+    {
+        // Adding to the eventfd wakes the poll of the thread, it only fails when the counter overflows
+        const uint64_t wake = 1;
+        const ssize_t written = write(mStopDescriptor, &wake, sizeof(wake));
+        (void)written;
+        mWatcherThread.join();
+    }
+    if (mInotifyDescriptor >= 0)
+    {
+        close(mInotifyDescriptor);
+    }
+    if (mStopDescriptor >= 0)
+    {
+        close(mStopDescriptor);
+    }
+    mInotifyDescriptor = -1;
+    mStopDescriptor = -1;
+}
+
+bool ParameterWatcher::running() const
+{
+    return mWatcherThread.joinable();
+}
+
+void ParameterWatcher::watchLoop()
+{
+    alignas(inotify_event) char buffer[EVENT_BUFFER_SIZE];
+    pollfd descriptors[2] = {{mInotifyDescriptor, POLLIN, 0}, {mStopDescriptor, POLLIN, 0}};
+    while (true)
+    {
+        if (poll(descriptors, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (descriptors[1].revents != 0)
+        {
+            break;
+        }
+
+        const ssize_t length = read(mInotifyDescriptor, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            continue;
+        }
+
+        // A save can write the file several times, one call covers every event that was read together
+        bool changed = false;
+        for (const char *position = buffer; position < buffer + length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(position);
+            changed = changed || (event->len > 0 && mFileName == event->name);
+            position += sizeof(inotify_event) + event->len;
+        }
+        if (changed)
+        {
+            mOnChange();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PARAMETER_WATCHER_H_
+#define PARAMETER_WATCHER_H_
+
+// Library
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Calls a function on its own thread whenever a file is written
+ *
+ * The directory of the file is watched with inotify, so a file that is
+ * replaced by a rename (as most editors save) is seen as well. The
+ * function runs on the watcher thread, it must not touch what the frame
+ * loop uses without synchronization.
+ */
+class ParameterWatcher
+{
+public:
+  ParameterWatcher();
+  ~ParameterWatcher();
+
+  ParameterWatcher(const ParameterWatcher &) = delete;
+  ParameterWatcher &operator=(const ParameterWatcher &) = delete;
+
+  /**
+   * @brief Start watching a file
+   * @param aPath The file to watch, its directory must exist
+   * @param aOnChange Called on the watcher thread after the file was written or moved in place
+   * @return whether the watch was set
+   */
+  bool start(const std::string &aPath, std::function<void()> aOnChange);
+
+  /**
+   * @brief Stop the watcher thread, a running call of the function is finished first
+   */
+  void stop();
+
+  /**
+   * @brief Get whether the file is watched
+   */
+  bool running() const;
+
+private:
+  /**
+   * @brief The loop of the watcher thread
+   */
+  void watchLoop();
+
+  std::string mFileName; // the name of the file in its directory
+  std::function<void()> mOnChange;
+  int mInotifyDescriptor; // -1 when stopped
+  int mStopDescriptor;    // an eventfd that wakes the thread to stop
+  std::thread mWatcherThread;
+};
+
+#endif
@@ -0,0 +1,171 @@
+// Library
+#include <algorithm>
+#include <cstring>
+
+// Local
+#include "ColorKernel.h"
+#include "RectMorphology.h"
+
+// The vector paths are compiled with per-function target attributes and
+// selected at runtime with the processor check of the color kernel
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RECT_MORPHOLOGY_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define RECT_MORPHOLOGY_X86_DISPATCH 0
+#endif
+
+namespace
+{
+const int STRIP_WIDTH = 256; // the columns of one strip, its running extremes stay in cache
+
+#if RECT_MORPHOLOGY_X86_DISPATCH
+__attribute__((target("sse2"))) int sse2CombineRows(const uchar *aFirst, const uchar *aSecond, uchar *aResult, int aWidth, bool aMinimum)
+{
+    int x = 0;
+    for (; x + 16 <= aWidth; x += 16)
+    {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(aFirst + x));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(aSecond + x));
+        const __m128i result = aMinimum ? _mm_min_epu8(first, second) : _mm_max_epu8(first, second);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(aResult + x), result);
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) int avx2CombineRows(const uchar *aFirst, const uchar *aSecond, uchar *aResult, int aWidth, bool aMinimum)
+{
+    int x = 0;
+    for (; x + 32 <= aWidth; x += 32)
+    {
+        const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(aFirst + x));
+        const __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(aSecond + x));
+        const __m256i result = aMinimum ? _mm256_min_epu8(first, second) : _mm256_max_epu8(first, second);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(aResult + x), result);
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Take the minimum or maximum of two rows, pixel by pixel
+ */
+void combineRows(const uchar *aFirst, const uchar *aSecond, uchar *aResult, int aWidth, bool aMinimum, KernelPath aPath)
+{
+    int x = 0;
+#if RECT_MORPHOLOGY_X86_DISPATCH
+    if (aPath == KernelPath::AVX2)
+    {
+        x = avx2CombineRows(aFirst, aSecond, aResult, aWidth, aMinimum);
+    }
+    else if (aPath == KernelPath::SSSE3)
+    {
+        x = sse2CombineRows(aFirst, aSecond, aResult, aWidth, aMinimum);
+    }
+#else
+    (void)aPath;
+#endif
+
+    for (; x < aWidth; x++)
+    {
+        aResult[x] = aMinimum ? std::min(aFirst[x], aSecond[x]) : std::max(aFirst[x], aSecond[x]);
+    }
+}
+} // namespace
+
+RectMorphology::RectMorphology()
+{
+}
+
+void RectMorphology::open(const Mat &aSource, Mat &aDestination, Size aKernelSize)
+{
+    CV_Assert(aSource.type() == CV_8U && aKernelSize.width > 0 && aKernelSize.height > 0);
+    if (aKernelSize.width == 1 && aKernelSize.height == 1)
+    {
+        filterColumns(aSource, aDestination, 1, true); // a single pixel kernel changes nothing
+        return;
+    }
+
+    // An erosion of the columns and the rows, then a dilation of the rows and the columns
+    Mat columns = bufferHeader(mColumnBuffer, aSource.rows, aSource.cols);
+    filterColumns(aSource, columns, aKernelSize.height, true);
+    if (aKernelSize.width > 1)
+    {
+        // The rows are filtered as the columns of the transposed mask, it stays transposed in between
+        Mat transposed = bufferHeader(mTransposedBuffer, aSource.cols, aSource.rows);
+        transpose(columns, transposed);
+        filterColumns(transposed, transposed, aKernelSize.width, true);
+        filterColumns(transposed, transposed, aKernelSize.width, false);
+        transpose(transposed, columns);
+    }
+    filterColumns(columns, aDestination, aKernelSize.height, false);
+}
+
+void RectMorphology::filterColumns(const Mat &aSource, Mat &aDestination, int aWindow, bool aErode)
+{
+    aDestination.create(aSource.rows, aSource.cols, CV_8U);
+    if (aWindow == 1)
+    {
+        if (aSource.data != aDestination.data)
+        {
+            aSource.copyTo(aDestination);
+        }
+        return;
+    }
+
+    // The rows outside the mask are neutral, as the default border of erode and dilate
+    const KernelPath path = bestKernelPath();
+    const int anchor = aWindow / 2;
+    const int length = aSource.rows + aWindow - 1;
+    const size_t bufferSize = (size_t)length * (size_t)STRIP_WIDTH;
+    if (mForward.size() < bufferSize)
+    {
+        mForward.resize(bufferSize);
+        mBackward.resize(bufferSize);
+    }
+    mBorder.assign((size_t)STRIP_WIDTH, aErode ? 255 : 0);
+
+    for (int x = 0; x < aSource.cols; x += STRIP_WIDTH)
+    {
+        const int width = std::min(STRIP_WIDTH, aSource.cols - x);
+        auto paddedRow = [&](int aRow) -> const uchar * {
+            const int y = aRow - anchor;
+            return (y >= 0 && y < aSource.rows) ? aSource.ptr<uchar>(y) + x : mBorder.data();
+        };
+        auto forwardRow = [&](int aRow) -> uchar * { return mForward.data() + (size_t)aRow * (size_t)width; };
+        auto backwardRow = [&](int aRow) -> uchar * { return mBackward.data() + (size_t)aRow * (size_t)width; };
+
+        // The running extremes from the start and the end of every block of aWindow padded rows
+        for (int start = 0; start < length; start += aWindow)
+        {
+            const int end = std::min(start + aWindow, length);
+            memcpy(forwardRow(start), paddedRow(start), (size_t)width);
+            for (int i = start + 1; i < end; i++)
+            {
+                combineRows(forwardRow(i - 1), paddedRow(i), forwardRow(i), width, aErode, path);
+            }
+            memcpy(backwardRow(end - 1), paddedRow(end - 1), (size_t)width);
+            for (int i = end - 2; i >= start; i--)
+            {
+                combineRows(backwardRow(i + 1), paddedRow(i), backwardRow(i), width, aErode, path);
+            }
+        }
+
+        // A window starts in one block and ends in the next: the backward extreme at its start
+        // and the forward extreme at its end cover it. The strip is read completely before this
+        for (int y = 0; y < aSource.rows; y++)
+        {
+            combineRows(backwardRow(y), forwardRow(y + aWindow - 1), aDestination.ptr<uchar>(y) + x, width, aErode, path);
+        }
+    }
+}
+
+Mat RectMorphology::bufferHeader(Mat &aBuffer, int aRows, int aCols)
+{
+    const size_t size = (size_t)aRows * (size_t)aCols;
+    if (aBuffer.total() < size)
+    {
+        aBuffer.create(1, (int)size, CV_8U);
+    }
+    return Mat(aRows, aCols, CV_8U, aBuffer.data);
+}
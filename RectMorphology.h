@@ -0,0 +1,57 @@
+#ifndef RECT_MORPHOLOGY_H_
+#define RECT_MORPHOLOGY_H_
+
+// Library
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief Opens 8-bit masks with rectangular kernels in a constant time per pixel
+ *
+ * A rectangle is separable, so the columns are filtered first and the rows
+ * after, as the columns of the transposed mask. Every pass uses the van
+ * Herk/Gil-Werman running minimum or maximum: three comparisons per pixel,
+ * whatever the kernel size, on whole rows at a time. The result equals
+ * morphologyEx with MORPH_OPEN and a MORPH_RECT structuring element, its
+ * anchor in the middle, on a mask without a parent. The storage is kept
+ * between calls.
+ */
+class RectMorphology
+{
+public:
+  RectMorphology();
+
+  /**
+   * @brief Open a mask, an erosion followed by a dilation
+   * @param aSource The 8-bit mask
+   * @param aDestination The opened mask, can be aSource
+   * @param aKernelSize The size of the rectangle
+   */
+  void open(const Mat &aSource, Mat &aDestination, Size aKernelSize);
+
+private:
+  /**
+   * @brief Erode or dilate the columns of a mask, in strips that stay in cache
+   * @param aSource The 8-bit mask
+   * @param aDestination The filtered mask, can be aSource
+   * @param aWindow The height of the kernel
+   * @param aErode true for the running minimum, false for the maximum
+   */
+  void filterColumns(const Mat &aSource, Mat &aDestination, int aWindow, bool aErode);
+
+  /**
+   * @brief Get a continuous header on the front of a buffer that only grows
+   */
+  static Mat bufferHeader(Mat &aBuffer, int aRows, int aCols);
+
+  std::vector<uchar> mForward;  // running extreme from the start of every block of rows
+  std::vector<uchar> mBackward; // running extreme from the end of every block of rows
+  std::vector<uchar> mBorder;   // the rows outside the mask
+  Mat mColumnBuffer;            // the mask after a column pass
+  Mat mTransposedBuffer;        // the transposed mask during the row passes
+};
+
+#endif
@@ -0,0 +1,126 @@
+// Local
+#include "RegionTracker.h"
+
+RegionTracker::RegionTracker()
+    : mKeyframeInterval(0),
+      mPadding(0),
+      mFramesSinceKeyframe(0),
+      mKeyframeNeeded(true),
+      mKeyframeShapeCount(0),
+      mProcessedFractionSum(0.0),
+      mFrameCount(0),
+      mKeyframeCount(0)
+{
+}
+
+void RegionTracker::configure(size_t aKeyframeInterval, int aPadding)
+{
+    mKeyframeInterval = aKeyframeInterval;
+    mPadding = aPadding;
+    mKeyframeNeeded = true;
+}
+
+bool RegionTracker::enabled() const
+{
+    return mKeyframeInterval > 1;
+}
+
+void RegionTracker::nextRegions(Size aFrameSize, std::vector<Rect> &aRegions)
+{
+    aRegions.clear();
+
+    mFramesSinceKeyframe++;
+    if (enabled() == false || mKeyframeNeeded || mFramesSinceKeyframe >= mKeyframeInterval || mShapeBoxes.empty())
+    {
+        mFramesSinceKeyframe = 0;
+        mKeyframeNeeded = false;
+        return;
+    }
+
+    // Pad the shapes of the previous frame, regions that overlap are merged so no pixel is processed twice
+    const Rect frame(0, 0, aFrameSize.width, aFrameSize.height);
+    for (const Rect &shapeBox : mShapeBoxes)
+    {
+        mergeRegion(aRegions, Rect(shapeBox.x - mPadding, shapeBox.y - mPadding, shapeBox.width + 2 * mPadding, shapeBox.height + 2 * mPadding) & frame);
+    }
+}
+
+void RegionTracker::update(bool aKeyframe, const std::vector<Rect> &aRegions, const std::vector<Rect> &aShapeBoxes, double aProcessedFraction)
+{
+    mFrameCount++;
+    mProcessedFractionSum += aProcessedFraction;
+
+    if (aKeyframe)
+    {
+        mKeyframeCount++;
+        mKeyframeShapeCount = aShapeBoxes.size();
+    }
+    else
+    {
+        // A shape appeared or disappeared, or moved out of the part that was looked at
+        mKeyframeNeeded = mKeyframeNeeded || (aShapeBoxes.size() != mKeyframeShapeCount);
+        for (const Rect &shapeBox : aShapeBoxes)
+        {
+            bool inside = false;
+            for (const Rect &region : aRegions)
+            {
+                inside = inside || (shapeBox.x > region.x && shapeBox.y > region.y &&
+                                    shapeBox.x + shapeBox.width < region.x + region.width &&
+                                    shapeBox.y + shapeBox.height < region.y + region.height);
+            }
+            mKeyframeNeeded = mKeyframeNeeded || (inside == false);
+        }
+    }
+    mShapeBoxes = aShapeBoxes;
+}
+
+double RegionTracker::processedFraction() const
+{
+    return (mFrameCount > 0) ? mProcessedFractionSum / (double)mFrameCount : 1.0;
+}
+
+uint64_t RegionTracker::frameCount() const
+{
+    return mFrameCount;
+}
+
+uint64_t RegionTracker::keyframeCount() const
+{
+    return mKeyframeCount;
+}
+
+uint64_t RegionTracker::regionPixels(const std::vector<Rect> &aRegions)
+{
+    uint64_t result = 0;
+    for (const Rect &region : aRegions)
+    {
+        result += (uint64_t)region.area();
+    }
+    return result;
+}
+
+void RegionTracker::mergeRegion(std::vector<Rect> &aRegions, Rect aRegion)
+{
+    if (aRegion.area() <= 0)
+    {
+        return;
+    }
+
+    // The merged region can overlap regions the original did not, so repeat until it overlaps none
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < aRegions.size(); i++)
+        {
+            if ((aRegions.at(i) & aRegion).area() > 0)
+            {
+                aRegion |= aRegions.at(i);
+                aRegions.erase(aRegions.begin() + (long)i);
+                merged = true;
+                break;
+            }
+        }
+    }
+    aRegions.push_back(aRegion);
+}
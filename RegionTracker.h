@@ -0,0 +1,93 @@
+#ifndef REGION_TRACKER_H_
+#define REGION_TRACKER_H_
+
+// Library
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief Chooses the regions of a live frame that are processed, between full keyframes
+ *
+ * A keyframe processes the full frame. The frames after it only process the
+ * padded bounding boxes of the shapes found in the previous frame, until the
+ * interval is over, the number of shapes changes or a shape reaches the
+ * edge of its region.
+ */
+class RegionTracker
+{
+public:
+  RegionTracker();
+
+  /**
+   * @brief Set how often the full frame is processed
+   * @param aKeyframeInterval The number of frames from one keyframe to the next, 0 or 1 processes every full frame
+   * @param aPadding The number of pixels around every shape that is processed
+   */
+  void configure(size_t aKeyframeInterval, int aPadding);
+
+  /**
+   * @brief Get whether frames between keyframes are tracked
+   */
+  bool enabled() const;
+
+  /**
+   * @brief Choose the regions of the next frame
+   * @param aFrameSize The size of the frame
+   * @param aRegions The disjoint regions to process, empty for a keyframe
+   */
+  void nextRegions(Size aFrameSize, std::vector<Rect> &aRegions);
+
+  /**
+   * @brief Take the shapes found in a frame, in the order the frames were chosen
+   * @param aKeyframe Whether the frame was searched completely
+   * @param aRegions The regions a tracked frame was processed with
+   * @param aShapeBoxes The bounding boxes of the shapes found
+   * @param aProcessedFraction The fraction of the pixels of the frame that was processed
+   */
+  void update(bool aKeyframe, const std::vector<Rect> &aRegions, const std::vector<Rect> &aShapeBoxes, double aProcessedFraction);
+
+  /**
+   * @brief Get the fraction of the pixels of all updated frames that was processed
+   */
+  double processedFraction() const;
+
+  /**
+   * @brief Get the number of updated frames
+   */
+  uint64_t frameCount() const;
+
+  /**
+   * @brief Get the number of updated keyframes
+   */
+  uint64_t keyframeCount() const;
+
+  /**
+   * @brief Get the number of pixels in some regions
+   */
+  static uint64_t regionPixels(const std::vector<Rect> &aRegions);
+
+  /**
+   * @brief Add a region to a list of disjoint regions, merging it with the regions it overlaps
+   * @param aRegions The disjoint regions
+   * @param aRegion The region to add
+   */
+  static void mergeRegion(std::vector<Rect> &aRegions, Rect aRegion);
+
+private:
+  size_t mKeyframeInterval;
+  int mPadding;
+  size_t mFramesSinceKeyframe;
+  bool mKeyframeNeeded;        // the number of shapes changed or a shape left its region
+  size_t mKeyframeShapeCount;  // the number of shapes of the last keyframe
+  std::vector<Rect> mShapeBoxes;
+
+  double mProcessedFractionSum;
+  uint64_t mFrameCount;
+  uint64_t mKeyframeCount;
+};
+
+#endif
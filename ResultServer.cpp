@@ -0,0 +1,425 @@
+// Library
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Local
+#include "ResultServer.h"
+
+namespace
+{
+const std::string UNIX_ADDRESS_PREFIX = "unix:";
+const std::string TCP_ADDRESS_PREFIX = "tcp:";
+const int MAX_EVENTS = 64;
+const size_t READ_BUFFER_SIZE = 512;
+const size_t MAX_QUERY_LENGTH = 256; // a client that sends a longer line is disconnected
+} // namespace
+
+ResultServer::ResultServer()
+    : mListenDescriptor(-1), mEpollDescriptor(-1), mWakeDescriptor(-1), mStopping(true), mPublishedNew(false), mClientCount(0),
+      mSentCount(0), mSkippedCount(0)
+{
+}
+
+ResultServer::~ResultServer()
+{
+    close();
+}
+
+bool ResultServer::open(const std::string &aAddress)
+{
+    close();
+
+    if (aAddress.compare(0, UNIX_ADDRESS_PREFIX.size(), UNIX_ADDRESS_PREFIX) == 0)
+    {
+        const std::string path = aAddress.substr(UNIX_ADDRESS_PREFIX.size());
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+
+        // A socket file left by an earlier run would make the bind fail
+        unlink(path.c_str());
+        mListenDescriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (mListenDescriptor >= 0 && bind(mListenDescriptor, (const sockaddr *)&address, sizeof(address)) == 0)
+        {
+            mUnixPath = path;
+        }
+        else
+        {
+            close();
+            return false;
+        }
+    }
+    else if (aAddress.compare(0, TCP_ADDRESS_PREFIX.size(), TCP_ADDRESS_PREFIX) == 0)
+    {
+        const int port = atoi(aAddress.c_str() + TCP_ADDRESS_PREFIX.size());
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local clients only
+
+        const int reuse = 1;
+        mListenDescriptor = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (port <= 0 || port > 65535 || mListenDescriptor < 0 ||
+            setsockopt(mListenDescriptor, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+            bind(mListenDescriptor, (const sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close();
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    mEpollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    mWakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event listenEvent;
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = mListenDescriptor;
+    epoll_event wakeEvent;
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = mWakeDescriptor;
+    if (listen(mListenDescriptor, SOMAXCONN) != 0 || mEpollDescriptor < 0 || mWakeDescriptor < 0 ||
+        epoll_ctl(mEpollDescriptor, EPOLL_CTL_ADD, mListenDescriptor, &listenEvent) != 0 ||
+        epoll_ctl(mEpollDescriptor, EPOLL_CTL_ADD, mWakeDescriptor, &wakeEvent) != 0)
+    {
+        close();
+        return false;
+    }
+
+    mPublished.clear();
+    mPublishedNew = false;
+    mQueries.clear();
+    mLatest.clear();
+    mClientCount = 0;
+    mSentCount = 0;
+    mSkippedCount = 0;
+    mStopping = false;
+    mServerThread = std::thread(&ResultServer::serveLoop, this);
+    return true;
+}
+
+void ResultServer::close()
+{
+    mStopping = true;
+    if (mServerThread.joinable())
+    {
+        const uint64_t wake = 1;
+        const ssize_t written = write(mWakeDescriptor, &wake, sizeof(wake));
+        (void)written;
+        mServerThread.join();
+    }
+
+    for (const std::pair<const int, Client> &client : mClients)
+    {
+        ::close(client.first);
+    }
+    mClients.clear();
+    for (int *descriptor : {&mListenDescriptor, &mEpollDescriptor, &mWakeDescriptor})
+    {
+        if (*descriptor >= 0)
+        {
+            ::close(*descriptor);
+        }
+        *descriptor = -1;
+    }
+    if (mUnixPath.empty() == false)
+    {
+        unlink(mUnixPath.c_str());
+        mUnixPath.clear();
+    }
+}
+
+bool ResultServer::isOpen() const
+{
+    return mListenDescriptor >= 0;
+}
+
+void ResultServer::publish(const std::string &aRecord)
+{
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPublished.assign(aRecord); // reuses the storage of an earlier record
+        wake = (mPublishedNew == false); // else the server was woken and did not take the last one yet
+        mPublishedNew = true;
+    }
+    if (wake)
+    {
+        const uint64_t value = 1;
+        const ssize_t written = write(mWakeDescriptor, &value, sizeof(value));
+        (void)written;
+    }
+}
+
+bool ResultServer::takeQuery(std::string &aCommand)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mQueries.empty())
+    {
+        return false;
+    }
+    aCommand = mQueries.front();
+    mQueries.erase(mQueries.begin());
+    return true;
+}
+
+uint64_t ResultServer::clientCount() const
+{
+    return mClientCount;
+}
+
+uint64_t ResultServer::sentCount() const
+{
+    return mSentCount;
+}
+
+uint64_t ResultServer::skippedCount() const
+{
+    return mSkippedCount;
+}
+
+void ResultServer::serveLoop()
+{
+    epoll_event events[MAX_EVENTS];
+    while (mStopping == false)
+    {
+        const int eventCount = epoll_wait(mEpollDescriptor, events, MAX_EVENTS, -1);
+        if (eventCount < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (eventCount < 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < eventCount && mStopping == false; i++)
+        {
+            const int descriptor = events[i].data.fd;
+            if (descriptor == mWakeDescriptor)
+            {
+                uint64_t value = 0;
+                const ssize_t readSize = read(mWakeDescriptor, &value, sizeof(value));
+                (void)readSize;
+                distributeRecord();
+                continue;
+            }
+            if (descriptor == mListenDescriptor)
+            {
+                acceptClients();
+                continue;
+            }
+
+            // A client dropped earlier in this batch has no entry anymore
+            std::unordered_map<int, Client>::iterator client = mClients.find(descriptor);
+            if (client == mClients.end())
+            {
+                continue;
+            }
+            bool connected = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+            if (connected && (events[i].events & EPOLLIN) != 0)
+            {
+                connected = readClient(client->second);
+            }
+            if (connected && (events[i].events & EPOLLOUT) != 0)
+            {
+                connected = writeClient(client->second);
+            }
+            if (connected == false)
+            {
+                dropClient(descriptor);
+            }
+        }
+    }
+}
+
+void ResultServer::distributeRecord()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mPublishedNew == false)
+        {
+            return;
+        }
+        // The detector gets the old buffer back to fill, neither side allocates
+        std::swap(mPublished, mLatest);
+        mPublishedNew = false;
+    }
+
+    std::vector<int> goneClients;
+    for (std::pair<const int, Client> &entry : mClients)
+    {
+        Client &client = entry.second;
+        if (client.offset < client.output.size())
+        {
+            // Still sending, the client gets the newest record after this one
+            mSkippedCount += client.stale ? 1 : 0;
+            client.stale = true;
+            continue;
+        }
+        client.stale = true;
+        if (writeClient(client) == false)
+        {
+            goneClients.push_back(entry.first);
+        }
+    }
+    for (int descriptor : goneClients)
+    {
+        dropClient(descriptor);
+    }
+}
+
+void ResultServer::acceptClients()
+{
+    while (true)
+    {
+        const int descriptor = accept4(mListenDescriptor, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (descriptor < 0)
+        {
+            return; // EAGAIN: every waiting connection was accepted
+        }
+
+        Client client;
+        client.fileDescriptor = descriptor;
+        client.offset = 0;
+        client.stale = false;
+        client.writing = false;
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = descriptor;
+        if (epoll_ctl(mEpollDescriptor, EPOLL_CTL_ADD, descriptor, &event) != 0)
+        {
+            ::close(descriptor);
+            continue;
+        }
+        mClients[descriptor] = client;
+        mClientCount++;
+    }
+}
+
+bool ResultServer::readClient(Client &aClient)
+{
+    char buffer[READ_BUFFER_SIZE];
+    std::vector<std::string> lines;
+    bool connected = true;
+    while (true)
+    {
+        const ssize_t readSize = recv(aClient.fileDescriptor, buffer, sizeof(buffer), 0);
+        if (readSize < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (readSize < 0)
+        {
+            connected = (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+        if (readSize == 0)
+        {
+            connected = false;
+            break;
+        }
+
+        for (ssize_t i = 0; i < readSize; i++)
+        {
+            if (buffer[i] != '\n')
+            {
+                aClient.input.push_back(buffer[i]);
+                continue;
+            }
+            if (aClient.input.empty() == false && aClient.input.back() == '\r')
+            {
+                aClient.input.pop_back();
+            }
+            if (aClient.input.empty() == false)
+            {
+                lines.push_back(aClient.input);
+            }
+            aClient.input.clear();
+        }
+        if (aClient.input.size() > MAX_QUERY_LENGTH)
+        {
+            connected = false;
+            break;
+        }
+    }
+
+    if (lines.empty() == false)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueries.insert(mQueries.end(), lines.begin(), lines.end());
+    }
+    return connected;
+}
+
+bool ResultServer::writeClient(Client &aClient)
+{
+    while (true)
+    {
+        if (aClient.offset == aClient.output.size())
+        {
+            if (aClient.stale == false || mLatest.empty())
+            {
+                break;
+            }
+            aClient.output.assign(mLatest);
+            aClient.offset = 0;
+            aClient.stale = false;
+        }
+
+        const ssize_t sent = send(aClient.fileDescriptor, aClient.output.data() + aClient.offset, aClient.output.size() - aClient.offset,
+                                  MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break; // the socket is full, the rest follows when it is writable
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        aClient.offset += (size_t)sent;
+        mSentCount += (aClient.offset == aClient.output.size()) ? 1 : 0;
+    }
+    updateInterest(aClient);
+    return true;
+}
+
+void ResultServer::updateInterest(Client &aClient)
+{
+    const bool writing = aClient.offset < aClient.output.size();
+    if (writing == aClient.writing)
+    {
+        return;
+    }
+    epoll_event event;
+    event.events = writing ? (uint32_t)(EPOLLIN | EPOLLOUT) : (uint32_t)EPOLLIN;
+    event.data.fd = aClient.fileDescriptor;
+    epoll_ctl(mEpollDescriptor, EPOLL_CTL_MOD, aClient.fileDescriptor, &event);
+    aClient.writing = writing;
+}
+
+void ResultServer::dropClient(int aFileDescriptor)
+{
+    // Closing the socket also removes it from the epoll set
+    ::close(aFileDescriptor);
+    mClients.erase(aFileDescriptor);
+}
@@ -0,0 +1,146 @@
+#ifndef RESULT_SERVER_H_
+#define RESULT_SERVER_H_
+
+// Library
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Serves the newest detection record to many local clients from one epoll thread
+ *
+ * The detector hands over every record and never waits for a client: the
+ * server thread sends a client the newest record once it took the previous
+ * one completely, the records a slow client missed are skipped. A client
+ * can send "vorm kleur" lines, the frame loop takes them as new queries.
+ */
+class ResultServer
+{
+public:
+  ResultServer();
+  ~ResultServer();
+
+  ResultServer(const ResultServer &) = delete;
+  ResultServer &operator=(const ResultServer &) = delete;
+
+  /**
+   * @brief Listen and start the server thread
+   * @param aAddress "unix:<path>" for a Unix stream socket, "tcp:<port>" for a TCP port on localhost
+   * @return whether the server listens
+   */
+  bool open(const std::string &aAddress);
+
+  /**
+   * @brief Stop the server thread and disconnect every client
+   */
+  void close();
+
+  /**
+   * @brief Get whether the server listens
+   */
+  bool isOpen() const;
+
+  /**
+   * @brief Make a record the newest one, only called by the detector thread
+   * @param aRecord The record, a complete line
+   */
+  void publish(const std::string &aRecord);
+
+  /**
+   * @brief Take the next query line a client sent
+   * @param aCommand The line, without its newline
+   * @return false when there is none
+   */
+  bool takeQuery(std::string &aCommand);
+
+  /**
+   * @brief Get the number of clients that connected
+   */
+  uint64_t clientCount() const;
+
+  /**
+   * @brief Get the number of records sent to a client
+   */
+  uint64_t sentCount() const;
+
+  /**
+   * @brief Get the number of records a slow client missed because a newer one replaced them
+   */
+  uint64_t skippedCount() const;
+
+private:
+  /**
+   * @brief A connected client, server thread only
+   */
+  struct Client
+  {
+    int fileDescriptor;
+    std::string input;  // the received part of the next query line
+    std::string output; // the record being sent
+    size_t offset;      // the bytes of the output that were sent
+    bool stale;         // a newer record was published while the output was sent
+    bool writing;       // the socket is watched for writing
+  };
+
+  /**
+   * @brief The loop of the server thread
+   */
+  void serveLoop();
+
+  /**
+   * @brief Take the published record and hand it to every client
+   */
+  void distributeRecord();
+
+  /**
+   * @brief Accept every waiting connection
+   */
+  void acceptClients();
+
+  /**
+   * @brief Read the query lines of a client
+   * @return false when the client is gone or misbehaves
+   */
+  bool readClient(Client &aClient);
+
+  /**
+   * @brief Send what the socket of a client takes, then the newest record when it is stale
+   * @return false when the client is gone
+   */
+  bool writeClient(Client &aClient);
+
+  /**
+   * @brief Watch a client for reading, and for writing while it has output left
+   */
+  void updateInterest(Client &aClient);
+
+  /**
+   * @brief Close the connection of a client
+   */
+  void dropClient(int aFileDescriptor);
+
+  std::string mUnixPath; // removed on close, empty for TCP
+  int mListenDescriptor;
+  int mEpollDescriptor;
+  int mWakeDescriptor; // an eventfd, a record was published or the server stops
+  std::thread mServerThread;
+  std::atomic<bool> mStopping;
+
+  std::mutex mMutex;
+  std::string mPublished; // the newest record, guarded by mMutex
+  bool mPublishedNew;     // guarded by mMutex
+  std::vector<std::string> mQueries; // the received query lines, guarded by mMutex
+
+  std::string mLatest; // the newest record, server thread only
+  std::unordered_map<int, Client> mClients; // by socket
+
+  std::atomic<uint64_t> mClientCount;
+  std::atomic<uint64_t> mSentCount;
+  std::atomic<uint64_t> mSkippedCount;
+};
+
+#endif
@@ -0,0 +1,251 @@
+// Library
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Local
+#include "ResultSink.h"
+
+namespace
+{
+const std::string STANDARD_OUTPUT_TARGET = "-";
+const std::string UNIX_SOCKET_PREFIX = "unix:";
+} // namespace
+
+ResultSink::ResultSink()
+    : mFileDescriptor(-1), mOwnsFileDescriptor(false), mIsSocket(false), mFormat(SinkFormat::JSON_LINES), mBufferSize(0),
+      mPendingCount(0), mStopping(true), mFailed(false), mWrittenCount(0), mDroppedCount(0)
+{
+}
+
+ResultSink::~ResultSink()
+{
+    close();
+}
+
+bool ResultSink::open(const std::string &aTarget, SinkFormat aFormat, size_t aBufferSize)
+{
+    close();
+
+    mIsSocket = false;
+    mOwnsFileDescriptor = true;
+    if (aTarget == STANDARD_OUTPUT_TARGET)
+    {
+        fflush(stdout); // the records follow what was printed before
+        mFileDescriptor = STDOUT_FILENO;
+        mOwnsFileDescriptor = false;
+    }
+    else if (aTarget.compare(0, UNIX_SOCKET_PREFIX.size(), UNIX_SOCKET_PREFIX) == 0)
+    {
+        const std::string path = aTarget.substr(UNIX_SOCKET_PREFIX.size());
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+
+        mFileDescriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (mFileDescriptor >= 0 && connect(mFileDescriptor, (const sockaddr *)&address, sizeof(address)) != 0)
+        {
+            ::close(mFileDescriptor);
+            mFileDescriptor = -1;
+        }
+        mIsSocket = true;
+    }
+    else
+    {
+        mFileDescriptor = ::open(aTarget.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (mFileDescriptor < 0)
+    {
+        return false;
+    }
+
+    // A reader that goes away must not end the program, the writer sees EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+
+    mFormat = aFormat;
+    mBufferSize = aBufferSize;
+    mRecord.clear();
+    mPending.clear();
+    mPending.reserve(mBufferSize);
+    mWriting.reserve(mBufferSize);
+    mPendingCount = 0;
+    mStopping = false;
+    mFailed = false;
+    mWrittenCount = 0;
+    mDroppedCount = 0;
+    mWriterThread = std::thread(&ResultSink::writeLoop, this);
+    return true;
+}
+
+void ResultSink::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+
+    if (mWriterThread.joinable())
+    {
+        mWriterThread.join();
+    }
+    if (mFileDescriptor >= 0 && mOwnsFileDescriptor)
+    {
+        ::close(mFileDescriptor);
+    }
+    mFileDescriptor = -1;
+}
+
+bool ResultSink::isOpen() const
+{
+    return mFileDescriptor >= 0;
+}
+
+SinkFormat ResultSink::format() const
+{
+    return mFormat;
+}
+
+std::string &ResultSink::beginRecord()
+{
+    mRecord.clear();
+    return mRecord;
+}
+
+void ResultSink::commitRecord()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFailed || mStopping || mPending.size() + mRecord.size() > mBufferSize)
+        {
+            mDroppedCount++;
+            return;
+        }
+        mPending.append(mRecord);
+        mPendingCount++;
+    }
+    mCondition.notify_one();
+}
+
+uint64_t ResultSink::writtenCount() const
+{
+    return mWrittenCount;
+}
+
+uint64_t ResultSink::droppedCount() const
+{
+    return mDroppedCount;
+}
+
+bool ResultSink::StringToFormat(const std::string &aFormatString, SinkFormat &aFormat)
+{
+    bool result = true;
+    if (aFormatString == "jsonl")
+    {
+        aFormat = SinkFormat::JSON_LINES;
+    }
+    else if (aFormatString == "binary")
+    {
+        aFormat = SinkFormat::BINARY;
+    }
+    else
+    {
+        result = false;
+    }
+    return result;
+}
+
+void ResultSink::appendBinary(std::string &aRecord, uint64_t aValue, size_t aBytes)
+{
+    for (size_t i = 0; i < aBytes; i++)
+    {
+        aRecord.push_back((char)(uint8_t)(aValue >> (8 * i)));
+    }
+}
+
+void ResultSink::appendJsonString(std::string &aRecord, const std::string &aText)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    aRecord.push_back('"');
+    for (char character : aText)
+    {
+        const unsigned char code = (unsigned char)character;
+        if (character == '"' || character == '\\')
+        {
+            aRecord.push_back('\\');
+            aRecord.push_back(character);
+        }
+        else if (code < 0x20)
+        {
+            aRecord.append("\\u00");
+            aRecord.push_back(HEX_DIGITS[code >> 4]);
+            aRecord.push_back(HEX_DIGITS[code & 0xF]);
+        }
+        else
+        {
+            aRecord.push_back(character);
+        }
+    }
+    aRecord.push_back('"');
+}
+
+void ResultSink::writeLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mCondition.wait(lock, [this]() { return mStopping || mPending.empty() == false; });
+        if (mPending.empty())
+        {
+            break; // stopping, everything is written
+        }
+
+        // The detector fills the other buffer while this one is written
+        std::swap(mPending, mWriting);
+        const uint64_t recordCount = mPendingCount;
+        mPendingCount = 0;
+        lock.unlock();
+
+        const bool written = writeAll(mWriting);
+        mWriting.clear();
+
+        lock.lock();
+        if (written == false)
+        {
+            mFailed = true;
+            mDroppedCount += recordCount;
+            break;
+        }
+        mWrittenCount += recordCount;
+    }
+}
+
+bool ResultSink::writeAll(const std::string &aBytes) const
+{
+    size_t offset = 0;
+    while (offset < aBytes.size())
+    {
+        const ssize_t written = mIsSocket ? send(mFileDescriptor, aBytes.data() + offset, aBytes.size() - offset, MSG_NOSIGNAL)
+                                          : write(mFileDescriptor, aBytes.data() + offset, aBytes.size() - offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        offset += (size_t)written;
+    }
+    return true;
+}
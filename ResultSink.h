@@ -0,0 +1,140 @@
+#ifndef RESULT_SINK_H_
+#define RESULT_SINK_H_
+
+// Library
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * @brief How the detection records are serialized
+ */
+enum class SinkFormat
+{
+  JSON_LINES, // one JSON object per frame and line
+  BINARY      // length-prefixed little-endian records, see the README
+};
+
+/**
+ * @brief Writes the detection records to a file, pipe or Unix socket from a background thread
+ *
+ * The detector serializes a frame into the reusable record buffer and
+ * commits it. The record is appended to a pending buffer of fixed capacity
+ * that the writer thread swaps out and writes, so the detector only waits
+ * for a short copy, never for the output. A record that does not fit in the
+ * pending buffer is dropped and counted.
+ */
+class ResultSink
+{
+public:
+  ResultSink();
+  ~ResultSink();
+
+  ResultSink(const ResultSink &) = delete;
+  ResultSink &operator=(const ResultSink &) = delete;
+
+  /**
+   * @brief Open the output and start the writer thread
+   * @param aTarget "-" for the standard output, "unix:<path>" for a Unix stream socket, else a file or named pipe
+   * @param aFormat The format of the records
+   * @param aBufferSize The bytes that may wait for the writer
+   * @return whether the output was opened, a named pipe waits for its reader
+   */
+  bool open(const std::string &aTarget, SinkFormat aFormat, size_t aBufferSize = 1 << 20);
+
+  /**
+   * @brief Write the pending records, stop the writer thread and close the output
+   */
+  void close();
+
+  /**
+   * @brief Get whether records are written
+   */
+  bool isOpen() const;
+
+  /**
+   * @brief Get the format of the records
+   */
+  SinkFormat format() const;
+
+  /**
+   * @brief Start a record, only called by the detector thread
+   * @return std::string& The emptied record buffer to serialize the frame into
+   */
+  std::string &beginRecord();
+
+  /**
+   * @brief Queue the record for the writer, dropped when the pending buffer is full
+   */
+  void commitRecord();
+
+  /**
+   * @brief Get the number of records written to the output
+   */
+  uint64_t writtenCount() const;
+
+  /**
+   * @brief Get the number of records dropped because the output fell behind or failed
+   */
+  uint64_t droppedCount() const;
+
+  /**
+   * @brief Parse a format name (jsonl or binary)
+   * @param aFormatString The name of the format
+   * @param aFormat The parsed format
+   * @return whether the name is valid
+   */
+  static bool StringToFormat(const std::string &aFormatString, SinkFormat &aFormat);
+
+  /**
+   * @brief Append an unsigned value in little-endian order
+   * @param aRecord The record to append to
+   * @param aValue The value
+   * @param aBytes The number of bytes to write, at most 8
+   */
+  static void appendBinary(std::string &aRecord, uint64_t aValue, size_t aBytes);
+
+  /**
+   * @brief Append a quoted and escaped JSON string
+   * @param aRecord The record to append to
+   * @param aText The text to quote
+   */
+  static void appendJsonString(std::string &aRecord, const std::string &aText);
+
+private:
+  /**
+   * @brief The loop of the writer thread
+   */
+  void writeLoop();
+
+  /**
+   * @brief Write all bytes to the output
+   * @return whether the output took them
+   */
+  bool writeAll(const std::string &aBytes) const;
+
+  int mFileDescriptor; // -1 when closed
+  bool mOwnsFileDescriptor;
+  bool mIsSocket;
+  SinkFormat mFormat;
+  size_t mBufferSize;
+
+  std::string mRecord;  // the record being serialized, detector thread only
+  std::string mPending; // the committed records, guarded by mMutex
+  std::string mWriting; // the records being written, writer thread only
+  uint64_t mPendingCount;
+
+  std::thread mWriterThread;
+  std::mutex mMutex;
+  std::condition_variable mCondition; // records were committed or the sink stops
+  bool mStopping;
+  bool mFailed; // the output stopped taking bytes
+
+  std::atomic<uint64_t> mWrittenCount;
+  std::atomic<uint64_t> mDroppedCount;
+};
+
+#endif
@@ -1,38 +1,62 @@
 // Local
 #include "Shapedetector.h"
+#include "ThreadPool.h"
+#include "FramePipeline.h"
 
 // Constructor
-Shapedetector::Shapedetector()
+Shapedetector::Shapedetector() : mPendingParameters(nullptr), mQueries(std::make_shared<const std::vector<ShapeQuery>>())
 {
     initializeValues();
+    updateParameters();
 }
 
 void Shapedetector::setImage(Mat aImage)
 {
     // Store origininal image
-    mOriginalImage = aImage;
-    mOriginalImage.copyTo(mDisplayImage);
-    mOriginalImage.copyTo(mTresholdImage);
+    mFrame.originalImage = aImage;
+    mFrame.originalImage.copyTo(mFrame.displayImage);
 
     // Convert to necessary formats
-    cvtColor(mOriginalImage, mGreyImage, CV_BGR2GRAY);
-    cvtColor(mOriginalImage, mHSVImage, CV_BGR2HSV);
+    cvtColor(mFrame.originalImage, mGreyImage, CV_BGR2GRAY);
 }
 
-void Shapedetector::reset()
+void Shapedetector::reset(FrameContext &aContext) const
 {
     // Reload frames
-    mOriginalImage.copyTo(mDisplayImage);
-    mOriginalImage.copyTo(mTresholdImage);
-    cvtColor(mOriginalImage, mHSVImage, CV_BGR2HSV);
-    mCurrentShapeCount = 0; // Reset shape count
+    if (mHeadless == false)
+    {
+        aContext.originalImage.copyTo(aContext.displayImage);
+    }
+
+    // Take the slider values, frames in flight keep the values they started with
+    aContext.settings.noiseKernelSize = std::max(1, mNoiseSliderValue);
+    aContext.settings.minSquareRatio = mMinSquareRatio;
+    aContext.settings.maxSquareRatio = mMaxSquareRatio;
+    aContext.parameters = mParameters;
+
+    // Reset shape counts, the frame keeps the queries it started with
+    aContext.result.queries = mQueries;
+    aContext.result.shapeCounts.assign(mQueries->size(), 0);
+    aContext.keyframe = true;
+    aContext.fullFrame = true;
+    aContext.regions.clear();
+    aContext.result.shapes.clear();
+    aContext.result.detections.clear();
+    aContext.result.processedFraction = 1.0;
+    aContext.result.detectionTime = 0.0;
+    aContext.result.decoded = true;
 }
 
 void Shapedetector::initializeValues()
 {   
-    // Set shape and color
-    mCurrentColor = COLORS::UNKNOWNCOLOR;
-    mCurrentShape = SHAPES::UNKNOWNSHAPE;
+    mHeadless = false;
+    mPipelineDepth = 0;
+    mColorLutBits = 0;
+    mWatchProfile = false;
+    mKeyframeInterval = 0;
+    mPyramidLevels = 0;
+    mStageReportInterval = std::chrono::seconds(10);
+    mReportedFrames = 0;
 
     // Set the calibration variables
     mContrastSliderValue = 0;
@@ -75,7 +99,7 @@ void Shapedetector::initializeValues()
 
     // Set the Contours variables
     mContourCenterMargin = 30;
-    mCurrentShapeCount = 0;
+    mTrackPadding = 40;
     mEpsilonMultiply = 0.03;
     mMinContourSize = 300.0;
     mMaxContourSize = 2800.0;
@@ -114,9 +138,11 @@ void Shapedetector::initializeValues()
 // Destructorclean
 Shapedetector::~Shapedetector()
 {
+    mParameterWatcher.stop();
+    delete mPendingParameters.exchange(nullptr);
 }
 
-bool Shapedetector::parseSpec(const std::string &aShapeCommand)
+bool Shapedetector::parseQuery(const std::string &aShapeCommand, ShapeQuery &aQuery)
 {
     bool result = true;
 
@@ -125,44 +151,144 @@ bool Shapedetector::parseSpec(const std::string &aShapeCommand)
     std::string shapeStr = aShapeCommand.substr(0, delimiterPos);
     std::string colorStr = aShapeCommand.substr(delimiterPos + 1);
 
-    mCurrentColor = StringToColor(colorStr); // convert string to enum
-    if (mCurrentColor == COLORS::UNKNOWNCOLOR)
+    aQuery.color = StringToColor(colorStr); // convert string to enum
+    if (aQuery.color == COLORS::UNKNOWNCOLOR)
     {
         std::cout << "Error: unkown color entered" << std::endl;
         result = false;
     }
 
-    mCurrentShape = StringToShape(shapeStr); // convert string to enum
-    if (mCurrentShape == SHAPES::UNKNOWNSHAPE)
+    aQuery.shape = StringToShape(shapeStr); // convert string to enum
+    if (aQuery.shape == SHAPES::UNKNOWNSHAPE)
     {
         std::cout << "Error: unkown shape entered" << std::endl;
         result = false;
     }
 
+    aQuery.command = aShapeCommand;
+
+    return result;
+}
+
+bool Shapedetector::parseSpec(const std::string &aShapeCommand)
+{
+    ShapeQuery query;
+    bool result = parseQuery(aShapeCommand, query);
+
+    if (result)
+    {
+        mQueries = std::make_shared<const std::vector<ShapeQuery>>(1, query);
+    }
+
+    return result;
+}
+
+bool Shapedetector::addSpec(const std::string &aShapeCommand)
+{
+    ShapeQuery query;
+    bool result = parseQuery(aShapeCommand, query);
+
     if (result)
     {
-        mCurrentShapeCommand = aShapeCommand;
+        appendQuery(query);
     }
 
     return result;
 }
 
-bool Shapedetector::showImages()
+bool Shapedetector::appendQuery(const ShapeQuery &aQuery)
 {
-    bool keyPressed = false;
+    const bool known = std::any_of(mQueries->begin(), mQueries->end(),
+                                   [&aQuery](const ShapeQuery &aActive) { return aActive.shape == aQuery.shape && aActive.color == aQuery.color; });
+    if (known)
+    {
+        return false;
+    }
+
+    // The frames in flight keep the old list, a copy with the new query replaces it
+    std::shared_ptr<std::vector<ShapeQuery>> queries = std::make_shared<std::vector<ShapeQuery>>(*mQueries);
+    queries->push_back(aQuery);
+    mQueries = queries;
+    return true;
+}
+
+bool Shapedetector::loadBatch(const std::string &aBatchPath)
+{
+    std::vector<ShapeQuery> queries;
+    std::string line;
+    std::ifstream batchFile(aBatchPath);
+
+    while (std::getline(batchFile, line)) // for every line in the file
+    {
+        if (line.empty() == false && line.at(0) != COMMENT_CHARACTER) // if line doesnt start with comment char
+        {
+            ShapeQuery query;
+            if (parseQuery(line, query))
+            {
+                std::cout << "Detecting \"" << line << "\".." << std::endl;
+                queries.push_back(query);
+            }
+            else
+            {
+                std::cout << "Error: invalid specification entered (" << line << ")" << std::endl;
+            }
+        }
+    }
+
+    mQueries = std::make_shared<const std::vector<ShapeQuery>>(std::move(queries));
+    return mQueries->empty() == false;
+}
+
+void Shapedetector::addClientQueries()
+{
+    std::string command;
+    bool added = false;
+    while (mResultServer.isOpen() && mResultServer.takeQuery(command))
+    {
+        ShapeQuery query;
+        if (parseQuery(command, query) == false)
+        {
+            std::cout << "Error: invalid specification from a client (" << command << ")" << std::endl;
+        }
+        else if (appendQuery(query))
+        {
+            std::cout << "Detecting \"" << command << "\".. (from a client)" << std::endl;
+            mClientQueries.push_back(query);
+            added = true;
+        }
+    }
+    if (added)
+    {
+        // The shapes of a new query can lie outside the tracked regions and in an unchanged scene
+        mTracker.configure(mKeyframeInterval, mTrackPadding);
+        mChangeDetector.invalidate();
+    }
+}
 
-    reset();     // reset images and values
-    recognize(); // run algorithm
+bool Shapedetector::showImages(const FrameContext &aContext)
+{
+    if (mHeadless)
+    {
+        return false;
+    }
+    ScopedStageTimer timer(mStageProfile, Stage::DISPLAY);
 
     // Show images
-    imshow("Original", mOriginalImage);
-    imshow("Color", mMaskImage);
-    imshow("Result", mDisplayImage);
+    imshow("Original", aContext.originalImage);
+    imshow("Color", aContext.maskImage);
+    imshow("Result", aContext.displayImage);
 
     // imshow("Brightness", mBrightenedRgbImage);
     // imshow("Blur", mBlurredImage);
 
-    int pressedKey = waitKey(30);
+    return exitKeyPressed(30);
+}
+
+bool Shapedetector::exitKeyPressed(int aDelay)
+{
+    bool keyPressed = false;
+
+    int pressedKey = waitKey(aDelay);
     if (pressedKey == 27) // ESC key
     {
         destroyAllWindows();
@@ -174,6 +300,11 @@ bool Shapedetector::showImages()
 
 void Shapedetector::draw()
 {
+    if (mHeadless)
+    {
+        return;
+    }
+
     // Show original
     namedWindow("Original", WINDOW_NORMAL);
     moveWindow("Original", 0, 0);
@@ -196,21 +327,142 @@ void Shapedetector::draw()
     createTrackbar("Noise\t\t", "Sliders", &mNoiseSliderValue, mNoiseSliderRange, onChange, this);
     createTrackbar("minRatio\t\t", "Sliders", &mMinRatioSliderValue, mMinRatioSliderRange, onChange, this);
     createTrackbar("maxRatio\t\t", "Sliders", &mMaxRatioSliderValue, mMaxRatioSliderRange, onChange, this);
-    moveWindow("Sliders", 0, mOriginalImage.rows + 10);
+    moveWindow("Sliders", 0, mFrame.originalImage.rows + 10);
 
     const int sliderWidth = 500;
     Mat emptyMatrix = Mat::zeros(1, sliderWidth, CV_8U);
     imshow("Sliders", emptyMatrix); // put an empty matrix in this window to prevent errors
 }
 
-void Shapedetector::printDetectionData()
+void Shapedetector::printDetectionData(const FrameResult &aResult) const
+{
+    for (const ShapeDetection &detection : aResult.detections)
+    {
+        std::cout << "\t" << aResult.queries->at(detection.queryIndex).command << ":\tX: " << detection.center.x << "\tY: " << detection.center.y
+                  << "\tA: " << detection.area << "\n";
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << "\tT = " << aResult.detectionTime << " ms\t";
+    for (size_t i = 0; i < aResult.queries->size(); i++)
+    {
+        std::cout << aResult.shapeCounts.at(i) << " " << aResult.queries->at(i).command << "\t";
+    }
+    if (mTracker.enabled())
+    {
+        // The fraction of the frame that was processed
+        std::cout << "P = " << std::setprecision(1) << (100.0 * aResult.processedFraction) << "%";
+    }
+    std::cout << "\n"; // no flush per frame, the stream flushes when its buffer is full
+}
+
+void Shapedetector::reportResult(const FrameResult &aResult)
 {
-    std::cout << std::fixed << std::setprecision(2) << "\tT = " << ((double)mClockEnd - (double)mClockStart) << "\t\t";
-    std::cout << std::to_string(mCurrentShapeCount) + " " + ShapeToString(mCurrentShape) << std::endl;
+    const uint64_t frameId = mReportedFrames++;
+    if (mResultServer.isOpen())
+    {
+        // The clients read lines, the server always gets JSON
+        mServerRecord.clear();
+        serializeResult(frameId, aResult, SinkFormat::JSON_LINES, mServerRecord);
+        mResultServer.publish(mServerRecord);
+    }
+    if (mResultSink.isOpen() == false)
+    {
+        printDetectionData(aResult);
+        return;
+    }
+
+    serializeResult(frameId, aResult, mResultSink.format(), mResultSink.beginRecord());
+    mResultSink.commitRecord();
 }
 
-// Starts the detection algorithm
-void Shapedetector::recognize()
+void Shapedetector::serializeResult(uint64_t aFrameId, const FrameResult &aResult, SinkFormat aFormat, std::string &aRecord) const
+{
+    const int64_t timestamp =
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    if (aFormat == SinkFormat::BINARY)
+    {
+        // The size is filled in once the record is complete
+        ResultSink::appendBinary(aRecord, 0, 4);
+        ResultSink::appendBinary(aRecord, aFrameId, 8);
+        ResultSink::appendBinary(aRecord, (uint64_t)timestamp, 8);
+        ResultSink::appendBinary(aRecord, (uint64_t)std::max(0.0, aResult.detectionTime * 1000.0), 4);
+        ResultSink::appendBinary(aRecord, aResult.shapeCounts.size(), 2);
+        for (int count : aResult.shapeCounts)
+        {
+            ResultSink::appendBinary(aRecord, (uint64_t)count, 2);
+        }
+        ResultSink::appendBinary(aRecord, aResult.detections.size(), 2);
+        for (const ShapeDetection &detection : aResult.detections)
+        {
+            ResultSink::appendBinary(aRecord, detection.queryIndex, 2);
+            ResultSink::appendBinary(aRecord, (uint64_t)detection.shape, 1);
+            ResultSink::appendBinary(aRecord, (uint64_t)detection.color, 1);
+            ResultSink::appendBinary(aRecord, (uint32_t)detection.center.x, 4);
+            ResultSink::appendBinary(aRecord, (uint32_t)detection.center.y, 4);
+            ResultSink::appendBinary(aRecord, (uint32_t)detection.area, 4);
+        }
+        const uint64_t size = aRecord.size() - 4;
+        for (size_t i = 0; i < 4; i++)
+        {
+            aRecord.at(i) = (char)(uint8_t)(size >> (8 * i));
+        }
+        return;
+    }
+
+    char number[32];
+    aRecord.append("{\"frame\":");
+    aRecord.append(std::to_string(aFrameId));
+    aRecord.append(",\"time_us\":");
+    aRecord.append(std::to_string(timestamp));
+    snprintf(number, sizeof(number), "%.3f", aResult.detectionTime);
+    aRecord.append(",\"detection_ms\":");
+    aRecord.append(number);
+    aRecord.append(",\"counts\":{");
+    for (size_t i = 0; i < aResult.shapeCounts.size(); i++)
+    {
+        aRecord.append((i == 0) ? "" : ",");
+        ResultSink::appendJsonString(aRecord, aResult.queries->at(i).command);
+        aRecord.push_back(':');
+        aRecord.append(std::to_string(aResult.shapeCounts.at(i)));
+    }
+    aRecord.append("},\"shapes\":[");
+    for (size_t i = 0; i < aResult.detections.size(); i++)
+    {
+        const ShapeDetection &detection = aResult.detections.at(i);
+        aRecord.append((i == 0) ? "{\"query\":" : ",{\"query\":");
+        ResultSink::appendJsonString(aRecord, aResult.queries->at(detection.queryIndex).command);
+        aRecord.append(",\"label\":");
+        ResultSink::appendJsonString(aRecord, ShapeToString(detection.shape));
+        aRecord.append(",\"color\":");
+        ResultSink::appendJsonString(aRecord, ColorToString(detection.color));
+        aRecord.append(",\"x\":");
+        aRecord.append(std::to_string(detection.center.x));
+        aRecord.append(",\"y\":");
+        aRecord.append(std::to_string(detection.center.y));
+        aRecord.append(",\"area\":");
+        aRecord.append(std::to_string(detection.area));
+        aRecord.push_back('}');
+    }
+    aRecord.append("]}\n");
+}
+
+void Shapedetector::closeResultOutput()
+{
+    if (mResultSink.isOpen())
+    {
+        mResultSink.close();
+        std::cout << "Result records: " << mResultSink.writtenCount() << " written, " << mResultSink.droppedCount() << " dropped" << std::endl;
+    }
+    if (mResultServer.isOpen())
+    {
+        mResultServer.close();
+        std::cout << "Result server: " << mResultServer.clientCount() << " clients, " << mResultServer.sentCount() << " records sent, "
+                  << mResultServer.skippedCount() << " skipped for slow clients" << std::endl;
+    }
+}
+
+void Shapedetector::applySliderValues()
 {
     // Constrain/manipulate slider values
     mMinSquareRatio = mMinRatioSliderValue / 100.0;
@@ -224,10 +476,11 @@ void Shapedetector::recognize()
     {
         mBlurSliderValue++;
     }
+}
 
-    // Start timer
-    mClockStart = std::clock();
-
+// Starts the detection algorithm
+void Shapedetector::recognize(FrameContext &aContext) const
+{
     //////////////////////
     // Apply filters
     //////////////////////
@@ -245,24 +498,39 @@ void Shapedetector::recognize()
     // GaussianBlur(brightenedHSVImage, blurredHSVImage, blurValue, 0);
     // cvtColor(blurredHSVImage, mBlurredImage, COLOR_HSV2BGR); // save blurred output
 
-    // 3. Filter color
-    // mMaskImage = detectColor(mCurrentColor, blurredHSVImage);
-    mMaskImage = detectColor(mCurrentColor, mOriginalImage);
+    // Every requested color is filtered once, its contours are sorted into all queries
 
+    // 3. Filter color
+    filterColors(aContext);
 
     // 4. Remove noise
-    Mat removedNoise = removeNoise(mMaskImage);
+    filterNoise(aContext);
 
     // 5. Detect shapes
-    detectShape(mCurrentShape, removedNoise);
+    findShapeContours(aContext);
+    classifyShapes(aContext);
 
-    // Stop timer
-    mClockEnd = std::clock();
+    // 6. Draw the results
+    drawShapes(aContext);
+}
+
+void Shapedetector::filterNoise(FrameContext &aContext) const
+{
+    // A single pixel kernel removes nothing
+    if (aContext.settings.noiseKernelSize <= 1)
+    {
+        return;
+    }
 
-    // Show recognition data in displayed image
-    setShapeCommand(mDisplayImage);
-    setTimeValue(mDisplayImage, mClockStart, mClockEnd);
-    setShapeFound(mDisplayImage);
+    const Rect fullFrame(0, 0, aContext.originalImage.cols, aContext.originalImage.rows);
+    const size_t regionCount = aContext.fullFrame ? 1 : aContext.regions.size();
+    for (BitMask &colorMask : aContext.colorMasks)
+    {
+        for (size_t i = 0; i < regionCount; i++)
+        {
+            removeNoise(colorMask, aContext.fullFrame ? fullFrame : aContext.regions.at(i), aContext);
+        }
+    }
 }
 
 void Shapedetector::onChange(int, void *)
@@ -270,43 +538,59 @@ void Shapedetector::onChange(int, void *)
     // Slider callback function
 }
 
-void Shapedetector::setShapeCommand(Mat aImage)
+void Shapedetector::setShapeCommand(Mat aImage, const std::vector<ShapeQuery> &aQueries) const
 {
-    const std::string aShapeCommandString = "Shape :" + mCurrentShapeCommand;
+    std::string aShapeCommandString = "Shape :";
+    for (const ShapeQuery &query : aQueries)
+    {
+        aShapeCommandString += " " + query.command + ";";
+    }
     putText(aImage, aShapeCommandString, Point(mTimeXOffset, mTimeYOffset), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(0, 0, 0), 1);
 }
 
-void Shapedetector::setTimeValue(Mat aImage, std::clock_t aStartTime, std::clock_t aEndTime)
+void Shapedetector::setTimeValue(Mat aImage, double aMilliseconds) const
 {
-    double calcTime = ((double)aEndTime - (double)aStartTime);
-    const std::string timeText = std::string("T:" + std::to_string(calcTime));
-    putText(aImage, timeText, Point(mTimeXOffset, (mTimeYOffset * 2)), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(0, 0, 0), 1);
+    std::ostringstream timeText;
+    timeText << "T: " << std::fixed << std::setprecision(2) << aMilliseconds << " ms";
+    putText(aImage, timeText.str(), Point(mTimeXOffset, (mTimeYOffset * 2)), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(0, 0, 0), 1);
 }
 
-void Shapedetector::setShapeFound(Mat aImage)
+void Shapedetector::setShapeFound(Mat aImage, const FrameResult &aResult) const
 {
-    const std::string shapeCountText = std::to_string(mCurrentShapeCount) + " " + ShapeToString(mCurrentShape);
-    putText(aImage, shapeCountText, Point(mTimeXOffset, (mTimeYOffset * 3)), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(0, 0, 0), 1);
+    for (size_t i = 0; i < aResult.queries->size(); i++)
+    {
+        const std::string shapeCountText = std::to_string(aResult.shapeCounts.at(i)) + " " + aResult.queries->at(i).command;
+        putText(aImage, shapeCountText, Point(mTimeXOffset, (mTimeYOffset * (3 + (int)i))), FONT_HERSHEY_SIMPLEX, mTextSize, Scalar(0, 0, 0), 1);
+    }
 }
 
-Mat Shapedetector::removeNoise(Mat aImage)
+void Shapedetector::removeNoise(BitMask &aMask, const Rect &aRegion, FrameContext &aContext) const
 {
-    Mat result;
-    Mat structure = getStructuringElement(MORPH_RECT, Size(mNoiseSliderValue, mNoiseSliderValue));
-    morphologyEx(aImage, result, MORPH_OPEN, structure);
-    return result;
+    // The packed opening works on whole masks, a region is copied out and back
+    const Size kernelSize(aContext.settings.noiseKernelSize, aContext.settings.noiseKernelSize);
+    if (aRegion == Rect(0, 0, aMask.cols(), aMask.rows()))
+    {
+        aMask.open(kernelSize);
+        return;
+    }
+    aMask.copyRegion(aRegion, aContext.scratchMask);
+    aContext.scratchMask.open(kernelSize);
+    aMask.pasteRegion(aContext.scratchMask, aRegion.tl());
 }
 
-void Shapedetector::webcamMode(int deviceId)
+void Shapedetector::webcamMode(const std::string &source)
 {
-    initCamera(deviceId);
+    initCamera(source);
 
     // Start webcam mode
     std::cout << "### Webcam mode ###" << std::endl;
 
-    //Calibrate colors
-    std::cout << "Calibrate colors" << std::endl;
-    calibrateColors();
+    if (prepareColors() == false)
+    {
+        closeResultOutput();
+        return;
+    }
+    watchProfile();
 
     std::cout << "Please enter [vorm] [kleur]" << std::endl;
     while (true)
@@ -322,8 +606,15 @@ void Shapedetector::webcamMode(int deviceId)
             {
                 std::cout << "Error: invalid specification entered" << std::endl;
             }
-
-            detectRealtime();
+            else
+            {
+                // The queries of the clients stay active next to the typed one
+                for (const ShapeQuery &query : mClientQueries)
+                {
+                    appendQuery(query);
+                }
+                detectRealtime();
+            }
         }
         else
         {
@@ -331,78 +622,493 @@ void Shapedetector::webcamMode(int deviceId)
             break;
         }
     }
+
+    // Every command wrote to the same output
+    closeResultOutput();
 }
 
-void Shapedetector::batchMode(int cameraId, std::string batchPath)
+void Shapedetector::batchMode(const std::string &source, std::string batchPath)
 {
-    initCamera(cameraId);
+    initCamera(source);
 
     if (fileExists(batchPath) == false)
     {
         std::cout << "Error: batch file does not exist (" << batchPath << ")" << std::endl;
     }
+    else if (loadBatch(batchPath) == false) // every command is loaded up front and detected on the same frames
+    {
+        std::cout << "Error: no valid specifications in batch file (" << batchPath << ")" << std::endl;
+    }
     else
     {
         std::cout << "### Batch mode ###" << std::endl;
 
-        std::cout << "Calibrate colors" << std::endl;
-        calibrateColors();
+        if (prepareColors())
+        {
+            watchProfile();
+            detectRealtime();
+        }
+    }
+    closeResultOutput();
+}
+
+void Shapedetector::publishMode(const std::string &source, const std::string &ringName)
+{
+    initCamera(source);
 
-        std::string line;
-        std::ifstream batchFile(batchPath);
+    std::cout << "### Publish mode ###" << std::endl;
 
-        while (std::getline(batchFile, line)) // for every line in the file
+    // The ring is created with the size of the first frame
+    SharedFrameRing ring;
+    Mat frame;
+    std::chrono::steady_clock::time_point captureTime;
+    uint64_t publishedCount = 0;
+    while (mGrabber.acquire(frame, captureTime))
+    {
+        if (ring.isOpen() == false)
         {
-            if (line.at(0) != COMMENT_CHARACTER) // if line doesnt start with comment char
+            if (ring.create(ringName, frame.cols, frame.rows, frame.type(), PUBLISH_SLOT_COUNT) == false)
             {
-                std::cout << "Detecting \"" << line << "\".." << std::endl;
+                std::cout << "Error: could not create the shared frame ring (" << ringName << ")" << std::endl;
+                break;
+            }
+            std::cout << "Publishing " << frame.cols << "x" << frame.rows << " frames to " << ringName << ".." << std::endl;
+        }
+        ring.publish(frame, captureTime);
+        mGrabber.release();
+        publishedCount++;
+    }
+    mGrabber.release();
+    std::cout << "Published " << publishedCount << " frames" << std::endl;
+}
+
+void Shapedetector::imagesMode(const std::string &imagesPath, const std::string &batchPath, size_t threadCount, bool reportScaling)
+{
+    // A directory lists all of its files, otherwise the path is used as pattern
+    std::vector<std::string> imagePaths;
+    glob(imagesPath, imagePaths, false);
+
+    if (imagePaths.empty())
+    {
+        std::cout << "Error: no images found (" << imagesPath << ")" << std::endl;
+    }
+    else if (fileExists(batchPath) == false)
+    {
+        std::cout << "Error: batch file does not exist (" << batchPath << ")" << std::endl;
+    }
+    else if (loadBatch(batchPath) == false)
+    {
+        std::cout << "Error: no valid specifications in batch file (" << batchPath << ")" << std::endl;
+    }
+    else if (mProfilePath.empty() == false && loadProfile() == false)
+    {
+        std::cout << "Error: images are not detected without their profile" << std::endl;
+    }
+    else
+    {
+        std::cout << "### Image mode ###" << std::endl;
+        setHeadless(true);
+        applySliderValues();
+
+        if (threadCount > 1)
+        {
+            setNumThreads(0); // the workers already use every core
+        }
+
+        std::vector<FrameResult> results;
+        double totalTime = processImages(imagePaths, threadCount, results);
+
+        size_t processedCount = 0;
+        for (size_t i = 0; i < imagePaths.size(); i++)
+        {
+            if (results.at(i).decoded == false)
+            {
+                std::cout << "Warning: skipping unreadable image (" << imagePaths.at(i) << ")" << std::endl;
+                continue;
+            }
+
+            if (mResultSink.isOpen() == false)
+            {
+                std::cout << "Image \"" << imagePaths.at(i) << "\"\n";
+            }
+            reportResult(results.at(i));
+            processedCount++;
+        }
+
+        closeResultOutput();
+        std::cout << "Processed " << processedCount << " images in " << std::setprecision(3) << totalTime << " s ("
+                  << ((double)processedCount / totalTime) << " images/s, " << threadCount << " threads)" << std::endl;
+        mStageProfile.print(std::cout);
 
-                bool parsingSucceeded = parseSpec(line);
-                if (parsingSucceeded == false)
+        if (reportScaling)
+        {
+            // Throughput for every thread count, relative to a single thread
+            std::cout << "Threads\tImages/s\tSpeedup\tEfficiency" << std::endl;
+            double singleThreadRate = 0.0;
+            for (size_t threads = 1; threads <= threadCount; threads++)
+            {
+                std::vector<FrameResult> scalingResults;
+                double rate = (double)imagePaths.size() / processImages(imagePaths, threads, scalingResults);
+                if (threads == 1)
                 {
-                    std::cout << "Error: invalid specification entered" << std::endl;
+                    singleThreadRate = rate;
                 }
-
-                detectRealtime();
+                double speedup = rate / singleThreadRate;
+                std::cout << threads << "\t" << rate << "\t\t" << speedup << "\t" << (100.0 * speedup / (double)threads) << "%" << std::endl;
             }
         }
     }
 }
 
+double Shapedetector::processImages(const std::vector<std::string> &aImagePaths, size_t aThreadCount, std::vector<FrameResult> &aResults) const
+{
+    aResults.assign(aImagePaths.size(), FrameResult());
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    {
+        ThreadPool pool(aThreadCount);
+        std::vector<FrameContext> contexts(pool.size()); // one context per worker
+
+        for (size_t i = 0; i < aImagePaths.size(); i++)
+        {
+            pool.submit([this, i, &aImagePaths, &aResults, &contexts](size_t aWorker) {
+                FrameContext &context = contexts.at(aWorker);
+                {
+                    ScopedStageTimer timer(mStageProfile, Stage::CAPTURE);
+                    context.originalImage = imread(aImagePaths.at(i), IMREAD_COLOR);
+                }
+                if (context.originalImage.empty())
+                {
+                    aResults.at(i).decoded = false;
+                    return;
+                }
+
+                reset(context);
+                recognize(context);
+                aResults.at(i) = context.result;
+            });
+        }
+
+        pool.wait();
+    }
+
+    std::chrono::duration<double> totalTime = std::chrono::steady_clock::now() - startTime;
+    return totalTime.count();
+}
+
 void Shapedetector::detectRealtime()
 {
     Mat firstRetrievedFrame;
-    mVidCap.grab();
-    mVidCap.retrieve(firstRetrievedFrame);
-    setImage(firstRetrievedFrame);
+    std::chrono::steady_clock::time_point captureTime;
+    if (mGrabber.acquire(firstRetrievedFrame, captureTime) == false)
+    {
+        std::cout << "Error: no frame captured" << std::endl;
+        return;
+    }
+    setImage(firstRetrievedFrame.clone());
+    mGrabber.release();
 
     draw();
 
-    while (true)
+    // Time from grabbing a frame until its result is known, the stage times are reported on their own
+    LatencyHistogram latencyHistogram;
+    mStageProfile.clear();
+    uint64_t droppedAtStart = mGrabber.droppedCount();
+    uint64_t capturedAtStart = mGrabber.capturedCount();
+    uint64_t frameCopies = 0; // copies of a captured frame before it is detected
+
+    if (mPipelineDepth == 0)
+    {
+        while (acquireFrame(mFrame.originalImage, captureTime))
+        {
+            adoptParameters();
+            addClientQueries();
+
+            // An unchanged scene keeps the result and images of the last detected frame
+            if (mChangeDetector.changed(mFrame.originalImage))
+            {
+                applySliderValues();
+                reset(mFrame);
+                chooseRegions(mFrame);
+                recognize(mFrame);
+                trackShapes(mFrame);
+            }
+            latencyHistogram.add(std::chrono::steady_clock::now() - captureTime);
+            if (mGrabber.frameIntact()) // a shared frame that was overwritten during detection has no valid result
+            {
+                reportResult(mFrame.result);
+            }
+
+            bool keyPressed = showImages(mFrame);
+            mGrabber.release(); // the frame buffer is reused by the capture thread
+            mStageProfile.printPeriodically(std::cout, mStageReportInterval);
+            if (keyPressed)
+            {
+                break;
+            }
+        }
+    }
+    else
     {
-        Mat retrievedFrame;
-        mVidCap.grab();
-        mVidCap.retrieve(retrievedFrame);
-        mOriginalImage = retrievedFrame;
-        reset();
-        recognize();
-        printDetectionData();
+        // Every stage runs on its own thread, up to mPipelineDepth frames are in flight
+        FramePipeline pipeline(*this, mPipelineDepth);
+        bool capturing = true;
+        bool keyPressed = false;
+        Mat capturedFrame;
 
-        bool keyPressed = showImages();
-        if (keyPressed)
+        while (keyPressed == false && (capturing || pipeline.inFlightCount() > 0))
         {
-            break;
+            // Feed the pipeline while it has room
+            FrameContext *freeContext = capturing ? pipeline.freeContext() : nullptr;
+            if (freeContext != nullptr)
+            {
+                adoptParameters(); // the frames in flight keep their snapshot and queries
+                addClientQueries();
+                capturing = acquireFrame(capturedFrame, freeContext->captureTime);
+                if (capturing && mChangeDetector.changed(capturedFrame) == false)
+                {
+                    // An unchanged frame is not detected, the last shown result still holds
+                    if (mHeadless == false)
+                    {
+                        imshow("Original", capturedFrame);
+                        keyPressed = exitKeyPressed(1);
+                    }
+                    mGrabber.release();
+                    pipeline.recycle(freeContext);
+                }
+                else if (capturing)
+                {
+                    capturedFrame.copyTo(freeContext->originalImage); // the ring buffer is released right away
+                    frameCopies++;
+                    mGrabber.release();
+                    applySliderValues();
+                    reset(*freeContext);
+                    // The regions come from the last finished frame, up to the pipeline depth behind
+                    chooseRegions(*freeContext);
+                    pipeline.push(freeContext);
+                }
+                else
+                {
+                    pipeline.recycle(freeContext);
+                }
+                continue;
+            }
+
+            // Show the oldest finished frame
+            FrameContext *finishedContext = pipeline.waitFinished();
+            trackShapes(*finishedContext);
+            latencyHistogram.add(std::chrono::steady_clock::now() - finishedContext->captureTime);
+            reportResult(finishedContext->result);
+            keyPressed = showImages(*finishedContext);
+            pipeline.recycle(finishedContext);
+            mStageProfile.printPeriodically(std::cout, mStageReportInterval);
         }
     }
+
+    latencyHistogram.print(std::cout, "Capture to result latency");
+    mStageProfile.print(std::cout);
+    if (mChangeDetector.enabled())
+    {
+        std::cout << "Unchanged frames: " << mChangeDetector.unchangedCount() << " of " << mChangeDetector.frameCount()
+                  << " served from the previous result" << std::endl;
+    }
+    if (mTracker.enabled())
+    {
+        std::cout << "Processed pixels: " << std::fixed << std::setprecision(1) << (100.0 * mTracker.processedFraction()) << "% ("
+                  << mTracker.keyframeCount() << " keyframes in " << mTracker.frameCount() << " frames)" << std::endl;
+    }
+    if (mGrabber.isFile())
+    {
+        // Decoding runs ahead on the capture thread, the capture stage above is only the wait for it
+        mGrabber.decodeHistogram().printSummary(std::cout, "Decode");
+        std::cout << "Read-ahead empty: " << mGrabber.starvedCount() << " of " << mGrabber.capturedCount()
+                  << " frames waited for the decoder" << std::endl;
+    }
+    if (mGrabber.isShared())
+    {
+        std::cout << "Shared frames overwritten during detection: " << mGrabber.tornCount() << std::endl;
+    }
+    std::cout << "Frame copies before detection: " << frameCopies << " in " << (mGrabber.capturedCount() - capturedAtStart) << " frames" << std::endl;
+    std::cout << "Dropped frames: " << (mGrabber.droppedCount() - droppedAtStart) << std::endl;
+}
+
+void Shapedetector::setCaptureOptions(size_t aRingSize, CapturePolicy aPolicy)
+{
+    mGrabber.configure(aRingSize, aPolicy);
+}
+
+void Shapedetector::setPipelineDepth(size_t aPipelineDepth)
+{
+    mPipelineDepth = aPipelineDepth;
+}
+
+void Shapedetector::setTracking(size_t aKeyframeInterval)
+{
+    mKeyframeInterval = aKeyframeInterval;
+    mTracker.configure(aKeyframeInterval, mTrackPadding);
 }
 
-void Shapedetector::initCamera(int cameraId)
+void Shapedetector::setChangeThreshold(double aThreshold)
 {
-    mVidCap.open(cameraId);
+    mChangeDetector.configure(aThreshold);
+}
 
-    if (mVidCap.isOpened() == false)
+void Shapedetector::trackShapes(const FrameContext &aContext)
+{
+    mTrackedBoxes.clear();
+    for (const LabeledShape &shape : aContext.result.shapes)
     {
-        std::cout << "Error: video capture not opened" << std::endl;
+        mTrackedBoxes.push_back(shape.boundingBox);
+    }
+    mTracker.update(aContext.keyframe, aContext.regions, mTrackedBoxes, aContext.result.processedFraction);
+}
+
+void Shapedetector::chooseRegions(FrameContext &aContext)
+{
+    mTracker.nextRegions(aContext.originalImage.size(), aContext.regions);
+    aContext.keyframe = aContext.regions.empty();
+    aContext.fullFrame = aContext.keyframe;
+}
+
+void Shapedetector::setHeadless(bool aHeadless)
+{
+    mHeadless = aHeadless;
+}
+
+void Shapedetector::setPyramidLevels(int aPyramidLevels)
+{
+    mPyramidLevels = aPyramidLevels;
+}
+
+bool Shapedetector::setResultOutput(const std::string &aTarget, SinkFormat aFormat)
+{
+    return mResultSink.open(aTarget, aFormat);
+}
+
+bool Shapedetector::setResultServer(const std::string &aAddress)
+{
+    return mResultServer.open(aAddress);
+}
+
+void Shapedetector::setProfile(const std::string &aProfilePath)
+{
+    mProfilePath = aProfilePath;
+}
+
+void Shapedetector::setProfileWatching(bool aWatch)
+{
+    mWatchProfile = aWatch;
+}
+
+void Shapedetector::watchProfile()
+{
+    if (mWatchProfile == false || mProfilePath.empty())
+    {
+        return;
+    }
+
+    // The watcher thread must not read the members, it starts from a copy of the current settings
+    CalibrationProfile baseProfile;
+    exportProfile(baseProfile);
+    const std::string profilePath = mProfilePath;
+    const int colorLutBits = mColorLutBits;
+    const bool watching = mParameterWatcher.start(profilePath, [this, baseProfile, profilePath, colorLutBits]() {
+        CalibrationProfile profile = baseProfile;
+        if (profile.load(profilePath) == false)
+        {
+            std::cout << "Warning: the current parameters are kept" << std::endl;
+            return;
+        }
+        publishParameters(buildParameters(profile, colorLutBits));
+    });
+
+    if (watching)
+    {
+        std::cout << "Watching the profile (" << mProfilePath << "), it is applied when it is saved" << std::endl;
+    }
+    else
+    {
+        std::cout << "Error: could not watch the profile (" << mProfilePath << ")" << std::endl;
+    }
+}
+
+void Shapedetector::publishParameters(std::unique_ptr<DetectionParameters> aParameters)
+{
+    // A snapshot that was never taken is replaced, only the newest one counts
+    delete mPendingParameters.exchange(aParameters.release());
+}
+
+void Shapedetector::updateParameters()
+{
+    CalibrationProfile profile;
+    exportProfile(profile);
+    mParameters = buildParameters(profile, mColorLutBits);
+}
+
+void Shapedetector::adoptParameters()
+{
+    std::unique_ptr<DetectionParameters> parameters(mPendingParameters.exchange(nullptr));
+    if (parameters == nullptr)
+    {
+        return;
+    }
+
+    // The members follow the snapshot, so the sliders and a later export show the reloaded values
+    const int trackPadding = mTrackPadding;
+    applyProfile(parameters->profile);
+    mParameters = std::move(parameters);
+
+    if (mTrackPadding != trackPadding)
+    {
+        mTracker.configure(mKeyframeInterval, mTrackPadding);
+    }
+    if (mHeadless == false)
+    {
+        cvSetTrackbarPos("Noise\t\t", "Sliders", mNoiseSliderValue);
+        cvSetTrackbarPos("minRatio\t\t", "Sliders", mMinRatioSliderValue);
+        cvSetTrackbarPos("maxRatio\t\t", "Sliders", mMaxRatioSliderValue);
+    }
+    mChangeDetector.invalidate(); // the last result was found with the old parameters
+    std::cout << "Reloaded the profile (" << mProfilePath << ")" << std::endl;
+}
+
+void Shapedetector::setStageReportInterval(double aSeconds)
+{
+    mStageReportInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(aSeconds));
+}
+
+bool Shapedetector::acquireFrame(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime)
+{
+    ScopedStageTimer timer(mStageProfile, Stage::CAPTURE);
+    return mGrabber.acquire(aFrame, aCaptureTime);
+}
+
+void Shapedetector::setColorLut(int aBitsPerChannel)
+{
+    mColorLutBits = aBitsPerChannel;
+    updateParameters();
+}
+
+void Shapedetector::initCamera(const std::string &source)
+{
+    const bool deviceId = source.empty() == false &&
+                          std::all_of(source.begin(), source.end(), [](char aCharacter) { return isdigit((unsigned char)aCharacter) != 0; });
+    bool opened = false;
+    if (deviceId)
+    {
+        opened = mGrabber.open(atoi(source.c_str()));
+    }
+    else if (source.compare(0, SHARED_SOURCE_PREFIX.size(), SHARED_SOURCE_PREFIX) == 0)
+    {
+        opened = mGrabber.openShared(source.substr(SHARED_SOURCE_PREFIX.size()));
+    }
+    else
+    {
+        opened = mGrabber.open(source);
+    }
+    if (opened == false)
+    {
+        std::cout << "Error: video capture not opened (" << source << ")" << std::endl;
         exit(-1);
     }
 }
@@ -420,7 +1126,7 @@ void Shapedetector::calibrateColors()
   const int sliderWidth = 500;
   Mat emptyMatrix = Mat::zeros(1, sliderWidth, CV_8U);
   imshow("Color sliders", emptyMatrix); // put an empty matrix in this window to prevent errors
-  moveWindow("Color sliders", 0, mOriginalImage.rows + 10);
+  moveWindow("Color sliders", 0, mFrame.originalImage.rows + 10);
 
   Mat retrievedFrame;
   Mat maskedFrame;
@@ -441,12 +1147,14 @@ void Shapedetector::calibrateColors()
     std::cout << "Calibrating " << COLORSTRINGS.at(i) << " colors." << std::endl;
     while (true) // Escape pressed
     {
-      // Capture frame
-      if (mVidCap.isOpened())
+      // Capture frame, a file is calibrated on its first frame instead of playing it away
+      Mat capturedFrame;
+      std::chrono::steady_clock::time_point captureTime;
+      if ((mGrabber.isFile() == false || retrievedFrame.empty()) && mGrabber.acquire(capturedFrame, captureTime))
       {
-        mVidCap.grab();
-        mVidCap.retrieve(retrievedFrame);
+        capturedFrame.copyTo(retrievedFrame);
       }
+      mGrabber.release();
       
       minCalibrationValues = Scalar(mMinCalibrationHue, mMinCalibrationSaturation, mMinCalibrationValue);
       maxCalibrationValues = Scalar(mMaxCalibrationHue, mMaxCalibrationSaturation, mMaxCalibrationValue);
@@ -465,6 +1173,12 @@ void Shapedetector::calibrateColors()
     saveColorValues(currentColor, minCalibrationValues, maxCalibrationValues);
   }
   destroyAllWindows();
+
+  // Detection starts at the first frame of a file, the calibration frame included
+  if (mGrabber.isFile() && mGrabber.rewind() == false)
+  {
+    std::cout << "Error: could not rewind the video after calibration" << std::endl;
+  }
 }
 
 void Shapedetector::setCurrentSliderValues(Scalar minCalibrationValues, Scalar maxCalibrationValues)
@@ -547,4 +1261,103 @@ void Shapedetector::saveColorValues(COLORS aColor, Scalar aMinScalar, Scalar aMa
       case (COLORS::UNKNOWNCOLOR):
         break;
     }
+
+  // The snapshot holds the old limits
+  updateParameters();
+}
+
+bool Shapedetector::prepareColors()
+{
+  if (mProfilePath.empty())
+  {
+    std::cout << "Calibrate colors" << std::endl;
+    calibrateColors();
+    return true;
+  }
+
+  if (fileExists(mProfilePath))
+  {
+    return loadProfile();
+  }
+
+  // The first start calibrates, every later start loads the profile
+  std::cout << "Calibrate colors, they are saved to the profile (" << mProfilePath << ")" << std::endl;
+  calibrateColors();
+  CalibrationProfile profile;
+  exportProfile(profile);
+  if (profile.save(mProfilePath) == false)
+  {
+    std::cout << "Error: could not save the profile (" << mProfilePath << ")" << std::endl;
+  }
+  return true;
+}
+
+bool Shapedetector::loadProfile()
+{
+  const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+  CalibrationProfile profile;
+  exportProfile(profile);
+  if (profile.load(mProfilePath) == false)
+  {
+    return false;
+  }
+  importProfile(profile);
+
+  const std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - startTime;
+  std::cout << "Loaded profile (" << mProfilePath << ") in " << std::fixed << std::setprecision(2) << loadTime.count() << " ms" << std::endl;
+  return true;
+}
+
+void Shapedetector::exportProfile(CalibrationProfile &aProfile) const
+{
+  std::copy(mRedLimits, mRedLimits + 4, aProfile.redLimits);
+  std::copy(mGreenLimits, mGreenLimits + 2, aProfile.greenLimits);
+  std::copy(mBlueLimits, mBlueLimits + 2, aProfile.blueLimits);
+  std::copy(mBlackLimits, mBlackLimits + 2, aProfile.blackLimits);
+  std::copy(mYellowLimits, mYellowLimits + 2, aProfile.yellowLimits);
+  std::copy(mWhiteLimits, mWhiteLimits + 2, aProfile.whiteLimits);
+
+  aProfile.noiseKernelSize = mNoiseSliderValue;
+  aProfile.minSquareRatio = mMinRatioSliderValue / 100.0;
+  aProfile.maxSquareRatio = mMaxRatioSliderValue / 100.0;
+
+  aProfile.contourCenterMargin = mContourCenterMargin;
+  aProfile.trackPadding = mTrackPadding;
+  aProfile.epsilonMultiply = mEpsilonMultiply;
+  aProfile.minContourSize = mMinContourSize;
+  aProfile.maxContourSize = mMaxContourSize;
+  aProfile.minHalfCirclePercentage = mMinHalfCirclePercentage;
+  aProfile.maxHalfCirclePercentage = mMaxHalfCirclePercentage;
+}
+
+void Shapedetector::importProfile(const CalibrationProfile &aProfile)
+{
+  applyProfile(aProfile);
+
+  // The snapshot holds the old settings
+  updateParameters();
+}
+
+void Shapedetector::applyProfile(const CalibrationProfile &aProfile)
+{
+  std::copy(aProfile.redLimits, aProfile.redLimits + 4, mRedLimits);
+  std::copy(aProfile.greenLimits, aProfile.greenLimits + 2, mGreenLimits);
+  std::copy(aProfile.blueLimits, aProfile.blueLimits + 2, mBlueLimits);
+  std::copy(aProfile.blackLimits, aProfile.blackLimits + 2, mBlackLimits);
+  std::copy(aProfile.yellowLimits, aProfile.yellowLimits + 2, mYellowLimits);
+  std::copy(aProfile.whiteLimits, aProfile.whiteLimits + 2, mWhiteLimits);
+
+  // The ratios are slider values, applySliderValues derives the ratios from them
+  mNoiseSliderValue = std::min(std::max(0, aProfile.noiseKernelSize), mNoiseSliderRange);
+  mMinRatioSliderValue = std::min(std::max(0, (int)std::lround(aProfile.minSquareRatio * 100.0)), mMinRatioSliderRange);
+  mMaxRatioSliderValue = std::min(std::max(0, (int)std::lround(aProfile.maxSquareRatio * 100.0)), mMaxRatioSliderRange);
+  applySliderValues();
+
+  mContourCenterMargin = aProfile.contourCenterMargin;
+  mTrackPadding = aProfile.trackPadding;
+  mEpsilonMultiply = aProfile.epsilonMultiply;
+  mMinContourSize = aProfile.minContourSize;
+  mMaxContourSize = aProfile.maxContourSize;
+  mMinHalfCirclePercentage = aProfile.minHalfCirclePercentage;
+  mMaxHalfCirclePercentage = aProfile.maxHalfCirclePercentage;
 }
\ No newline at end of file
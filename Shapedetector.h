@@ -5,15 +5,34 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <ctime>
+#include <cmath>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 // Local
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
+#include "BlobLabeler.h"
+#include "CalibrationProfile.h"
+#include "ChangeDetector.h"
+#include "ColorKernel.h"
+#include "ContourFeatures.h"
+#include "ColorLut.h"
+#include "FrameGrabber.h"
+#include "SpatialGrid.h"
+#include "LatencyHistogram.h"
+#include "StageTimer.h"
+#include "RegionTracker.h"
+#include "ResultSink.h"
+#include "ResultServer.h"
+#include "ParameterWatcher.h"
+#include "BitMask.h"
 
 // Namespace
 using namespace cv;
@@ -27,6 +46,26 @@ const std::string EXIT_COMMAND = "exit";
 const int INTERACTIVE_ARGCOUNT = 2;
 const int BATCH_ARGCOUNT = 3;
 const char COMMENT_CHARACTER = '#';
+const std::string IMAGES_OPTION = "--images";
+const std::string BATCH_OPTION = "--batch";
+const std::string THREADS_OPTION = "--threads";
+const std::string SCALING_OPTION = "--scaling";
+const std::string CAPTURE_POLICY_OPTION = "--capture-policy";
+const std::string RING_SIZE_OPTION = "--ring-size";
+const std::string PIPELINE_DEPTH_OPTION = "--pipeline-depth";
+const std::string COLOR_LUT_OPTION = "--color-lut";
+const std::string TRACK_INTERVAL_OPTION = "--track-interval";
+const std::string CHANGE_THRESHOLD_OPTION = "--change-threshold";
+const std::string PYRAMID_LEVELS_OPTION = "--pyramid-levels";
+const std::string STAGE_REPORT_OPTION = "--stage-report";
+const std::string OUTPUT_OPTION = "--output";
+const std::string OUTPUT_FORMAT_OPTION = "--output-format";
+const std::string PROFILE_OPTION = "--profile";
+const std::string WATCH_PROFILE_OPTION = "--watch-profile";
+const std::string SHARED_SOURCE_PREFIX = "shm:";
+const std::string SERVE_OPTION = "--serve";
+const std::string PUBLISH_OPTION = "--publish";
+const size_t PUBLISH_SLOT_COUNT = 8; // frames in a published ring, a reader has this many frame times to detect one
 
 // Enums
 enum SHAPES
@@ -178,6 +217,116 @@ inline bool fileExists(const std::string &aFilePath)
   return f.good();
 }
 
+/**
+ * @brief A shape/color command that is evaluated on every frame
+ */
+struct ShapeQuery
+{
+  std::string command; // the original command text
+  SHAPES shape;
+  COLORS color;
+};
+
+/**
+ * @brief A shape found for one of the queries
+ */
+struct ShapeDetection
+{
+  size_t queryIndex;
+  SHAPES shape; // the label of the shape, a query can match several
+  COLORS color;
+  Point center;
+  int area;
+};
+
+/**
+ * @brief A contour of an allowed size with the shape it was classified as
+ */
+struct LabeledShape
+{
+  COLORS color;
+  SHAPES shape;        // UNKNOWNSHAPE when it has no known shape
+  size_t colorIndex;   // index in the requested colors of the frame
+  size_t contourIndex; // index in the contours of that color
+  Rect boundingBox;
+  Point center;
+  int area;
+};
+
+/**
+ * @brief The detection results of a single frame
+ */
+struct FrameResult
+{
+  std::shared_ptr<const std::vector<ShapeQuery>> queries; // the queries of the frame, taken when it was reset
+  std::vector<int> shapeCounts; // one count per query
+  std::vector<LabeledShape> shapes; // every contour of an allowed size, labeled once
+  std::vector<ShapeDetection> detections;
+  double processedFraction; // the fraction of the frame in the processed regions
+  double detectionTime; // wall-clock milliseconds from the color filter to the classified shapes
+  bool decoded; // false when the frame could not be loaded
+};
+
+/**
+ * @brief The slider controlled settings, copied into every frame when it is reset
+ */
+struct FrameSettings
+{
+  int noiseKernelSize;
+  double minSquareRatio;
+  double maxSquareRatio;
+};
+
+/**
+ * @brief An immutable snapshot of the detection parameters and the tables derived from them
+ *
+ * A frame takes the current snapshot when it is reset and reads only that
+ * one, so a new snapshot can be swapped in between frames while older
+ * frames are still in flight. The old snapshot is freed with its last frame.
+ */
+struct DetectionParameters
+{
+  CalibrationProfile profile;
+  std::vector<std::vector<ColorRange>> colorRanges; // the ranges of every color, indexed by COLORS
+  ColorLut colorLut; // empty when the fused kernel makes the color masks
+};
+
+/**
+ * @brief The working state of a single frame, one context per thread or pipeline slot
+ *
+ * Every buffer of the detection lives here and keeps its storage between
+ * frames: once a frame of the same size was detected, the next one does
+ * not allocate.
+ */
+struct FrameContext
+{
+  Mat originalImage; // original
+  Mat maskImage;     // color filtered image
+  Mat displayImage;  // image with shape outlines
+  std::vector<Point> approxPoints; // the approximated polygon of a contour
+  bool keyframe;                             // the frame is searched completely, not only around tracked shapes
+  bool fullFrame;                            // every pixel is processed, else only the regions
+  std::vector<Rect> regions;                 // the parts of the frame to process when not the full frame
+  Mat coarseImage;                           // the frame at the pyramid level the candidates are found at
+  std::vector<BitMask> coarseMasks;          // one coarse mask per requested color
+  std::vector<COLORS> colors;                // the requested colors
+  std::vector<std::vector<ColorRange>> colorRanges; // the ranges per requested color
+  std::vector<size_t> colorBits;             // the lookup table bit per requested color
+  std::vector<BitMask> colorMasks;           // one packed mask per requested color
+  BitMask scratchMask;                       // the part of a mask inside one region, or the union of the masks to show
+  std::vector<std::vector<Mat>> contours;    // the contours per requested color, headers on the contour points
+  std::vector<std::vector<Point>> contourPoints; // the points of all contours per requested color
+  std::vector<size_t> contourSizes;          // the number of points per contour of the color being traced
+  std::vector<ContourFeatures> features;     // the features of the contours per requested color
+  BlobLabeler labeler;                       // labels the blobs of the masks, keeps its storage
+  SpatialGrid centerGrid;                    // finds contours with close centers, keeps its storage
+  FrameSettings settings;
+  std::shared_ptr<const DetectionParameters> parameters; // the snapshot taken when the frame was reset
+  std::chrono::steady_clock::time_point captureTime;
+  std::chrono::steady_clock::time_point detectionStart; // set by the color filter
+  FrameResult result;
+};
+
 /**
  * @brief Shapedetector class
  */
@@ -188,29 +337,86 @@ public:
   ~Shapedetector();
 
   /**
-   * @brief Reset the images to the new captured image
+   * @brief Reset the context to its newly captured image
+   * @param aContext The frame context to reset
    */
-  void reset();
+  void reset(FrameContext &aContext) const;
   /**
    * @brief Draw the data on the result image
    */
   void draw();
   /**
-   * @brief Recognize the requested shape
+   * @brief Recognize the requested shapes, only the context is modified
+   * @param aContext The frame context to detect in
+   */
+  void recognize(FrameContext &aContext) const;
+
+  // Detection stages, recognize runs them in this order
+
+  /**
+   * @brief Stage 1: build a mask for every requested color
+   * @param aContext The frame context to detect in
+   */
+  void filterColors(FrameContext &aContext) const;
+  /**
+   * @brief Stage 2: remove the noise from every color mask
+   * @param aContext The frame context to detect in
+   */
+  void filterNoise(FrameContext &aContext) const;
+  /**
+   * @brief Stage 3: find the contours in every color mask
+   * @param aContext The frame context to detect in
    */
-  void recognize();
+  void findShapeContours(FrameContext &aContext) const;
+  /**
+   * @brief Stage 4: sort the contours into the queries
+   * @param aContext The frame context to detect in
+   */
+  void classifyShapes(FrameContext &aContext) const;
+  /**
+   * @brief Stage 5: draw the found shapes and the results on the display image, nothing when headless
+   * @param aContext The frame context to draw on
+   */
+  void drawShapes(FrameContext &aContext) const;
+  /**
+   * @brief Constrain the slider values and apply them to the settings
+   */
+  void applySliderValues();
 
   /**
    * @brief Function for handling the webcam mode
-   * @param deviceId The webcam device Id
+   * @param source The webcam device Id, a video file or an image sequence
    */
-  void webcamMode(int deviceId);
+  void webcamMode(const std::string &source);
   /**
    * @brief Function for handling the batch mode
-   * @param cameraId The camera device id
+   * @param source The camera device id, a video file or an image sequence
+   * @param batchPath The path to the batch file to use
+   */
+  void batchMode(const std::string &source, std::string batchPath);
+  /**
+   * @brief Function for handling the publish mode, the capture process of detectors that read a shared memory ring
+   * @param source The camera device id, a video file or an image sequence
+   * @param ringName The name of the shared memory ring to create, such as /shapedetector
+   */
+  void publishMode(const std::string &source, const std::string &ringName);
+  /**
+   * @brief Function for handling the headless image mode, no windows are used
+   * @param imagesPath A directory or glob pattern of the images to process
    * @param batchPath The path to the batch file to use
+   * @param threadCount The number of worker threads
+   * @param reportScaling Whether to measure the throughput for 1 up to threadCount threads
    */
-  void batchMode(int cameraId, std::string batchPath);
+  void imagesMode(const std::string &imagesPath, const std::string &batchPath, size_t threadCount, bool reportScaling);
+
+  /**
+   * @brief Decode and detect a list of images on a work-stealing thread pool
+   * @param aImagePaths The images to process
+   * @param aThreadCount The number of worker threads
+   * @param aResults The results, in the order of the image paths
+   * @return double The wall-clock time in seconds
+   */
+  double processImages(const std::vector<std::string> &aImagePaths, size_t aThreadCount, std::vector<FrameResult> &aResults) const;
 
   /**
    * @brief Set the image to use for recognicion
@@ -219,23 +425,53 @@ public:
   void setImage(Mat aImage);
 
   /**
-   * @brief Shows the images
+   * @brief Shows the images of a frame
+   * @param aContext The frame to show
    * @return if the exit key was pressed
    */
-  bool showImages();
+  bool showImages(const FrameContext &aContext);
 
   /**
-   * @brief Parses the current specification
+   * @brief Wait for a key and close the windows on the exit key
+   * @param aDelay The time to wait in milliseconds
+   * @return if the exit key was pressed
+   */
+  static bool exitKeyPressed(int aDelay);
+
+  /**
+   * @brief Parses the current specification and makes it the only active query
    * @param aShapeCommand The command to parse
    * @return if the parsing was successful
    */
   bool parseSpec(const std::string &aShapeCommand);
 
   /**
-   * @brief Open the camera to make it ready for capturing
-   * @param cameraId The id of the camera
+   * @brief Parses a specification and adds it to the active queries
+   * @param aShapeCommand The command to parse
+   * @return if the parsing was successful
    */
-  void initCamera(int cameraId);
+  bool addSpec(const std::string &aShapeCommand);
+
+  /**
+   * @brief Parses a single shape command
+   * @param aShapeCommand The command to parse
+   * @param aQuery The query to store the parsed command in
+   * @return if the parsing was successful
+   */
+  static bool parseQuery(const std::string &aShapeCommand, ShapeQuery &aQuery);
+
+  /**
+   * @brief Loads all commands from a batch file as active queries
+   * @param aBatchPath The path to the batch file
+   * @return if at least one valid command was loaded
+   */
+  bool loadBatch(const std::string &aBatchPath);
+
+  /**
+   * @brief Open the camera or file to make it ready for capturing
+   * @param source A number is the id of a camera, "shm:<name>" a shared memory ring, else a video file or image sequence (frames/%04d.png)
+   */
+  void initCamera(const std::string &source);
 
   /**
    * @brief Calibrate the color ranges
@@ -260,6 +496,50 @@ public:
    */
   void saveColorValues(COLORS aColor, Scalar aMinScalar, Scalar aMaxScalar);
 
+  /**
+   * @brief Load the calibration profile, or calibrate the colors and save them to the profile when it does not exist
+   * @return false when the profile could not be loaded
+   */
+  bool prepareColors();
+
+  /**
+   * @brief Load the calibration profile, the settings it does not have keep their value
+   * @return whether the profile was loaded
+   */
+  bool loadProfile();
+
+  /**
+   * @brief Copy the color limits and the detection settings to a profile
+   * @param aProfile The profile to fill
+   */
+  void exportProfile(CalibrationProfile &aProfile) const;
+
+  /**
+   * @brief Take the color limits and the detection settings of a profile
+   * @param aProfile The profile to apply
+   */
+  void importProfile(const CalibrationProfile &aProfile);
+
+  /**
+   * @brief Reload the profile on the watcher thread whenever it is written, the live loops swap it in between frames
+   * @param aWatch true to watch the profile, it must be set with setProfile
+   */
+  void setProfileWatching(bool aWatch);
+
+  /**
+   * @brief Hand a parameter snapshot to the frame loop, it is taken before the next frame, from any thread
+   * @param aParameters The new snapshot, replaces a snapshot that was not taken yet
+   */
+  void publishParameters(std::unique_ptr<DetectionParameters> aParameters);
+
+  /**
+   * @brief Build a parameter snapshot with its color ranges and lookup table, from any thread
+   * @param aProfile The parameters
+   * @param aColorLutBits The quantization of the lookup table, 0 for none
+   * @return the snapshot
+   */
+  static std::unique_ptr<DetectionParameters> buildParameters(const CalibrationProfile &aProfile, int aColorLutBits);
+
   /**
    * @brief Set the Current Slider Values
    * 
@@ -274,9 +554,79 @@ public:
   void detectRealtime();
 
   /**
-   * @brief The capture object for handling the webcam
+   * @brief Set how frames are captured, must be called before initCamera
+   * @param aRingSize The number of preallocated frame buffers
+   * @param aPolicy Whether the latest or every frame is processed
+   */
+  void setCaptureOptions(size_t aRingSize, CapturePolicy aPolicy);
+
+  /**
+   * @brief Set the number of frames in flight in the stage pipeline of the live loop
+   * @param aPipelineDepth The pipeline depth, 0 runs every stage on the main thread
+   */
+  void setPipelineDepth(size_t aPipelineDepth);
+
+  /**
+   * @brief Classify the colors with a lookup table instead of the fused kernel
+   * @param aBitsPerChannel The quantization of the table, 0 uses the fused kernel
    */
-  VideoCapture mVidCap;
+  void setColorLut(int aBitsPerChannel);
+
+  /**
+   * @brief Only process the regions around the shapes of the previous frame between keyframes
+   * @param aKeyframeInterval The number of frames from one full frame to the next, 0 processes every full frame
+   */
+  void setTracking(size_t aKeyframeInterval);
+
+  /**
+   * @brief Skip the detection of live frames that hardly differ from the last detected frame
+   * @param aThreshold The mean absolute grey difference of a 32x32 block that counts as a change, 0 detects every frame
+   */
+  void setChangeThreshold(double aThreshold);
+
+  /**
+   * @brief Skip all drawing on the display image, for frames that are never shown; the live modes open no windows
+   * @param aHeadless true to skip the drawing
+   */
+  void setHeadless(bool aHeadless);
+
+  /**
+   * @brief Find candidate regions on a smaller pyramid level first, then detect only those at full resolution
+   * @param aPyramidLevels The number of times the frame is halved, 0 detects on the full frame
+   */
+  void setPyramidLevels(int aPyramidLevels);
+
+  /**
+   * @brief Set how often the live modes print the time histogram of every stage, it is always printed at exit
+   * @param aSeconds The time between two reports, 0 only reports at exit
+   */
+  void setStageReportInterval(double aSeconds);
+
+  /**
+   * @brief Write the results to an output from a background thread instead of printing them
+   * @param aTarget "-" for the standard output, "unix:<path>" for a Unix socket, else a file or named pipe
+   * @param aFormat The format of the records
+   * @return whether the output was opened
+   */
+  bool setResultOutput(const std::string &aTarget, SinkFormat aFormat);
+
+  /**
+   * @brief Serve the newest result of the live modes to local clients, which can also add queries
+   * @param aAddress "unix:<path>" for a Unix socket, "tcp:<port>" for a TCP port on localhost
+   * @return whether the server listens
+   */
+  bool setResultServer(const std::string &aAddress);
+
+  /**
+   * @brief Use a calibration profile instead of calibrating on every start
+   * @param aProfilePath The profile to load, the live modes calibrate once and save it when it does not exist
+   */
+  void setProfile(const std::string &aProfilePath);
+
+  /**
+   * @brief The capture thread and frame ring for handling the webcam
+   */
+  FrameGrabber mGrabber;
 
   /**
      * @brief Handles a single shape command
@@ -285,22 +635,35 @@ public:
   void handleShapeCommand(const std::string &aShapeCommand);
 
   // Image matrices to show
-  Mat mOriginalImage;      // original
+  FrameContext mFrame;     // original, color filtered image and image with shape outlines
   Mat mBrightenedRgbImage; // brightness image
   Mat mBlurredImage;       // blurred image
-  Mat mMaskImage;          // color filtered image
-  Mat mDisplayImage;       // image with shape outlines
 
 private:
   // Program variables
   std::string mImagePath;
-  std::string mCurrentShapeCommand;
+  bool mHeadless; // skip all drawing on the display image
+  size_t mPipelineDepth;
+  int mColorLutBits; // 0 when the fused kernel makes the color masks
+  std::shared_ptr<const DetectionParameters> mParameters; // the snapshot new frames take, main thread only
+  std::atomic<DetectionParameters *> mPendingParameters; // a published snapshot that was not taken yet, owned
+  ParameterWatcher mParameterWatcher; // reloads the profile when it is written
+  bool mWatchProfile;
+  RegionTracker mTracker; // chooses the regions of the live frames
+  size_t mKeyframeInterval;
+  std::vector<Rect> mTrackedBoxes; // the shape boxes given to the tracker, kept for their storage
+  ChangeDetector mChangeDetector; // finds the live frames that need no detection
+  int mPyramidLevels; // 0 when the full frame is detected at full resolution
+  mutable StageProfile mStageProfile; // the time of every stage, added to by the const detection stages
+  std::chrono::steady_clock::duration mStageReportInterval; // zero only reports at exit
+  ResultSink mResultSink; // writes the results when an output is set, else they are printed
+  ResultServer mResultServer; // serves the newest result when an address is set
+  std::string mServerRecord; // the record served for the last frame, kept for its storage
+  uint64_t mReportedFrames; // the id of the next reported frame
+  std::string mProfilePath; // empty when the colors are calibrated on every start
 
   // Image matrices
-  Mat mHSVImage;
   Mat mGreyImage;
-  Mat mTresholdImage;
-  Mat mApproxImage;
 
   // Slider values
   int mBlurSliderValue;
@@ -328,25 +691,13 @@ private:
   int mCalibrationSaturationRange;
   int mCalibrationValueRange;
 
-  // Current command values
-  COLORS mCurrentColor;
-  SHAPES mCurrentShape;
-
-  // Calculation values
-  Mat mCurrentMask;
-  std::vector<Mat> mCurrentContours;
-  Moments mCurrentMoments;
-
-  // Shapecounter
-  int mCurrentShapeCount;
+  // Active queries, all evaluated on the same frame; a frame keeps the list it was reset with
+  std::shared_ptr<const std::vector<ShapeQuery>> mQueries;
+  std::vector<ShapeQuery> mClientQueries; // added by the clients of the result server, kept when a typed command replaces the others
 
   // Blur variables
   Size mGaussianKernelsize;
 
-  // Timer variables
-  std::clock_t mClockStart;
-  std::clock_t mClockEnd;
-
   // Time position
   int mTimeXOffset;
   int mTimeYOffset;
@@ -364,11 +715,12 @@ private:
   int mMinTreshold;
   int mMaxTreshold;
   ThresholdTypes mTresholdType;
-  double mMinSquareRatio;
+  double mMinSquareRatio; // only read by applySliderValues and reset
   double mMaxSquareRatio;
 
   // Contour settings
   int mContourCenterMargin;
+  int mTrackPadding; // pixels around a tracked shape that are processed
   double mEpsilonMultiply;
   double mMinContourSize;
   double mMaxContourSize;
@@ -389,82 +741,143 @@ private:
   void initializeValues();
 
   /**
- * @brief Detect a color in an image
- * @param aColor the color to detect
- * @return Mat a Mask with the current color filter
- */
-  Mat detectColor(COLORS aColor, Mat aImage);
+   * @brief Get the ranges that make up a color
+   * @param aProfile the color limits
+   * @param aColor the color
+   * @param aRanges the ranges, a pixel inside any of them has the color
+   */
+  static void colorRanges(const CalibrationProfile &aProfile, COLORS aColor, std::vector<ColorRange> &aRanges);
 
   /**
-     * @brief Detect a shape in an image
-     * @param aShape the shape to detect
-     * @return std::vector<Mat> The contours of the found shapes
-     */
-  std::vector<Mat> detectShape(SHAPES aShape, Mat aShapeMask);
+   * @brief Build a new snapshot from the current settings, the next frame takes it
+   */
+  void updateParameters();
 
   /**
-   * @brief finds the squares in an image
-   * @param aContours the contours in the image
+   * @brief Take a published snapshot and its settings, called by the live loops between frames
    */
-  void detectSquares(std::vector<Mat> aContours);
+  void adoptParameters();
 
   /**
-   * @brief finds the rectangles in an image
-   * @param aContours the contours in the image
+   * @brief Set the color limits and the detection settings of a profile, without building a snapshot
+   * @param aProfile The profile to apply
    */
-  void detectRectangles(std::vector<Mat> aContours);
+  void applyProfile(const CalibrationProfile &aProfile);
 
   /**
-   * @brief finds the triangles in an image
-   * @param aContours the contours in the image
+   * @brief Start the profile watcher when it is enabled
    */
-  void detectTriangles(std::vector<Mat> aContours);
+  void watchProfile();
 
   /**
-   * @brief finds the circles in an image
-   * @param aContours the contours in the image
+   * @brief Give the shapes of a finished live frame to the region tracker
+   * @param aContext The finished frame
    */
-  void detectCircles(std::vector<Mat> aContours);
+  void trackShapes(const FrameContext &aContext);
 
   /**
-   * @brief Checks whether the contour is within the min and max contourSize
-   * @param aContour the contour to check
-   * @return whether the contour is within the range
+   * @brief Let the region tracker choose what part of a live frame is processed
+   * @param aContext The frame, after it was reset
+   */
+  void chooseRegions(FrameContext &aContext);
+
+  /**
+   * @brief Threshold an image against the requested colors, with the lookup table or the fused kernel
+   * @param aContext The frame context with the ranges and table bits of the requested colors
+   * @param aImage The image
+   * @param aOffset The position of the image in the masks, when it is a region of the frame
+   * @param aMasks The masks, one per color, already created
    */
-  bool contourSizeAllowed(Mat aContour) const;
+  void thresholdColors(const FrameContext &aContext, const Mat &aImage, Point aOffset, std::vector<BitMask> &aMasks) const;
 
   /**
-   * @brief finds the halfcircles in an image
-   * @param aContours the contours in the image
+   * @brief Find the regions that can hold a shape of an allowed size on a smaller pyramid level
+   * @param aContext The frame context, its regions are set
    */
-  void detectHalfCircles(std::vector<Mat> aContours);
+  void findCandidateRegions(FrameContext &aContext) const;
 
   /**
-   * @brief finds the halfcircles in an image using the houghcircles algorithm
-   * @param aContours the contours in the image
+   * @brief Get the distinct colors of the queries of a frame
+   * @param aQueries the queries of the frame
+   * @param aColors every requested color once
    */
-  void detectHalfCirclesHough(std::vector<Mat> aContours);
+  static void requestedColors(const std::vector<ShapeQuery> &aQueries, std::vector<COLORS> &aColors);
 
   /**
-   * @brief Set the shape command in the image
-   * @param aImage the image to set the command in
+   * @brief Add the queries the clients of the result server sent, called by the live loops between frames
    */
-  void setShapeCommand(Mat aImage);
+  void addClientQueries();
 
   /**
-     * @brief Set the X/Y/Area in the center of the shape
-     * @param aImage The image to set the values on
-     * @param aContour The contour to place the values in
+   * @brief Add a query to the active queries, unless one for the same shape and color is active
+   * @param aQuery the query to add
+   * @return whether it was added
+   */
+  bool appendQuery(const ShapeQuery &aQuery);
+
+  /**
+     * @brief Label every contour of an allowed size of one color with its shape
+     * @param aColorIndex the index of the color in the requested colors
+     * @param aFeatures the features of the contours found in the mask of the color
+     * @param aContext the frame context to add the labeled shapes to
      */
-  void setShapeValues(Mat aImage, Mat aContour);
+  void labelShapes(size_t aColorIndex, const ContourFeatures &aFeatures, FrameContext &aContext) const;
+
+  /**
+   * @brief Classify a contour as the one shape it matches
+   * @param aFeatures the features of the contours
+   * @param aIndex the index of the contour to classify
+   * @param aContext the frame context with the settings and parameters of the frame
+   * @return the shape, UNKNOWNSHAPE when it matches none
+   */
+  SHAPES classifyShape(const ContourFeatures &aFeatures, size_t aIndex, const FrameContext &aContext) const;
+
+  /**
+   * @brief Checks whether a shape label answers a query for a shape
+   * @param aQueryShape the shape of the query
+   * @param aLabel the shape the contour was labeled as
+   * @return whether the query counts the contour
+   */
+  static bool queryMatches(SHAPES aQueryShape, SHAPES aLabel);
+
+  /**
+   * @brief Checks whether the contour is within the min and max contourSize
+   * @param aProfile the parameters of the frame
+   * @param aArea the area of the contour to check
+   * @return whether the contour is within the range
+   */
+  static bool contourSizeAllowed(const CalibrationProfile &aProfile, double aArea);
+
+  /**
+   * @brief Checks whether the contour of a blob can be within the min and max contourSize,
+   *        without tracing it
+   * @param aProfile the parameters of the frame
+   * @param aBlob the blob to check
+   * @return false when the contour is certainly outside the range
+   */
+  static bool blobSizePossible(const CalibrationProfile &aProfile, const Blob &aBlob);
+
+  /**
+   * @brief Set the shape commands in the image
+   * @param aImage the image to set the commands in
+   * @param aQueries the queries of the frame
+   */
+  void setShapeCommand(Mat aImage, const std::vector<ShapeQuery> &aQueries) const;
+
+  /**
+     * @brief Store the X/Y/Area of the shape, they are printed once the frame is done
+     * @param aContext The frame context to store the values in
+     * @param aShape The shape to place the values of
+     * @param aQueryIndex The query the shape was found for
+     */
+  void setShapeValues(FrameContext &aContext, const LabeledShape &aShape, size_t aQueryIndex) const;
 
   /**
      * @brief Set the Time in the image
      * @param aImage The image to set the time in
-     * @param aStartTime The start time
-     * @param aEndTime The end time
+     * @param aMilliseconds The detection time in milliseconds
      */
-  void setTimeValue(Mat aImage, std::clock_t aStartTime, std::clock_t aEndTime);
+  void setTimeValue(Mat aImage, double aMilliseconds) const;
 
   /**
      * @brief Draws the contours of a shape
@@ -474,21 +887,28 @@ private:
   static void drawShapeContours(Mat aImage, Mat aContour);
 
   /**
-     * @brief Set the count of shapes found
+     * @brief Set the count of shapes found for every query
      * @param aImage the image to set the count on
+     * @param aResult the results of the frame
      */
-  void setShapeFound(Mat aImage);
+  void setShapeFound(Mat aImage, const FrameResult &aResult) const;
 
   /**
-   * @brief Get the center point of a contour
+   * @brief Wait for the next captured frame, timed as the capture stage
+   * @param aFrame The captured frame, valid until the grabber is released
+   * @param aCaptureTime The time the frame was captured
+   * @return false when the capture has stopped
    */
-  static Point getContourCenter(Mat aContour);
+  bool acquireFrame(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime);
 
   /**
-   * @brief remove the shapes where the center point is too close to another shape
+   * @brief remove the shapes where the center point is too close to an earlier shape
    * @param aContours the contours to check
+   * @param aFeatures the features of the contours, kept in step with the contours
+   * @param aGrid the grid to find the close centers with
+   * @param aMargin the distance below which centers are too close
    */
-  void removeCloseShapes(std::vector<Mat> &aContours) const;
+  static void removeCloseShapes(std::vector<Mat> &aContours, ContourFeatures &aFeatures, SpatialGrid &aGrid, int aMargin);
 
   /**
    * @brief Callback for setting the slider values in the program
@@ -496,14 +916,38 @@ private:
   static void onChange(int, void *);
 
   /**
-   * @brief filters the noise from the image
+   * @brief filters the noise from a region of a mask, in place
+   * @param aMask the mask to filter
+   * @param aRegion the region to filter, it is opened as if it were the whole mask
+   * @param aContext the frame context with the scratch mask and the kernel size
    */
-  Mat removeNoise(Mat aImage);
+  void removeNoise(BitMask &aMask, const Rect &aRegion, FrameContext &aContext) const;
 
   /**
    * @brief Print the data from the detection to the console
+   * @param aResult the results of the frame
+   */
+  void printDetectionData(const FrameResult &aResult) const;
+
+  /**
+   * @brief Write the results of a frame to the result output, or print them when there is none
+   * @param aResult the results of the frame
+   */
+  void reportResult(const FrameResult &aResult);
+
+  /**
+   * @brief Serialize the results of a frame in the format of the result output
+   * @param aFrameId The id of the frame, counting from 0
+   * @param aResult the results of the frame
+   * @param aFormat the format of the record
+   * @param aRecord the record to append to
+   */
+  void serializeResult(uint64_t aFrameId, const FrameResult &aResult, SinkFormat aFormat, std::string &aRecord) const;
+
+  /**
+   * @brief Write the remaining results, close the result output and the result server and print their counts
    */
-  void printDetectionData();
+  void closeResultOutput();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+// Library
+#include <algorithm>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Local
+#include "SharedFrameRing.h"
+
+namespace
+{
+const size_t MIN_SLOT_COUNT = 2;
+const size_t ALIGNMENT = 64; // a cache line, the pixels of every slot start on one
+const std::chrono::microseconds POLL_INTERVAL(200);
+
+size_t alignUp(size_t aSize)
+{
+    return (aSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+const size_t HEADER_SIZE = alignUp(sizeof(SharedRingHeader));
+const size_t SLOT_HEADER_SIZE = alignUp(sizeof(SharedSlotHeader));
+} // namespace
+
+SharedFrameRing::SharedFrameRing()
+    : mProducer(false), mMapping(nullptr), mMappingSize(0), mHeader(nullptr), mNextFrame(0), mTakenFrame(0), mTakenSlot(0),
+      mTakenSequence(0), mTakenCount(0), mSkippedCount(0), mTornCount(0)
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+    close();
+}
+
+bool SharedFrameRing::create(const std::string &aName, int aWidth, int aHeight, int aType, size_t aSlotCount)
+{
+    close();
+    const size_t pixelSize = CV_ELEM_SIZE(aType);
+    if (aWidth <= 0 || aHeight <= 0 || pixelSize == 0)
+    {
+        return false;
+    }
+
+    const size_t slotCount = std::max(aSlotCount, MIN_SLOT_COUNT);
+    const size_t stride = alignUp((size_t)aWidth * pixelSize);
+    const size_t slotSize = SLOT_HEADER_SIZE + alignUp(stride * (size_t)aHeight);
+    const size_t mappingSize = HEADER_SIZE + slotCount * slotSize;
+
+    // The readers of an older ring keep their mapping, new readers find this one
+    shm_unlink(aName.c_str());
+    const int fileDescriptor = shm_open(aName.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+    if (ftruncate(fileDescriptor, (off_t)mappingSize) == 0)
+    {
+        mMapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    }
+    ::close(fileDescriptor);
+    if (mMapping == nullptr || mMapping == MAP_FAILED)
+    {
+        mMapping = nullptr;
+        shm_unlink(aName.c_str());
+        return false;
+    }
+
+    mName = aName;
+    mProducer = true;
+    mMappingSize = mappingSize;
+    mHeader = new (mMapping) SharedRingHeader();
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        new (static_cast<uchar *>(mMapping) + HEADER_SIZE + i * slotSize) SharedSlotHeader();
+    }
+    mHeader->version = SHARED_RING_VERSION;
+    mHeader->slotCount = (uint32_t)slotCount;
+    mHeader->width = aWidth;
+    mHeader->height = aHeight;
+    mHeader->type = aType;
+    mHeader->stride = stride;
+    mHeader->slotSize = slotSize;
+    mHeader->published.store(0, std::memory_order_relaxed);
+    mNextFrame = 0;
+
+    // The magic is written last, a reader that sees it sees a complete header
+    mHeader->magic.store(SHARED_RING_MAGIC, std::memory_order_release);
+    return true;
+}
+
+bool SharedFrameRing::open(const std::string &aName)
+{
+    close();
+    const int fileDescriptor = shm_open(aName.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) == 0 && (size_t)fileStatus.st_size >= HEADER_SIZE)
+    {
+        mMappingSize = (size_t)fileStatus.st_size;
+        mMapping = mmap(nullptr, mMappingSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    }
+    ::close(fileDescriptor);
+    if (mMapping == nullptr || mMapping == MAP_FAILED)
+    {
+        mMapping = nullptr;
+        return false;
+    }
+
+    // The other fields are only read once the magic shows the header is complete,
+    // then every size of the header is checked against the mapping before a slot is touched
+    mHeader = static_cast<SharedRingHeader *>(mMapping);
+    const bool complete = mHeader->magic.load(std::memory_order_acquire) == SHARED_RING_MAGIC;
+    const size_t pixelSize = complete ? CV_ELEM_SIZE(mHeader->type) : 0;
+    const bool valid = complete && mHeader->version == SHARED_RING_VERSION &&
+                       mHeader->slotCount >= MIN_SLOT_COUNT && mHeader->width > 0 && mHeader->height > 0 && pixelSize > 0 &&
+                       mHeader->stride >= (size_t)mHeader->width * pixelSize &&
+                       mHeader->slotSize >= SLOT_HEADER_SIZE + mHeader->stride * (size_t)mHeader->height &&
+                       mHeader->slotSize % ALIGNMENT == 0 && HEADER_SIZE + mHeader->slotCount * mHeader->slotSize <= mMappingSize;
+    if (valid == false)
+    {
+        close();
+        return false;
+    }
+
+    // The frames published before the reader came are not counted as skipped
+    const uint64_t published = mHeader->published.load(std::memory_order_acquire);
+    mName = aName;
+    mProducer = false;
+    mTakenFrame = (published > 0) ? published - 1 : 0;
+    mTakenSlot = mHeader->slotCount;
+    mTakenCount = 0;
+    mSkippedCount = 0;
+    mTornCount = 0;
+    return true;
+}
+
+void SharedFrameRing::close()
+{
+    if (mMapping != nullptr)
+    {
+        munmap(mMapping, mMappingSize);
+        if (mProducer)
+        {
+            shm_unlink(mName.c_str());
+        }
+    }
+    mMapping = nullptr;
+    mMappingSize = 0;
+    mHeader = nullptr;
+    mProducer = false;
+}
+
+bool SharedFrameRing::isOpen() const
+{
+    return mMapping != nullptr;
+}
+
+bool SharedFrameRing::publish(const Mat &aFrame, std::chrono::steady_clock::time_point aCaptureTime)
+{
+    if (mProducer == false || aFrame.rows != mHeader->height || aFrame.cols != mHeader->width || aFrame.type() != mHeader->type)
+    {
+        return false;
+    }
+
+    const uint64_t frame = mNextFrame++;
+    const size_t slot = (size_t)(frame % mHeader->slotCount);
+    SharedSlotHeader *header = slotHeader(slot);
+
+    // Odd while the pixels change, the readers of the previous frame in this slot see it torn
+    header->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Mat pixels(mHeader->height, mHeader->width, mHeader->type, slotPixels(slot), mHeader->stride);
+    aFrame.copyTo(pixels);
+    header->captureTime.store(std::chrono::duration_cast<std::chrono::nanoseconds>(aCaptureTime.time_since_epoch()).count(),
+                              std::memory_order_relaxed);
+    header->sequence.store(2 * frame + 2, std::memory_order_release);
+    mHeader->published.store(frame + 1, std::memory_order_release);
+    return true;
+}
+
+bool SharedFrameRing::acquire(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime, std::chrono::steady_clock::duration aTimeout)
+{
+    release();
+    if (mHeader == nullptr || mProducer)
+    {
+        return false;
+    }
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + aTimeout;
+    while (true)
+    {
+        const uint64_t published = mHeader->published.load(std::memory_order_acquire);
+        if (published > mTakenFrame)
+        {
+            // Always the newest frame, the older ones are skipped
+            const uint64_t frame = published - 1;
+            const size_t slot = (size_t)(frame % mHeader->slotCount);
+            const SharedSlotHeader *header = slotHeader(slot);
+            const uint64_t sequence = header->sequence.load(std::memory_order_acquire);
+            if (sequence == 2 * frame + 2)
+            {
+                mSkippedCount += frame - mTakenFrame;
+                mTakenFrame = published;
+                mTakenSlot = slot;
+                mTakenSequence = sequence;
+                mTakenCount++;
+
+                const std::chrono::nanoseconds captureTime(header->captureTime.load(std::memory_order_relaxed));
+                aCaptureTime = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(captureTime));
+                aFrame = Mat(mHeader->height, mHeader->width, mHeader->type, slotPixels(slot), mHeader->stride);
+                return true;
+            }
+            // The producer lapped the ring and writes this slot again, a newer frame is published soon
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+}
+
+bool SharedFrameRing::intact() const
+{
+    if (mHeader == nullptr || mTakenSlot >= mHeader->slotCount)
+    {
+        return false;
+    }
+    // Every read of the pixels happens before the sequence is read again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotHeader(mTakenSlot)->sequence.load(std::memory_order_relaxed) == mTakenSequence;
+}
+
+void SharedFrameRing::release()
+{
+    if (mHeader == nullptr || mTakenSlot >= mHeader->slotCount)
+    {
+        return;
+    }
+    if (intact() == false)
+    {
+        mTornCount++;
+    }
+    mTakenSlot = mHeader->slotCount;
+}
+
+uint64_t SharedFrameRing::takenCount() const
+{
+    return mTakenCount;
+}
+
+uint64_t SharedFrameRing::skippedCount() const
+{
+    return mSkippedCount;
+}
+
+uint64_t SharedFrameRing::tornCount() const
+{
+    return mTornCount;
+}
+
+SharedSlotHeader *SharedFrameRing::slotHeader(size_t aSlot) const
+{
+    return reinterpret_cast<SharedSlotHeader *>(static_cast<uchar *>(mMapping) + HEADER_SIZE + aSlot * mHeader->slotSize);
+}
+
+uchar *SharedFrameRing::slotPixels(size_t aSlot) const
+{
+    return reinterpret_cast<uchar *>(slotHeader(aSlot)) + SLOT_HEADER_SIZE;
+}
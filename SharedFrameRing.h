@@ -0,0 +1,160 @@
+#ifndef SHARED_FRAME_RING_H_
+#define SHARED_FRAME_RING_H_
+
+// Library
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief The header at the start of the shared memory, written once by the producer
+ */
+struct SharedRingHeader
+{
+  std::atomic<uint32_t> magic; // SHARED_RING_MAGIC, stored last with release semantics
+  uint32_t version; // SHARED_RING_VERSION
+  uint32_t slotCount;
+  int32_t width;
+  int32_t height;
+  int32_t type;     // the OpenCV type of the pixels, CV_8UC3 for BGR
+  uint64_t stride;  // bytes from one row to the next
+  uint64_t slotSize; // bytes from one slot to the next, the slot header included
+  std::atomic<uint64_t> published; // the number of the newest complete frame + 1, 0 before the first frame
+};
+
+/**
+ * @brief The header of every slot, the pixels follow at the next 64 byte boundary
+ *
+ * The sequence is a seqlock: it is odd while frame n is written (2n + 1)
+ * and even once it is complete (2n + 2). A reader knows the frame stayed
+ * intact when the sequence did not change while it was read.
+ */
+struct SharedSlotHeader
+{
+  std::atomic<uint64_t> sequence;
+  std::atomic<int64_t> captureTime; // nanoseconds of CLOCK_MONOTONIC, the steady clock of every process
+};
+
+const uint32_t SHARED_RING_MAGIC = 0x52464453; // "SDFR"
+const uint32_t SHARED_RING_VERSION = 1;
+
+/**
+ * @brief A ring of frames in POSIX shared memory, written by one capture process and read by any number of detectors
+ *
+ * The producer creates the ring and publishes every frame into the next
+ * slot. A reader maps the ring read-only and takes the newest complete
+ * frame as a Mat header on the slot, without copying it. The producer
+ * never waits for the readers: a reader that holds a frame for longer
+ * than the ring lasts sees it overwritten, which release reports as torn.
+ */
+class SharedFrameRing
+{
+public:
+  SharedFrameRing();
+  ~SharedFrameRing();
+
+  SharedFrameRing(const SharedFrameRing &) = delete;
+  SharedFrameRing &operator=(const SharedFrameRing &) = delete;
+
+  /**
+   * @brief Create the ring as its producer, an existing ring of the same name is replaced
+   * @param aName The name of the shared memory object, such as /shapedetector
+   * @param aWidth The width of the frames
+   * @param aHeight The height of the frames
+   * @param aType The OpenCV type of the pixels
+   * @param aSlotCount The number of frames in the ring, at least 2
+   * @return whether the ring was created
+   */
+  bool create(const std::string &aName, int aWidth, int aHeight, int aType, size_t aSlotCount);
+
+  /**
+   * @brief Open an existing ring as a reader, it is mapped read-only
+   * @param aName The name of the shared memory object
+   * @return whether the ring was opened and has a valid header
+   */
+  bool open(const std::string &aName);
+
+  /**
+   * @brief Unmap the ring, the producer also removes its name
+   */
+  void close();
+
+  /**
+   * @brief Get whether a ring is mapped
+   */
+  bool isOpen() const;
+
+  /**
+   * @brief Copy a frame into the next slot and publish it, producer only
+   * @param aFrame The frame, of the size and type of the ring
+   * @param aCaptureTime The time the frame was captured
+   * @return whether the frame fits the ring
+   */
+  bool publish(const Mat &aFrame, std::chrono::steady_clock::time_point aCaptureTime);
+
+  /**
+   * @brief Take the newest complete frame that was not taken yet, reader only
+   * @param aFrame A header on the slot, valid until release
+   * @param aCaptureTime The time the producer captured the frame
+   * @param aTimeout How long to wait for a new frame before the producer counts as gone
+   * @return false when no new frame was published within the timeout
+   */
+  bool acquire(Mat &aFrame, std::chrono::steady_clock::time_point &aCaptureTime, std::chrono::steady_clock::duration aTimeout);
+
+  /**
+   * @brief Get whether the taken frame was not overwritten yet
+   */
+  bool intact() const;
+
+  /**
+   * @brief Give the taken frame back, counts it as torn when it was overwritten while it was used
+   */
+  void release();
+
+  /**
+   * @brief Get the number of taken frames
+   */
+  uint64_t takenCount() const;
+
+  /**
+   * @brief Get the number of published frames that were never taken
+   */
+  uint64_t skippedCount() const;
+
+  /**
+   * @brief Get the number of taken frames that were overwritten before they were released
+   */
+  uint64_t tornCount() const;
+
+private:
+  /**
+   * @brief Get the header of a slot
+   */
+  SharedSlotHeader *slotHeader(size_t aSlot) const;
+
+  /**
+   * @brief Get the pixels of a slot
+   */
+  uchar *slotPixels(size_t aSlot) const;
+
+  std::string mName;
+  bool mProducer;
+  void *mMapping;
+  size_t mMappingSize;
+  SharedRingHeader *mHeader;
+
+  uint64_t mNextFrame;     // the number of the next frame, producer only
+  uint64_t mTakenFrame;    // the number of the newest taken frame + 1, reader only
+  size_t mTakenSlot;       // the slot of the frame being used, slotCount when none
+  uint64_t mTakenSequence; // the sequence of that slot when it was taken
+  uint64_t mTakenCount;
+  uint64_t mSkippedCount;
+  uint64_t mTornCount;
+};
+
+#endif
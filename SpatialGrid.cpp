@@ -0,0 +1,80 @@
+// Library
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Local
+#include "SpatialGrid.h"
+
+namespace
+{
+const double CELLS_PER_POINT = 4.0; // the grid grows the cells beyond the margin above this
+} // namespace
+
+SpatialGrid::SpatialGrid()
+{
+}
+
+const std::vector<uchar> &SpatialGrid::suppressNearDuplicates(const std::vector<Point> &aPoints, int aMargin)
+{
+    mKeep.assign(aPoints.size(), 0);
+    if (aPoints.empty())
+    {
+        return mKeep;
+    }
+
+    Point minimum = aPoints.front();
+    Point maximum = aPoints.front();
+    for (const Point &point : aPoints)
+    {
+        minimum.x = std::min(minimum.x, point.x);
+        minimum.y = std::min(minimum.y, point.y);
+        maximum.x = std::max(maximum.x, point.x);
+        maximum.y = std::max(maximum.y, point.y);
+    }
+
+    // Cells of the margin, larger when a small margin would give more cells than points
+    const double width = (double)(maximum.x - minimum.x) + 1.0;
+    const double height = (double)(maximum.y - minimum.y) + 1.0;
+    const double sparseCellSize = std::ceil(std::sqrt(width * height / (CELLS_PER_POINT * (double)aPoints.size())));
+    const int cellSize = std::max(std::max(aMargin, 1), (int)sparseCellSize);
+    const int columns = (maximum.x - minimum.x) / cellSize + 1;
+    const int rows = (maximum.y - minimum.y) / cellSize + 1;
+
+    mHeads.assign((size_t)columns * (size_t)rows, -1);
+    mNext.resize(aPoints.size());
+
+    for (size_t i = 0; i < aPoints.size(); i++)
+    {
+        const Point &point = aPoints.at(i);
+        const int column = (point.x - minimum.x) / cellSize;
+        const int row = (point.y - minimum.y) / cellSize;
+
+        // Compare with the points kept so far in the 3x3 cells around it
+        bool duplicate = false;
+        for (int y = std::max(row - 1, 0); y <= std::min(row + 1, rows - 1) && duplicate == false; y++)
+        {
+            for (int x = std::max(column - 1, 0); x <= std::min(column + 1, columns - 1) && duplicate == false; x++)
+            {
+                for (int kept = mHeads.at((size_t)(y * columns + x)); kept >= 0; kept = mNext.at((size_t)kept))
+                {
+                    const Point &keptPoint = aPoints.at((size_t)kept);
+                    if (abs(point.x - keptPoint.x) <= aMargin && abs(point.y - keptPoint.y) <= aMargin)
+                    {
+                        duplicate = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (duplicate == false)
+        {
+            const size_t cell = (size_t)(row * columns + column);
+            mNext.at(i) = mHeads.at(cell);
+            mHeads.at(cell) = (int)i;
+            mKeep.at(i) = 1;
+        }
+    }
+    return mKeep;
+}
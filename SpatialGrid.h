@@ -0,0 +1,42 @@
+#ifndef SPATIAL_GRID_H_
+#define SPATIAL_GRID_H_
+
+// Library
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Namespace
+using namespace cv;
+
+/**
+ * @brief Uniform grid over points for near-duplicate suppression in expected linear time
+ *
+ * The cells are at least as large as the margin, so every point within the
+ * margin of a point lies in its own or one of the 8 neighbouring cells. The
+ * cells are linked lists in two preallocated arrays, kept between calls.
+ */
+class SpatialGrid
+{
+public:
+  SpatialGrid();
+
+  /**
+   * @brief Keep the first of every group of points that are within the margin of each other
+   *
+   * Greedy in the order of the points: a point is kept when no point kept
+   * before it is within the margin on both axes, so the result does not
+   * depend on the grid layout.
+   *
+   * @param aPoints The points
+   * @param aMargin The largest difference per axis of points that are duplicates
+   * @return std::vector<uchar> 1 for every kept point and 0 for every suppressed point
+   */
+  const std::vector<uchar> &suppressNearDuplicates(const std::vector<Point> &aPoints, int aMargin);
+
+private:
+  std::vector<int> mHeads; // first kept point per cell, -1 for an empty cell
+  std::vector<int> mNext;  // next kept point in the same cell, -1 for the last one
+  std::vector<uchar> mKeep;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+// Library
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Bounded lock-free queue for exactly one producer and one consumer thread
+ *
+ * The producer only writes the tail and the consumer only writes the head,
+ * so neither side ever waits on a lock.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+  /**
+   * @brief Create the queue
+   * @param aCapacity The maximum number of queued elements
+   */
+  explicit SpscQueue(size_t aCapacity)
+      : mBuffer(aCapacity + 1), mHead(0), mTail(0)
+  {
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  /**
+   * @brief Add an element, only called by the producer
+   * @param aValue The element to add
+   * @return false when the queue is full
+   */
+  bool push(const T &aValue)
+  {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    const size_t nextTail = next(tail);
+    if (nextTail == mHead.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    mBuffer[tail] = aValue;
+    mTail.store(nextTail, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Take the oldest element, only called by the consumer
+   * @param aValue The element that was taken
+   * @return false when the queue is empty
+   */
+  bool pop(T &aValue)
+  {
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mTail.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    aValue = mBuffer[head];
+    mHead.store(next(head), std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Check whether the queue is empty, exact only on the consumer thread
+   */
+  bool empty() const
+  {
+    return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+  }
+
+private:
+  size_t next(size_t aIndex) const
+  {
+    return (aIndex + 1 == mBuffer.size()) ? 0 : aIndex + 1;
+  }
+
+  static const size_t CACHE_LINE_SIZE = 64;
+
+  std::vector<T> mBuffer;
+  char mHeadPadding[CACHE_LINE_SIZE];
+  std::atomic<size_t> mHead; // written by the consumer
+  char mTailPadding[CACHE_LINE_SIZE]; // keeps head and tail on separate cache lines
+  std::atomic<size_t> mTail; // written by the producer
+};
+
+#endif
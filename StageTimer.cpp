@@ -0,0 +1,90 @@
+// Library
+#include <atomic>
+
+// Local
+#include "StageTimer.h"
+
+std::string StageToString(Stage aStage)
+{
+    switch (aStage)
+    {
+        case Stage::CAPTURE:
+            return "capture";
+        case Stage::COLOR:
+            return "color";
+        case Stage::NOISE:
+            return "noise";
+        case Stage::CONTOURS:
+            return "contours";
+        case Stage::CLASSIFY:
+            return "classify";
+        case Stage::DRAW:
+            return "draw";
+        case Stage::DISPLAY:
+            return "display";
+        case Stage::COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+StageProfile::StageProfile()
+    : mLastReport(std::chrono::steady_clock::now())
+{
+}
+
+void StageProfile::add(Stage aStage, std::chrono::steady_clock::duration aDuration)
+{
+    mHistograms[(size_t)aStage].add(aDuration);
+}
+
+const LatencyHistogram &StageProfile::histogram(Stage aStage) const
+{
+    return mHistograms[(size_t)aStage];
+}
+
+void StageProfile::clear()
+{
+    for (LatencyHistogram &histogram : mHistograms)
+    {
+        histogram.clear();
+    }
+    mLastReport = std::chrono::steady_clock::now();
+}
+
+void StageProfile::print(std::ostream &aStream) const
+{
+#if SHAPEDETECTOR_STAGE_TIMING
+    aStream << "Stage timing (wall clock):" << std::endl;
+    for (size_t i = 0; i < (size_t)Stage::COUNT; i++)
+    {
+        if (mHistograms[i].count() > 0)
+        {
+            mHistograms[i].printSummary(aStream, "\t" + StageToString(Stage(i)));
+        }
+    }
+#else
+    // Once per process, a live mode prints at the end of every run
+    static std::atomic<bool> noticePrinted(false);
+    if (noticePrinted.exchange(true) == false)
+    {
+        aStream << "Stage timing is compiled out (STAGE_TIMING=OFF)" << std::endl;
+    }
+#endif
+}
+
+void StageProfile::printPeriodically(std::ostream &aStream, std::chrono::steady_clock::duration aInterval)
+{
+#if SHAPEDETECTOR_STAGE_TIMING
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (aInterval > std::chrono::steady_clock::duration::zero() && now - mLastReport >= aInterval)
+    {
+        print(aStream);
+        mLastReport = now;
+    }
+#else
+    // Nothing is timed, the notice is printed at exit
+    (void)aStream;
+    (void)aInterval;
+#endif
+}
@@ -0,0 +1,121 @@
+#ifndef STAGE_TIMER_H_
+#define STAGE_TIMER_H_
+
+// Library
+#include <chrono>
+#include <ostream>
+#include <string>
+
+// Local
+#include "LatencyHistogram.h"
+
+// Set to 0 by the STAGE_TIMING CMake option to compile every stage timer out
+#ifndef SHAPEDETECTOR_STAGE_TIMING
+#define SHAPEDETECTOR_STAGE_TIMING 1
+#endif
+
+/**
+ * @brief The timed stages of a frame
+ */
+enum class Stage
+{
+  CAPTURE,  // waiting for a camera frame or decoding an image
+  COLOR,    // the color masks
+  NOISE,    // the noise filter
+  CONTOURS, // labeling and tracing
+  CLASSIFY, // the features and the queries
+  DRAW,     // the contours and the text on the result image
+  DISPLAY,  // showing the windows and waiting for a key
+  COUNT
+};
+
+/**
+ * @brief Convert a stage to its name
+ */
+std::string StageToString(Stage aStage);
+
+/**
+ * @brief The wall-clock time histogram of every stage
+ *
+ * The histograms take samples from every thread without locks, the stages
+ * of a pipeline add to them concurrently.
+ */
+class StageProfile
+{
+public:
+  StageProfile();
+
+  /**
+   * @brief Add the time a stage took
+   * @param aStage The stage
+   * @param aDuration The time it took
+   */
+  void add(Stage aStage, std::chrono::steady_clock::duration aDuration);
+
+  /**
+   * @brief Get the histogram of a stage
+   */
+  const LatencyHistogram &histogram(Stage aStage) const;
+
+  /**
+   * @brief Remove every sample, not while stages add to it
+   */
+  void clear();
+
+  /**
+   * @brief Print the percentiles of every stage that has samples, without stage timing only a notice, once
+   * @param aStream The stream to print to
+   */
+  void print(std::ostream &aStream) const;
+
+  /**
+   * @brief Print when an interval has passed since the last time, only called by one thread, nothing without stage timing
+   * @param aStream The stream to print to
+   * @param aInterval The time between two reports, 0 never prints
+   */
+  void printPeriodically(std::ostream &aStream, std::chrono::steady_clock::duration aInterval);
+
+private:
+  LatencyHistogram mHistograms[(size_t)Stage::COUNT];
+  std::chrono::steady_clock::time_point mLastReport;
+};
+
+#if SHAPEDETECTOR_STAGE_TIMING
+/**
+ * @brief Adds the wall-clock time from its construction to its destruction to a stage
+ */
+class ScopedStageTimer
+{
+public:
+  ScopedStageTimer(StageProfile &aProfile, Stage aStage)
+      : mProfile(aProfile), mStage(aStage), mStart(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~ScopedStageTimer()
+  {
+    mProfile.add(mStage, std::chrono::steady_clock::now() - mStart);
+  }
+
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+private:
+  StageProfile &mProfile;
+  Stage mStage;
+  std::chrono::steady_clock::time_point mStart;
+};
+#else
+/**
+ * @brief The compiled out timer, an empty class that reads no clock
+ */
+class ScopedStageTimer
+{
+public:
+  ScopedStageTimer(StageProfile &, Stage)
+  {
+  }
+};
+#endif
+
+#endif
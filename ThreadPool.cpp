@@ -0,0 +1,124 @@
+// Local
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t aThreadCount)
+    : mQueuedCount(0), mUnfinishedCount(0), mNextQueue(0), mStolenCount(0), mStopping(false)
+{
+    size_t threadCount = (aThreadCount > 0) ? aThreadCount : 1;
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        mQueues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        mThreads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        mStopping = true;
+    }
+    mWorkCondition.notify_all();
+
+    for (std::thread &thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(Task aTask)
+{
+    mUnfinishedCount++;
+
+    // Counted before it is queued, a thief that takes it at once must not take the count below zero
+    {
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        mQueuedCount++;
+    }
+    size_t queueIndex = mNextQueue++ % mQueues.size();
+    {
+        std::lock_guard<std::mutex> lock(mQueues.at(queueIndex)->mutex);
+        mQueues.at(queueIndex)->tasks.push_back(std::move(aTask));
+    }
+    mWorkCondition.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mStateMutex);
+    mDoneCondition.wait(lock, [this] { return mUnfinishedCount == 0; });
+}
+
+size_t ThreadPool::size() const
+{
+    return mThreads.size();
+}
+
+size_t ThreadPool::stolenCount() const
+{
+    return mStolenCount;
+}
+
+bool ThreadPool::takeTask(size_t aWorker, Task &aTask)
+{
+    // Newest own task first, it is most likely still in the cache
+    {
+        WorkerQueue &ownQueue = *mQueues.at(aWorker);
+        std::lock_guard<std::mutex> lock(ownQueue.mutex);
+        if (ownQueue.tasks.empty() == false)
+        {
+            aTask = std::move(ownQueue.tasks.back());
+            ownQueue.tasks.pop_back();
+            mQueuedCount--;
+            return true;
+        }
+    }
+
+    // Steal the oldest task of the next worker that has one
+    for (size_t offset = 1; offset < mQueues.size(); offset++)
+    {
+        WorkerQueue &victimQueue = *mQueues.at((aWorker + offset) % mQueues.size());
+        std::lock_guard<std::mutex> lock(victimQueue.mutex);
+        if (victimQueue.tasks.empty() == false)
+        {
+            aTask = std::move(victimQueue.tasks.front());
+            victimQueue.tasks.pop_front();
+            mQueuedCount--;
+            mStolenCount++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t aWorker)
+{
+    while (true)
+    {
+        Task task;
+        if (takeTask(aWorker, task))
+        {
+            task(aWorker);
+
+            if (--mUnfinishedCount == 0)
+            {
+                std::lock_guard<std::mutex> lock(mStateMutex);
+                mDoneCondition.notify_all();
+            }
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(mStateMutex);
+            mWorkCondition.wait(lock, [this] { return mStopping || mQueuedCount > 0; });
+            if (mStopping && mQueuedCount == 0)
+            {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+// Library
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing thread pool
+ *
+ * Every worker owns a task queue. A worker takes its newest task first and
+ * steals the oldest task of another worker when its own queue is empty.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * @brief A task, receives the index of the worker that runs it
+   */
+  typedef std::function<void(size_t)> Task;
+
+  /**
+   * @brief Start the worker threads
+   * @param aThreadCount The number of workers, at least one is started
+   */
+  explicit ThreadPool(size_t aThreadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Add a task, tasks are spread round-robin over the worker queues
+   * @param aTask The task to run
+   */
+  void submit(Task aTask);
+
+  /**
+   * @brief Block until every submitted task has finished
+   */
+  void wait();
+
+  /**
+   * @brief Get the number of workers
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get the number of tasks that were stolen from another worker
+   */
+  size_t stolenCount() const;
+
+private:
+  /**
+   * @brief The task queue of one worker
+   */
+  struct WorkerQueue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  /**
+   * @brief Take a task from the own queue or steal one from another worker
+   * @param aWorker The index of the worker
+   * @param aTask The task that was taken
+   * @return whether a task was taken
+   */
+  bool takeTask(size_t aWorker, Task &aTask);
+
+  /**
+   * @brief The loop that runs on every worker thread
+   * @param aWorker The index of the worker
+   */
+  void workerLoop(size_t aWorker);
+
+  std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+  std::vector<std::thread> mThreads;
+
+  std::mutex mStateMutex;
+  std::condition_variable mWorkCondition;
+  std::condition_variable mDoneCondition;
+
+  std::atomic<size_t> mQueuedCount;     // tasks waiting in a queue
+  std::atomic<size_t> mUnfinishedCount; // tasks submitted but not finished
+  std::atomic<size_t> mNextQueue;
+  std::atomic<size_t> mStolenCount;
+  bool mStopping;
+};
+
+#endif
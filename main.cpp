@@ -5,32 +5,233 @@
 #include <sstream>
 #include <string>
 #include <memory>
+#include <thread>
+#include <algorithm>
+#include <vector>
 #include <stdlib.h>
 
 /// Local
 #include "Shapedetector.h"
 
+/**
+ * @brief Print how the program is used
+ */
+static void printUsage()
+{
+    std::cout << "Error: invalid arguments or filepath, usage:" << std::endl;
+    std::cout << "\tWebcam mode:\t\tshapedetector [device id|video file|image sequence]" << std::endl;
+    std::cout << "\tBatch mode:\t\tshapedetector [device id|video file|image sequence] [batchfile]" << std::endl;
+    std::cout << "\tPublish mode:\t\tshapedetector --publish [ring name] [device id|video file|image sequence]" << std::endl;
+    std::cout << "\tImage mode:\t\tshapedetector --images [directory|pattern] --batch [batchfile] [--threads n] [--scaling]" << std::endl;
+    std::cout << "\tCapture options:\t--capture-policy [latest|every|inline] --ring-size [n] --pipeline-depth [n] --track-interval [n] --change-threshold [t] --stage-report [seconds]" << std::endl;
+    std::cout << "\tColor options:\t\t--color-lut [bits per channel, 0 = fused kernel] --pyramid-levels [n]" << std::endl;
+    std::cout << "\tProfile option:\t\t--profile [file, calibrated and saved when it does not exist] [--watch-profile]" << std::endl;
+    std::cout << "\tOutput options:\t\t--output [file|pipe|unix:socket|-] --output-format [jsonl|binary]" << std::endl;
+    std::cout << "\tServer option:\t\t--serve [unix:socket|tcp:port], live modes only" << std::endl;
+}
+
+/**
+ * @brief Open the result output when one is given
+ * @return whether there is no output or it was opened
+ */
+static bool openResultOutput(Shapedetector &aShapeDetector, const std::string &aTarget, SinkFormat aFormat)
+{
+    if (aTarget.empty() || aShapeDetector.setResultOutput(aTarget, aFormat))
+    {
+        return true;
+    }
+    std::cout << "Error: could not open the result output (" << aTarget << ")" << std::endl;
+    return false;
+}
+
+/**
+ * @brief Start the result server when an address is given
+ * @return whether there is no address or the server listens
+ */
+static bool openResultServer(Shapedetector &aShapeDetector, const std::string &aAddress)
+{
+    if (aAddress.empty() || aShapeDetector.setResultServer(aAddress))
+    {
+        return true;
+    }
+    std::cout << "Error: could not serve results on " << aAddress << std::endl;
+    return false;
+}
+
 int main(int argc, char **argv)
 {
-    if (argc > 1)
+    // Named options, everything else is a positional argument
+    std::vector<std::string> positionalArguments;
+    std::string imagesPath;
+    std::string batchPath;
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    bool reportScaling = false;
+    bool watchProfile = false;
+    CapturePolicy capturePolicy = CapturePolicy::LATEST_FRAME;
+    size_t ringSize = 4;
+    size_t pipelineDepth = 0;
+    int colorLutBits = 0;
+    size_t trackInterval = 0;
+    double changeThreshold = 0.0;
+    int pyramidLevels = 0;
+    double stageReportInterval = 10.0;
+    std::string outputTarget;
+    std::string serveAddress;
+    std::string publishName;
+    std::string profilePath;
+    SinkFormat outputFormat = SinkFormat::JSON_LINES;
+    bool validOptions = true;
+
+    for (int i = 1; i < argc; i++)
     {
-        Shapedetector shapeDetector; // create shape detector
+        const std::string argument = argv[i];
+        if (argument == SCALING_OPTION)
+        {
+            reportScaling = true;
+        }
+        else if (argument == WATCH_PROFILE_OPTION)
+        {
+            watchProfile = true;
+        }
+        else if (argument.compare(0, 2, "--") != 0)
+        {
+            positionalArguments.push_back(argument);
+        }
+        else if (i + 1 >= argc)
+        {
+            validOptions = false;
+        }
+        else if (argument == IMAGES_OPTION)
+        {
+            imagesPath = argv[++i];
+        }
+        else if (argument == BATCH_OPTION)
+        {
+            batchPath = argv[++i];
+        }
+        else if (argument == THREADS_OPTION)
+        {
+            threadCount = (size_t)std::max(1, atoi(argv[++i]));
+        }
+        else if (argument == CAPTURE_POLICY_OPTION)
+        {
+            validOptions = FrameGrabber::StringToPolicy(argv[++i], capturePolicy) && validOptions;
+        }
+        else if (argument == RING_SIZE_OPTION)
+        {
+            ringSize = (size_t)std::max(1, atoi(argv[++i]));
+        }
+        else if (argument == PIPELINE_DEPTH_OPTION)
+        {
+            pipelineDepth = (size_t)std::max(0, atoi(argv[++i]));
+        }
+        else if (argument == COLOR_LUT_OPTION)
+        {
+            colorLutBits = std::min(std::max(0, atoi(argv[++i])), 8);
+        }
+        else if (argument == TRACK_INTERVAL_OPTION)
+        {
+            trackInterval = (size_t)std::max(0, atoi(argv[++i]));
+        }
+        else if (argument == CHANGE_THRESHOLD_OPTION)
+        {
+            changeThreshold = std::max(0.0, atof(argv[++i]));
+        }
+        else if (argument == PYRAMID_LEVELS_OPTION)
+        {
+            pyramidLevels = std::min(std::max(0, atoi(argv[++i])), 3);
+        }
+        else if (argument == STAGE_REPORT_OPTION)
+        {
+            stageReportInterval = std::max(0.0, atof(argv[++i]));
+        }
+        else if (argument == PROFILE_OPTION)
+        {
+            profilePath = argv[++i];
+        }
+        else if (argument == OUTPUT_OPTION)
+        {
+            outputTarget = argv[++i];
+        }
+        else if (argument == PUBLISH_OPTION)
+        {
+            publishName = argv[++i];
+        }
+        else if (argument == SERVE_OPTION)
+        {
+            serveAddress = argv[++i];
+        }
+        else if (argument == OUTPUT_FORMAT_OPTION)
+        {
+            validOptions = ResultSink::StringToFormat(argv[++i], outputFormat) && validOptions;
+        }
+        else
+        {
+            validOptions = false;
+        }
+    }
+
+    const size_t positionalArgc = positionalArguments.size() + 1; // including the program name
 
-        if (argc == INTERACTIVE_ARGCOUNT)
+    if (validOptions == false || (watchProfile && profilePath.empty()))
+    {
+        printUsage();
+    }
+    else if (imagesPath.empty() == false && batchPath.empty() == false)
+    {
+        Shapedetector shapeDetector; // create shape detector
+        shapeDetector.setColorLut(colorLutBits);
+        shapeDetector.setPyramidLevels(pyramidLevels);
+        shapeDetector.setProfile(profilePath);
+        if (openResultOutput(shapeDetector, outputTarget, outputFormat))
         {
-            shapeDetector.webcamMode(atoi(argv[1]));
+            shapeDetector.imagesMode(imagesPath, batchPath, threadCount, reportScaling);
         }
-        else if (argc == BATCH_ARGCOUNT) // shapedetector [image] [batchfile]
+    }
+    else if (publishName.empty() == false && positionalArgc == INTERACTIVE_ARGCOUNT)
+    {
+        Shapedetector shapeDetector; // only its frame grabber is used
+        shapeDetector.setCaptureOptions(ringSize, capturePolicy);
+        shapeDetector.publishMode(positionalArguments.at(0), publishName);
+    }
+    else if (positionalArgc == INTERACTIVE_ARGCOUNT)
+    {
+        Shapedetector shapeDetector; // create shape detector
+        shapeDetector.setCaptureOptions(ringSize, capturePolicy);
+        shapeDetector.setPipelineDepth(pipelineDepth);
+        shapeDetector.setColorLut(colorLutBits);
+        shapeDetector.setTracking(trackInterval);
+        shapeDetector.setChangeThreshold(changeThreshold);
+        shapeDetector.setPyramidLevels(pyramidLevels);
+        shapeDetector.setProfile(profilePath);
+        shapeDetector.setProfileWatching(watchProfile);
+        shapeDetector.setStageReportInterval(stageReportInterval);
+        if (openResultOutput(shapeDetector, outputTarget, outputFormat) && openResultServer(shapeDetector, serveAddress))
+        {
+            shapeDetector.webcamMode(positionalArguments.at(0));
+        }
+    }
+    else if (positionalArgc == BATCH_ARGCOUNT) // shapedetector [device id|video] [batchfile]
+    {
+        Shapedetector shapeDetector; // create shape detector
+        shapeDetector.setCaptureOptions(ringSize, capturePolicy);
+        shapeDetector.setPipelineDepth(pipelineDepth);
+        shapeDetector.setColorLut(colorLutBits);
+        shapeDetector.setTracking(trackInterval);
+        shapeDetector.setChangeThreshold(changeThreshold);
+        shapeDetector.setPyramidLevels(pyramidLevels);
+        shapeDetector.setProfile(profilePath);
+        shapeDetector.setProfileWatching(watchProfile);
+        shapeDetector.setStageReportInterval(stageReportInterval);
+        if (openResultOutput(shapeDetector, outputTarget, outputFormat) && openResultServer(shapeDetector, serveAddress))
         {
-            shapeDetector.batchMode(atoi(argv[1]), argv[2]);
+            shapeDetector.batchMode(positionalArguments.at(0), positionalArguments.at(1));
         }
     }
     else
     {
-        std::cout << "Error: invalid arguments or filepath, usage:" << std::endl;
-        std::cout << "\tWebcam mode:\t\tshapedetector [device id]" << std::endl;
-        std::cout << "\tBatch mode:\t\tshapedetector [device id] [batchfile]" << std::endl;
+        printUsage();
     }
 
     return 0;
-}
\ No newline at end of file
+}